@@ -20,6 +20,7 @@
 #include <config.h>
 
 #include <src/libext/FileID.h>
+#include <src/libext/FileDescriptorCache.h>
 #include <src/libext/Logger.h>
 #include <iostream>
 #include <string>
@@ -37,6 +38,15 @@
 #include "FileScanner.h"
 #include "OutputTask.h"
 
+/// Maximum number of files the directory traversal can get ahead of the scanners by.  Plenty to keep the scanners'
+/// prefetch windows and read batches full, while keeping the traversal's memory use flat however big the tree is.
+static constexpr size_t f_files_to_scan_queue_capacity = 16*1024;
+
+/// Maximum number of bytes of match text the scanners can get ahead of the output by.  When stdout is slow (a pager,
+/// ssh), the scanners wait for it instead of buffering everything a broad pattern matches.  The queue can overshoot
+/// this by one MatchList.  Files larger than --stream-chunk-size have their matches queued a chunk at a time, so that
+/// is at most one chunk's matches, not one whole file's (unless streaming is disabled with --stream-chunk-size=0).
+static constexpr size_t f_match_queue_capacity_bytes = 64*1024*1024;
 
 int main(int argc, char **argv)
 {
@@ -60,6 +70,7 @@ int main(int argc, char **argv)
 
 		dir_inclusion_manager.AddExclusions(arg_parser.m_excludes);
 
+		type_manager.SetSearchCompressed(arg_parser.m_search_zip);
 		type_manager.CompileTypeTables();
 		dir_inclusion_manager.CompileExclusionTables();
 
@@ -67,19 +78,36 @@ int main(int argc, char **argv)
 
 		// Create the Globber->FileScanner queue.
 		sync_queue<std::shared_ptr<FileID>> files_to_scan_queue;
+		files_to_scan_queue.set_capacity(f_files_to_scan_queue_capacity);
 
 		// Create the FileScanner->OutputTask queue.
 		sync_queue<MatchList> match_queue;
+		match_queue.set_capacity(f_match_queue_capacity_bytes, [](const MatchList &ml){ return ml.GetNumTextBytes(); });
 
 		// Set up the globber.
 		Globber globber(arg_parser.m_paths, type_manager, dir_inclusion_manager, arg_parser.m_recurse, arg_parser.m_follow_symlinks,
 				arg_parser.m_dirjobs, files_to_scan_queue);
+		globber.SetUseGetdents(arg_parser.m_use_getdents);
+		globber.SetInodeOrder(arg_parser.m_inode_order);
+		globber.SetDirListingCachePath(arg_parser.m_dir_cache_path);
+		globber.SetUseIgnoreFiles(arg_parser.m_use_ignore_files);
+		globber.SetOneFileSystem(arg_parser.m_one_file_system);
+		globber.SetMaxDepth(arg_parser.m_max_depth);
+		globber.SetMaxFileSize(arg_parser.m_max_filesize);
+		globber.SetMinMtime(arg_parser.m_min_mtime);
 
 		// Set up the output task object.
 		OutputTask output_task(arg_parser.m_color, arg_parser.m_nocolor, arg_parser.m_column, match_queue);
 
 		// Create the FileScanner object.
 		std::unique_ptr<FileScanner> file_scanner(FileScanner::Create(files_to_scan_queue, match_queue, arg_parser.m_pattern, arg_parser.m_ignore_case, arg_parser.m_word_regexp, arg_parser.m_pattern_is_literal));
+		file_scanner->SetMmapMinSize(arg_parser.m_use_mmap ? arg_parser.m_mmap_min_size : 0);
+		file_scanner->SetUseIOUring(arg_parser.m_use_io_uring);
+		file_scanner->SetStreamChunkSize(arg_parser.m_stream_chunk_size);
+		file_scanner->SetPrefetchDepth(arg_parser.m_prefetch_depth);
+		file_scanner->SetSkipBinary(arg_parser.m_skip_binary);
+		file_scanner->SetSearchCompressed(arg_parser.m_search_zip);
+		file_scanner->SetSegmentSize(arg_parser.m_segment_size);
 
 		// Start the output task thread.
 		std::thread output_task_thread {&OutputTask::Run, &output_task};
@@ -103,6 +131,7 @@ int main(int argc, char **argv)
 
 		// Close the Globber->FileScanner queue.
 		files_to_scan_queue.close();
+		LOG(INFO) << "Directory traversal waited for the scanners to catch up " << files_to_scan_queue.num_full_waits() << " times.";
 
 		// Wait for all scanner threads to complete.
 		for (auto& scanner_thread_ref : scanner_threads)
@@ -110,9 +139,12 @@ int main(int argc, char **argv)
 			scanner_thread_ref.join();
 		}
 		// All scanner threads completed.
+		LOG(INFO) << "Directory file descriptor cache stats:" << FileDescriptorCache::Instance().GetStats();
 
 		// Close the FileScanner->OutputTask queue.
 		match_queue.close();
+		LOG(INFO) << "Match queue high-water mark: " << match_queue.high_water_mark() << " bytes of match text.  Scanners waited for the output to catch up "
+				<< match_queue.num_full_waits() << " times.";
 
 		// Wait for the output thread to complete.
 		output_task_thread.join();
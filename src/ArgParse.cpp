@@ -31,6 +31,7 @@
 #include <algorithm>
 #include <vector>
 #include <string>
+#include <unordered_set>
 #include <locale>
 #include <thread>
 #include <iostream>
@@ -51,9 +52,13 @@ namespace lmcppop = lmcppop_int::option;
 #if HAVE_LIBPCRE2 == 1
 #include <FileScannerPCRE2.h>
 #endif
+#include <cctype>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <ctime>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -64,10 +69,45 @@ namespace lmcppop = lmcppop_int::option;
 #include "TypeManager.h"
 #include "File.h"
 #include <libext/Logger.h>
+#include <libext/StorageInfo.h>
 #include <libext/Terminal.h>
 
 // The sweet spot for the number of directory tree traversal threads seems to be 4 on Linux with the new DirTree implementation.
-static constexpr size_t f_default_dirjobs = 4;
+static constexpr int f_default_dirjobs = 4;
+
+/// How strongly each StorageKind limits the parallelism we can use, indexed by StorageKind.  With several search
+/// paths, the highest one wins.
+static constexpr int f_storage_kind_precedence[] =
+{
+	0, // UNKNOWN
+	1, // MEMORY
+	2, // SOLID_STATE
+	5, // ROTATIONAL
+	3, // NETWORK
+	4  // FUSE
+};
+
+/// The StorageKind nothing else outranks.  Once we've seen one of these, there's no point in looking any further.
+static constexpr StorageKind f_most_restrictive_storage_kind = StorageKind::ROTATIONAL;
+
+/// Maximum number of filesystems we'll classify when picking the default parallelism.  The probes happen on the main
+/// thread before the traversal starts, so with a huge number of search paths in many directories, we classify the
+/// first few and go with that.
+static constexpr size_t f_max_storage_probes = 16;
+
+// Files at least this large are mmap()ed instead of read() by default.  Below this, the cost of setting up and tearing
+// down the mapping outweighs the savings of not copying the data.
+static constexpr size_t f_default_mmap_min_size = 4*1024*1024;
+
+// Files larger than this are read and scanned in chunks of this size, to bound per-thread memory usage.
+static constexpr size_t f_default_stream_chunk_size = 64*1024*1024;
+
+// Number of files each scanner thread asks the OS to start reading in ahead of the one it's searching.
+static constexpr size_t f_default_prefetch_depth = 4;
+
+// Files (or stream chunks) at least twice this size are split into segments of about this size, which any idle
+// scanner threads can help search.
+static constexpr size_t f_default_segment_size = 8*1024*1024;
 
 
 // Not static, argp.h externs this.
@@ -118,9 +158,17 @@ enum OPT
 	OPT_IGNORE_DIR,
 	OPT_NOIGNORE_DIR,
 	OPT_IGNORE_FILE,
+	OPT_GITIGNORE,
 	OPT_INCLUDE,
 	OPT_EXCLUDE,
 	OPT_FOLLOW,
+	OPT_ONE_FILE_SYSTEM,
+	OPT_MAX_DEPTH,
+	OPT_MAX_FILESIZE,
+	OPT_CHANGED_WITHIN,
+	OPT_NEWER,
+	OPT_SKIP_BINARY,
+	OPT_SEARCH_ZIP,
 	OPT_NOFOLLOW,
 	OPT_RECURSE_SUBDIRS,
 	OPT_ONLY_KNOWN_TYPES,
@@ -131,6 +179,15 @@ enum OPT
 	OPT_TYPE_DEL,
 	OPT_PERF_DIRJOBS,
 	OPT_PERF_SCANJOBS,
+	OPT_PERF_MMAP,
+	OPT_PERF_MMAP_MIN_SIZE,
+	OPT_PERF_IO_URING,
+	OPT_PERF_STREAM_CHUNK_SIZE,
+	OPT_PERF_PREFETCH_DEPTH,
+	OPT_PERF_SEGMENT_SIZE,
+	OPT_PERF_GETDENTS,
+	OPT_PERF_INODE_ORDER,
+	OPT_PERF_DIR_CACHE,
 	OPT_HELP,
 	OPT_HELP_TYPES,
 	OPT_USAGE,
@@ -139,7 +196,6 @@ enum OPT
 	OPT_NOCOLUMN,
 	OPT_TEST_LOG_ALL,
 	OPT_TEST_NOENV_USER,
-	OPT_TEST_USE_MMAP,
 	OPT_BRACKET_NO_STANDIN
 };
 
@@ -150,6 +206,52 @@ enum OPT
 // Not static, argp.h externs this.
 int argp_err_exit_status = STATUS_EX_USAGE;
 
+/**
+ * Parse a duration like "90", "90s", "15m", "1h", "2d", or "1w" into a number of seconds.
+ *
+ * @returns true on success.
+ */
+static bool parse_duration(const char *str, long long *seconds) noexcept
+{
+	if(str == nullptr || !std::isdigit(static_cast<unsigned char>(str[0])))
+	{
+		return false;
+	}
+
+	char *endptr = nullptr;
+	errno = 0;
+	long long value = std::strtoll(str, &endptr, 10);
+	if(errno != 0)
+	{
+		errno = 0;
+		return false;
+	}
+
+	long long multiplier;
+	switch(*endptr)
+	{
+	case '\0':
+	case 's': multiplier = 1; break;
+	case 'm': multiplier = 60; break;
+	case 'h': multiplier = 60*60; break;
+	case 'd': multiplier = 24*60*60; break;
+	case 'w': multiplier = 7*24*60*60; break;
+	default: return false;
+	}
+	if(*endptr != '\0' && endptr[1] != '\0')
+	{
+		// Junk after the unit.
+		return false;
+	}
+	if(value > LLONG_MAX / multiplier)
+	{
+		return false;
+	}
+
+	*seconds = value * multiplier;
+	return true;
+}
+
 /// Arg validity checkers.
 struct Arg: public lmcppop::Arg
 {
@@ -206,6 +308,18 @@ struct Arg: public lmcppop::Arg
 		return lmcppop::ARG_ILLEGAL;
 	}
 
+	static lmcppop::ArgStatus Duration(const lmcppop::Option& option, bool msg)
+	{
+		long long seconds;
+		if(parse_duration(option.arg, &seconds))
+		{
+			return lmcppop::ARG_OK;
+		}
+
+		if (msg) printError("Option '", option, "' requires a duration argument, e.g. 90s, 15m, 1h, 2d, or 1w\n");
+		return lmcppop::ARG_ILLEGAL;
+	}
+
 	template <long limit>
 	static lmcppop::ArgStatus IntegerGreater(const lmcppop::Option& option, bool msg)
 	{
@@ -508,9 +622,17 @@ static std::vector<PreDescriptor> raw_options {
 																													// In ag, this option applies to both files and directories.  For the present, ucg will only apply this to files.
 		// ack-style --ignore-file=FILTER:FILTERARGS
 		{ OPT_IGNORE_FILE, 0, "", "ignore-file", "FILTER:FILTERARGS", Arg::NonEmpty, "Files matching FILTER:FILTERARGS (e.g. ext:txt,cpp) will be ignored." },
+		{ OPT_GITIGNORE, ENABLE, DISABLE, "", "[no]gitignore", "", Arg::None, "[Do not] exclude files and directories matched by the .gitignore and .ignore files found while searching (default: disabled)." },
 		{ OPT_RECURSE_SUBDIRS, ENABLE, "r,R", "recurse", Arg::None, "Recurse into subdirectories (default: on)." },
 		{ OPT_RECURSE_SUBDIRS, DISABLE, "n", "no-recurse", Arg::None, "Do not recurse into subdirectories."},
 		{ OPT_FOLLOW, ENABLE, DISABLE, "", "[no]follow", "", Arg::None, "[Do not] follow symlinks (default: nofollow)." },
+		{ OPT_ONE_FILE_SYSTEM, 0, "x", "one-file-system", Arg::None, "Do not descend into directories on a different filesystem than the path they were found under."},
+		{ OPT_MAX_DEPTH, 0, "", "max-depth", "NUM", Arg::IntegerGreater<-1>, "Descend at most NUM directory levels below the paths given on the command line.  0 searches only the files given on the command line."},
+		{ OPT_MAX_FILESIZE, 0, "", "max-filesize", "NUM_BYTES", Arg::IntegerGreater<-1>, "Ignore files larger than NUM_BYTES."},
+		{ OPT_CHANGED_WITHIN, 0, "", "changed-within", "DURATION", Arg::Duration, "Only search files modified within the last DURATION, e.g. 90s, 15m, 1h, 2d, or 1w."},
+		{ OPT_NEWER, 0, "", "newer", "FILE", Arg::NonEmpty, "Only search files modified more recently than FILE."},
+		{ OPT_SKIP_BINARY, ENABLE, DISABLE, "", "[no]skip-binary", "", Arg::None, "[Do not] skip files which look like binary files (default: enabled)." },
+		{ OPT_SEARCH_ZIP, 0, "z", "search-zip", Arg::None, "Search the contents of gzip, zstd, xz, and bzip2 compressed files."},
 		{ OPT_ONLY_KNOWN_TYPES, ENABLE, "k", "known-types", Arg::None, "Only search in files of recognized types (default: on)."},
 		{ OPT_TYPE, ENABLE, "", "type", "[no]TYPE", Arg::NonEmpty, "Include only [exclude all] TYPE files.  Types may also be specified as --[no]TYPE."},
 	{ "File type specification:" },
@@ -518,8 +640,17 @@ static std::vector<PreDescriptor> raw_options {
 		{OPT_TYPE_ADD, 0, "", "type-add", "TYPE:FILTER:FILTERARGS", Arg::NonEmpty, "Files FILTERed with the given FILTERARGS are treated as belonging to type TYPE.  Any existing definition of type TYPE is appended to."},
 		{OPT_TYPE_DEL, 0, "", "type-del", "TYPE", Arg::NonEmpty, "Remove any existing definition of type TYPE."},
 	{ "Performance tuning:" },
-		{ OPT_PERF_DIRJOBS, 0, "", "dirjobs", "NUM_JOBS", Arg::IntegerGreater<0>, "Number of directory traversal jobs (std::thread<>s) to use." },
-		{ OPT_PERF_SCANJOBS, 0, "j", "jobs", "NUM_JOBS", Arg::IntegerGreater<0>, "Number of scanner jobs (std::thread<>s) to use."},
+		{ OPT_PERF_DIRJOBS, 0, "", "dirjobs", "NUM_JOBS", Arg::IntegerGreater<0>, "Number of directory traversal jobs (std::thread<>s) to use.  Default depends on the kind of storage searched." },
+		{ OPT_PERF_SCANJOBS, 0, "j", "jobs", "NUM_JOBS", Arg::IntegerGreater<0>, "Number of scanner jobs (std::thread<>s) to use.  Default depends on the kind of storage searched."},
+		{ OPT_PERF_MMAP, ENABLE, DISABLE, "", "[no]mmap", "", Arg::None, "[Do not] mmap() large files instead of read()ing them (default: enabled)."},
+		{ OPT_PERF_MMAP_MIN_SIZE, 0, "", "mmap-min-size", "NUM_BYTES", Arg::IntegerGreater<0>, "Minimum size of files to mmap() (default: 4194304)."},
+		{ OPT_PERF_IO_URING, ENABLE, DISABLE, "", "[no]io-uring", "", Arg::None, "[Do not] read small files in batches via io_uring, where supported (default: enabled)."},
+		{ OPT_PERF_STREAM_CHUNK_SIZE, 0, "", "stream-chunk-size", "NUM_BYTES", Arg::IntegerGreater<0>, "Files larger than this are searched in chunks of this size (default: 67108864)."},
+		{ OPT_PERF_PREFETCH_DEPTH, 0, "", "prefetch-depth", "NUM_FILES", Arg::IntegerGreater<-1>, "Number of files each scanner job starts reading ahead of the one it's searching.  0 disables prefetching (default: 4)."},
+		{ OPT_PERF_SEGMENT_SIZE, 0, "", "segment-size", "NUM_BYTES", Arg::IntegerGreater<-1>, "Large files are split into segments of this size which multiple scanner jobs search in parallel.  0 disables splitting (default: 8388608)."},
+		{ OPT_PERF_GETDENTS, ENABLE, DISABLE, "", "[no]getdents", "", Arg::None, "[Do not] read directories in bulk with getdents64(), where supported (default: enabled)."},
+		{ OPT_PERF_INODE_ORDER, ENABLE, DISABLE, "", "[no]inode-order", "", Arg::None, "[Do not] search the files in each directory in inode number order, which keeps cold-cache reads from rotating disks closer to sequential (default: disabled)."},
+		{ OPT_PERF_DIR_CACHE, 0, "", "dir-cache", "FILE", Arg::NonEmpty, "Keep a cache of directory listings in FILE, and don't re-read directories which haven't been modified since they were cached (default: no cache)."},
 	{ "Miscellaneous:" },
 		{ OPT_NOENV, 0, "", "noenv", Arg::None, "Ignore .ucgrc configuration files."},
 	{ "Informational options:" },
@@ -532,7 +663,6 @@ static std::vector<PreDescriptor> raw_options {
 	// DO NOT USE THESE.  They're going to change and go away without notice.
 		{ OPT_TEST_LOG_ALL, 0, "", "test-log-all", "", Arg::None, "Enable all logging output.", PreDescriptor::hidden_tag() },
 		{ OPT_TEST_NOENV_USER, 0, "", "test-noenv-user", "", Arg::None, "Don't search for or use $HOME/.ucgrc.", PreDescriptor::hidden_tag() },
-		{ OPT_TEST_USE_MMAP, 0, "", "test-use-mmap", "", Arg::None, "Use mmap() to access files being searched.", PreDescriptor::hidden_tag() },
 	// Epilogue Text.
 		{ "\n" "Mandatory or optional arguments to long options are also mandatory or optional for any corresponding short options." "\n", PreDescriptor::arbtext_tag() },
 		// Again, this folderol is to keep the doc[] string in the same format as used by argp.
@@ -715,8 +845,6 @@ void ArgParse::Parse(int argc, char **argv)
 		INFO::Enable(true);
 		DEBUG::Enable(true);
 	}
-	// Handle --test-use-mmap.
-	m_use_mmap = (options[OPT_TEST_USE_MMAP].last()->type() == ENABLE);
 
 	// Work out the interaction between ignore-case and smart-case.
 	for(lmcppop::Option* opt = options[OPT_HANDLE_CASE]; opt; opt = opt->next())
@@ -750,6 +878,49 @@ void ArgParse::Parse(int argc, char **argv)
 		m_recurse = (options[OPT_RECURSE_SUBDIRS].last()->type() == ENABLE);
 	}
 	m_follow_symlinks = (options[OPT_FOLLOW].last()->type() == ENABLE);
+	m_one_file_system = options[OPT_ONE_FILE_SYSTEM];
+	if(lmcppop::Option* opt = options[OPT_MAX_DEPTH])
+	{
+		m_max_depth = std::stoi(opt->last()->arg);
+	}
+	if(lmcppop::Option* opt = options[OPT_MAX_FILESIZE])
+	{
+		m_max_filesize = std::stoll(opt->last()->arg);
+	}
+	if(lmcppop::Option* opt = options[OPT_CHANGED_WITHIN])
+	{
+		long long seconds = 0;
+		parse_duration(opt->last()->arg, &seconds);
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		now.tv_sec -= seconds;
+		SetMinMtime(now);
+	}
+	if(lmcppop::Option* opt = options[OPT_NEWER])
+	{
+		struct stat ref_stat;
+		if(stat(opt->last()->arg, &ref_stat) != 0)
+		{
+			throw ArgParseException("Could not stat --newer reference file \"" + std::string(opt->last()->arg) + "\": " + LOG_STRERROR());
+		}
+		// Strictly newer, like find -newer.
+		struct timespec after = ref_stat.st_mtim;
+		if(++after.tv_nsec >= 1000000000L)
+		{
+			after.tv_nsec = 0;
+			++after.tv_sec;
+		}
+		SetMinMtime(after);
+	}
+	if(options[OPT_SKIP_BINARY])
+	{
+		m_skip_binary = (options[OPT_SKIP_BINARY].last()->type() == ENABLE);
+	}
+	m_search_zip = options[OPT_SEARCH_ZIP];
+	if(options[OPT_GITIGNORE])
+	{
+		m_use_ignore_files = (options[OPT_GITIGNORE].last()->type() == ENABLE);
+	}
 
 	for(lmcppop::Option* opt = options[OPT_IGNORE_DIR]; opt; opt=opt->next())
 	{
@@ -800,27 +971,64 @@ void ArgParse::Parse(int argc, char **argv)
 	{
 		m_jobs = std::stoi(opt->arg);
 	}
+	if(options[OPT_PERF_MMAP])
+	{
+		m_use_mmap = (options[OPT_PERF_MMAP].last()->type() == ENABLE);
+	}
+	if(lmcppop::Option* opt = options[OPT_PERF_MMAP_MIN_SIZE])
+	{
+		m_mmap_min_size = std::stoull(opt->last()->arg);
+	}
+	if(options[OPT_PERF_IO_URING])
+	{
+		m_use_io_uring = (options[OPT_PERF_IO_URING].last()->type() == ENABLE);
+	}
+	if(lmcppop::Option* opt = options[OPT_PERF_STREAM_CHUNK_SIZE])
+	{
+		m_stream_chunk_size = std::stoull(opt->last()->arg);
+	}
+	if(lmcppop::Option* opt = options[OPT_PERF_PREFETCH_DEPTH])
+	{
+		m_prefetch_depth = std::stoull(opt->last()->arg);
+	}
+	else
+	{
+		m_prefetch_depth = f_default_prefetch_depth;
+	}
+	if(lmcppop::Option* opt = options[OPT_PERF_SEGMENT_SIZE])
+	{
+		m_segment_size = std::stoull(opt->last()->arg);
+	}
+	else
+	{
+		m_segment_size = f_default_segment_size;
+	}
+	if(options[OPT_PERF_GETDENTS])
+	{
+		m_use_getdents = (options[OPT_PERF_GETDENTS].last()->type() == ENABLE);
+	}
+	if(options[OPT_PERF_INODE_ORDER])
+	{
+		m_inode_order = (options[OPT_PERF_INODE_ORDER].last()->type() == ENABLE);
+	}
+	if(lmcppop::Option* opt = options[OPT_PERF_DIR_CACHE])
+	{
+		m_dir_cache_path = opt->last()->arg;
+	}
 
 	//// Now set up some defaults which we can only determine after all arg parsing is complete.
 
-	// Number of jobs.
-	if(m_jobs == 0)
-	{
-		// Number of jobs wasn't specified on command line.  Default to the number of cores the std lib says we have.
-		m_jobs = std::thread::hardware_concurrency();
 
-		if(m_jobs == 0)
-		{
-			// std::thread::hardware_concurrency() is broken.  Default to one thread.
-			m_jobs = 1;
-		}
+	// Minimum file size to mmap().
+	if(m_mmap_min_size == 0)
+	{
+		m_mmap_min_size = f_default_mmap_min_size;
 	}
 
-	// Number of directory scanning jobs.
-	if(m_dirjobs == 0)
+	// Streaming chunk size.
+	if(m_stream_chunk_size == 0)
 	{
-		// Wasn't specified on command line.  Use the default.
-		m_dirjobs = f_default_dirjobs;
+		m_stream_chunk_size = f_default_stream_chunk_size;
 	}
 
 	// Search files/directories.
@@ -830,6 +1038,12 @@ void ArgParse::Parse(int argc, char **argv)
 		m_paths.push_back(".");
 	}
 
+	// Number of scanner and directory traversal jobs.
+	if(m_jobs == 0 || m_dirjobs == 0)
+	{
+		ChooseDefaultParallelism();
+	}
+
 	// Is smart-case enabled, and will we otherwise not be ignoring case?
 	if(m_smart_case && !m_ignore_case)
 	{
@@ -855,6 +1069,108 @@ void ArgParse::Parse(int argc, char **argv)
 	}
 }
 
+void ArgParse::SetMinMtime(const struct timespec &min_mtime) noexcept
+{
+	// With both --changed-within and --newer, a file has to pass both, so the later one wins.
+	if(min_mtime.tv_sec > m_min_mtime.tv_sec
+			|| (min_mtime.tv_sec == m_min_mtime.tv_sec && min_mtime.tv_nsec > m_min_mtime.tv_nsec))
+	{
+		m_min_mtime = min_mtime;
+	}
+}
+
+void ArgParse::ChooseDefaultParallelism()
+{
+	int num_cores = std::thread::hardware_concurrency();
+	if(num_cores == 0)
+	{
+		// std::thread::hardware_concurrency() is broken.  Assume one core.
+		num_cores = 1;
+	}
+
+	// Classify the storage under each search path.  When they differ, the kind which tolerates the least
+	// parallelism wins, since oversubscribing a spinning disk costs a lot more than underusing an SSD.
+	// There can be tens of thousands of paths, and on a network filesystem every probe is a round trip, so we don't
+	// look at every one.  Paths in the same directory are taken to be on the same filesystem (the exception being a
+	// mount point, which we live with), and we only classify each filesystem once.
+	StorageKind kind = StorageKind::UNKNOWN;
+	std::unordered_set<std::string> probed_dirs;
+	std::unordered_set<dev_t> probed_devs;
+	for(const auto & path : m_paths)
+	{
+		auto last_slash = path.find_last_of('/');
+		std::string dir = (last_slash == std::string::npos) ? "." : path.substr(0, std::max(last_slash, static_cast<size_t>(1)));
+		if(!probed_dirs.insert(std::move(dir)).second)
+		{
+			continue;
+		}
+		if(probed_dirs.size() > f_max_storage_probes)
+		{
+			LOG(INFO) << "Classified the storage of the first " << f_max_storage_probes << " directories of search paths, not looking at any more.";
+			break;
+		}
+
+		struct stat st;
+		if(stat(path.c_str(), &st) == 0 && !probed_devs.insert(st.st_dev).second)
+		{
+			// Already classified this filesystem.
+			continue;
+		}
+
+		StorageInfo info = GetStorageInfo(path);
+		LOG(INFO) << "Search path '" << path << "' is on filesystem type " << info.m_fs_name << ", storage class " << to_string(info.m_kind) << ".";
+		if(f_storage_kind_precedence[static_cast<int>(info.m_kind)] > f_storage_kind_precedence[static_cast<int>(kind)])
+		{
+			kind = info.m_kind;
+		}
+		if(kind == f_most_restrictive_storage_kind)
+		{
+			break;
+		}
+	}
+
+	int jobs, dirjobs;
+	switch(kind)
+	{
+	case StorageKind::MEMORY:
+		// Purely CPU bound, and readdir() is cheap enough that more than a couple of traversal threads just contend.
+		jobs = num_cores;
+		dirjobs = 2;
+		break;
+	case StorageKind::ROTATIONAL:
+		// Every extra concurrent reader is another seek.
+		jobs = std::min(num_cores, 2);
+		dirjobs = 1;
+		break;
+	case StorageKind::NETWORK:
+		// Latency bound.  Keep more requests in flight than we have cores.
+		jobs = 2 * num_cores;
+		dirjobs = 8;
+		break;
+	case StorageKind::FUSE:
+		// Many FUSE daemons serve one request at a time.
+		jobs = num_cores;
+		dirjobs = 2;
+		break;
+	case StorageKind::SOLID_STATE:
+	default:
+		jobs = num_cores;
+		dirjobs = f_default_dirjobs;
+		break;
+	}
+
+	if(m_jobs == 0)
+	{
+		m_jobs = jobs;
+	}
+	if(m_dirjobs == 0)
+	{
+		m_dirjobs = dirjobs;
+	}
+
+	LOG(INFO) << "Storage class " << to_string(kind) << ", " << num_cores << " cores: using --jobs=" << m_jobs << " --dirjobs=" << m_dirjobs << ".";
+}
+
 void ArgParse::PrintVersionText(FILE* stream)
 {
 	// Print the version string and copyright notice.
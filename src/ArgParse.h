@@ -27,6 +27,7 @@
 #include <vector>
 #include <set>
 #include <cstdio>
+#include <ctime>
 
 
 class TypeManager;
@@ -98,6 +99,15 @@ private:
 
 	void HandleTYPELogic(std::vector<char *> *v);
 
+	/**
+	 * Pick defaults for whichever of m_jobs and m_dirjobs weren't given on the command line, based on the kind of
+	 * storage the search paths are on.
+	 */
+	void ChooseDefaultParallelism();
+
+	/// Raise m_min_mtime to @a min_mtime, if that's later.
+	void SetMinMtime(const struct timespec &min_mtime) noexcept;
+
 	/// If true, ArgParse won't look for or use $HOME/.ucgrc.
 	/// Used for testing.
 	bool m_test_noenv_user { false };
@@ -152,7 +162,53 @@ public:
 
 	bool m_follow_symlinks { false };
 
-	bool m_use_mmap { false };
+	/// Whether to stay on the filesystem each search path is on.
+	bool m_one_file_system { false };
+
+	/// Maximum number of directory levels to descend below the search paths.  -1 means no limit.
+	int m_max_depth { -1 };
+
+	/// Files larger than this are skipped.  -1 means no limit.
+	long long m_max_filesize { -1 };
+
+	/// Files last modified before this are skipped.  All zeroes means no limit.
+	struct timespec m_min_mtime { 0, 0 };
+
+	/// Whether to skip files which look like binary files.
+	bool m_skip_binary { true };
+
+	/// Whether to search the contents of compressed files.
+	bool m_search_zip { false };
+
+	/// Whether to obey .gitignore and .ignore files.
+	bool m_use_ignore_files { false };
+
+	/// Whether to mmap() files of at least m_mmap_min_size bytes instead of read()ing them.
+	bool m_use_mmap { true };
+
+	/// Minimum size of files to mmap().
+	size_t m_mmap_min_size { 0 };
+
+	/// Whether to read small files in batches via io_uring.
+	bool m_use_io_uring { true };
+
+	/// Files larger than this are read and scanned in chunks of this size.
+	size_t m_stream_chunk_size { 0 };
+
+	/// Number of files each scanner thread prefetches ahead of the one it's searching.
+	size_t m_prefetch_depth { 0 };
+
+	/// Size of the segments large files are split into for parallel searching.  0 == don't split files.
+	size_t m_segment_size { 0 };
+
+	/// Whether to read directories with getdents64() instead of readdir().
+	bool m_use_getdents { true };
+
+	/// Whether to sort the files in each directory by inode number before scanning them.
+	bool m_inode_order { false };
+
+	/// The directory listing cache file, or empty for no cache.
+	std::string m_dir_cache_path;
 
 	///@}
 };
@@ -0,0 +1,238 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "BatchFileReader.h"
+
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+
+#include <libext/memory.hpp>
+#include <libext/Logger.h>
+#include <libext/IOUring.h>
+
+/// Number of zeroed bytes we guarantee after the end of the file data, so vectorized code can read past the end.
+static constexpr size_t f_tail_padding = 1024/8;
+
+struct BatchFileReader::impl
+{
+	impl(size_t max_batch_size, size_t max_file_size);
+
+	void Read(const std::vector<std::shared_ptr<FileID>> &files);
+
+#if HAVE_LINUX_IO_URING
+	std::unique_ptr<IOUring> m_ring;
+#endif
+
+	size_t m_max_batch_size { 0 };
+	size_t m_max_file_size { 0 };
+
+	/// Distance between the per-file buffers in m_buffers.
+	size_t m_buffer_stride { 0 };
+
+	/// One buffer for all the files in the batch.
+	std::unique_ptr<char, void(*)(void*)> m_buffers { nullptr, std::free };
+
+	/// Pins on the descriptors of the directories the files in the current batch are being opened relative to.  These
+	/// have to stay alive until the batch is complete.
+	std::vector<FileDescriptorCache::Lease> m_at_dir_leases;
+
+	/// The number of bytes read for each file in the batch, or -1 if it wasn't read.
+	std::vector<ssize_t> m_sizes;
+};
+
+BatchFileReader::impl::impl(size_t max_batch_size, size_t max_file_size)
+{
+#if HAVE_LINUX_IO_URING
+	if(max_batch_size == 0)
+	{
+		return;
+	}
+
+	// Three SQEs per file: openat, read, close.
+	auto ring = std::make_unique<IOUring>(max_batch_size*3);
+	if(!ring->IsValid())
+	{
+		LOG(INFO) << "io_uring not available, falling back to normal reads: " << LOG_STRERROR();
+		return;
+	}
+
+	int retval = ring->RegisterSparseFiles(max_batch_size);
+	if(retval < 0)
+	{
+		LOG(INFO) << "Couldn't register io_uring file slots, falling back to normal reads: " << LOG_STRERROR(-retval);
+		return;
+	}
+
+	m_ring = std::move(ring);
+	m_max_batch_size = max_batch_size;
+	m_max_file_size = max_file_size;
+
+	// We read up to one byte more than m_max_file_size, so we can tell if the file was bigger than that.
+	m_buffer_stride = ((max_file_size + 1 + f_tail_padding + 4095) / 4096) * 4096;
+	m_buffers.reset(static_cast<char*>(overaligned_alloc(4096, m_buffer_stride * max_batch_size)));
+
+	m_at_dir_leases.reserve(max_batch_size);
+	m_sizes.reserve(max_batch_size);
+#else
+	(void)max_batch_size;
+	(void)max_file_size;
+#endif
+}
+
+void BatchFileReader::impl::Read(const std::vector<std::shared_ptr<FileID>> &files)
+{
+	m_at_dir_leases.clear();
+	m_sizes.assign(files.size(), -1);
+
+#if HAVE_LINUX_IO_URING
+	if(!m_ring || files.empty())
+	{
+		return;
+	}
+
+	for(size_t i=0; i<files.size(); ++i)
+	{
+		char *buffer = m_buffers.get() + i*m_buffer_stride;
+
+		// Open the file into fixed file slot i.  If this fails, the linked read and close will be cancelled.
+		// If its directory's descriptor is cached, open it relative to that so the kernel doesn't have to walk the
+		// whole path again.  Either way, the path strings belong to the FileIDs, which outlive the batch.
+		io_uring_sqe *sqe = m_ring->GetSQE();
+		sqe->opcode = IORING_OP_OPENAT;
+		m_at_dir_leases.push_back(files[i]->LeaseAtDirDescriptor());
+		if(m_at_dir_leases.back())
+		{
+			sqe->fd = m_at_dir_leases.back().fd();
+			sqe->addr = reinterpret_cast<uintptr_t>(files[i]->GetBasenameCStr());
+		}
+		else
+		{
+			sqe->fd = AT_FDCWD;
+			sqe->addr = reinterpret_cast<uintptr_t>(files[i]->GetPath().c_str());
+		}
+		sqe->open_flags = O_RDONLY | O_NOCTTY | O_NOATIME;
+		sqe->file_index = i+1;
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = i*3;
+
+		// Read the contents.  A short read (which is what we expect) breaks a normal link, so hard-link the close.
+		sqe = m_ring->GetSQE();
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = i;
+		sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+		sqe->len = m_max_file_size + 1;
+		sqe->off = 0;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+		sqe->user_data = i*3 + 1;
+
+		// Close the fixed file slot.
+		sqe = m_ring->GetSQE();
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->file_index = i+1;
+		sqe->user_data = i*3 + 2;
+	}
+
+	unsigned num_pending = files.size()*3;
+	int retval = m_ring->Submit(num_pending);
+	if(retval < 0)
+	{
+		// Fall back to File for this and all subsequent batches.
+		LOG(INFO) << "io_uring submit failed, disabling batched reads: " << LOG_STRERROR(-retval);
+		m_ring.reset();
+		m_max_batch_size = 0;
+		m_at_dir_leases.clear();
+		return;
+	}
+
+	while(num_pending > 0)
+	{
+		io_uring_cqe *cqe = m_ring->PeekCQE();
+		if(cqe == nullptr)
+		{
+			if(m_ring->Wait(1) < 0)
+			{
+				// Something's badly wrong.  Don't trust anything we've read, and don't use the ring again.
+				LOG(INFO) << "io_uring wait failed, disabling batched reads.";
+				m_sizes.assign(files.size(), -1);
+				m_ring.reset();
+				m_max_batch_size = 0;
+				m_at_dir_leases.clear();
+				return;
+			}
+			continue;
+		}
+
+		auto index = cqe->user_data / 3;
+		if(cqe->user_data % 3 == 1 && cqe->res >= 0 && static_cast<size_t>(cqe->res) <= m_max_file_size)
+		{
+			// Successful read of the whole file.
+			m_sizes[index] = cqe->res;
+			std::memset(m_buffers.get() + index*m_buffer_stride + cqe->res, 0, f_tail_padding);
+		}
+
+		m_ring->SeenCQE();
+		--num_pending;
+	}
+
+	// All the openat()s are done, so the directory descriptors can be evicted again.
+	m_at_dir_leases.clear();
+#endif
+}
+
+BatchFileReader::BatchFileReader(size_t max_batch_size, size_t max_file_size)
+	: m_pimpl(std::make_unique<BatchFileReader::impl>(max_batch_size, max_file_size))
+{
+}
+
+BatchFileReader::~BatchFileReader()
+{
+}
+
+bool BatchFileReader::IsValid() const noexcept
+{
+	return m_pimpl->m_max_batch_size > 0;
+}
+
+size_t BatchFileReader::GetMaxBatchSize() const noexcept
+{
+	return IsValid() ? m_pimpl->m_max_batch_size : 1;
+}
+
+void BatchFileReader::Read(const std::vector<std::shared_ptr<FileID>> &files)
+{
+	m_pimpl->Read(files);
+}
+
+const char * BatchFileReader::data(size_t index) const noexcept
+{
+	if(index >= m_pimpl->m_sizes.size() || m_pimpl->m_sizes[index] < 0)
+	{
+		return nullptr;
+	}
+	return m_pimpl->m_buffers.get() + index*m_pimpl->m_buffer_stride;
+}
+
+size_t BatchFileReader::size(size_t index) const noexcept
+{
+	return (index < m_pimpl->m_sizes.size() && m_pimpl->m_sizes[index] >= 0) ? m_pimpl->m_sizes[index] : 0;
+}
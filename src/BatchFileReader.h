@@ -0,0 +1,83 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_BATCHFILEREADER_H_
+#define SRC_BATCHFILEREADER_H_
+
+#include <config.h>
+
+#include <memory>
+#include <vector>
+
+#include "libext/FileID.h"
+
+/**
+ * Reads the complete contents of batches of small files with as few system calls as possible.
+ *
+ * On Linux with io_uring support, each file in a batch gets an openat()/read()/close() chain of linked SQEs, using
+ * direct (fixed) file descriptors, and the whole batch is submitted to the kernel in one go.  This turns what would
+ * otherwise be at least five blocking syscalls per file into one or two per batch, and lets the kernel keep many
+ * reads in flight at once.
+ *
+ * Files which turn out to be larger than the per-file buffer, or which hit any error, are reported as not read, and
+ * the caller should fall back to reading them via File.  That way error reporting and large file handling stay in one
+ * place.
+ *
+ * Where io_uring isn't available, IsValid() returns false and the caller should use File for everything.
+ */
+class BatchFileReader
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param max_batch_size  Maximum number of files to read in one batch.  0 == disable.
+	 * @param max_file_size   Largest file size which will be read by the batch mechanism.
+	 */
+	BatchFileReader(size_t max_batch_size, size_t max_file_size);
+	~BatchFileReader();
+
+	/// @returns true if batched reads are available.
+	bool IsValid() const noexcept;
+
+	/// @returns The maximum number of files Read() will accept, 1 if !IsValid().
+	size_t GetMaxBatchSize() const noexcept;
+
+	/**
+	 * Read the contents of @a files.  The results are available via data() and size() until the next call to Read().
+	 *
+	 * @param files  The files to read.  Must be no more than GetMaxBatchSize() of them.
+	 */
+	void Read(const std::vector<std::shared_ptr<FileID>> &files);
+
+	/**
+	 * @returns Pointer to the contents of the @a index'th file passed to the last Read(), followed by a vector's worth of
+	 *          zeroed padding, or nullptr if the file wasn't read and should be read via File instead.
+	 */
+	const char * data(size_t index) const noexcept;
+
+	/// @returns The size of the @a index'th file passed to the last Read().  Only valid if data(index) != nullptr.
+	size_t size(size_t index) const noexcept;
+
+private:
+	struct impl;
+	std::unique_ptr<impl> m_pimpl;
+};
+
+#endif /* SRC_BATCHFILEREADER_H_ */
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "BufferPool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include <utility>
+#include <sys/mman.h>
+
+#include <libext/memory.hpp>
+#include <libext/Logger.h>
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer &&other) noexcept
+{
+	if(this != &other)
+	{
+		reset();
+		m_pool = other.m_pool;
+		m_data = other.m_data;
+		m_capacity = other.m_capacity;
+		m_size_class = other.m_size_class;
+		other.m_pool = nullptr;
+		other.m_data = nullptr;
+		other.m_capacity = 0;
+	}
+	return *this;
+}
+
+void BufferPool::Buffer::reset() noexcept
+{
+	if(m_pool != nullptr && m_data != nullptr)
+	{
+		m_pool->Release(*this);
+	}
+	m_pool = nullptr;
+	m_data = nullptr;
+	m_capacity = 0;
+}
+
+BufferPool::~BufferPool() noexcept
+{
+	for(uint8_t size_class = 0; size_class < f_num_classes; ++size_class)
+	{
+		for(char *data : m_slots[size_class].m_free)
+		{
+			Free(data, ClassSize(size_class));
+		}
+	}
+}
+
+BufferPool::Buffer BufferPool::Acquire(size_t size)
+{
+	++m_acquire_count;
+	++m_stats.m_num_acquires;
+
+	Trim();
+
+	Buffer retval;
+	retval.m_pool = this;
+
+	// Find the smallest size class which will hold the request.
+	uint8_t size_class = 0;
+	while(size_class < f_num_classes && ClassSize(size_class) < size)
+	{
+		++size_class;
+	}
+	retval.m_size_class = size_class;
+
+	if(size_class < f_num_classes)
+	{
+		Slot &slot = m_slots[size_class];
+		slot.m_last_used = m_acquire_count;
+		retval.m_capacity = ClassSize(size_class);
+		if(!slot.m_free.empty())
+		{
+			++m_stats.m_num_pool_hits;
+			retval.m_data = slot.m_free.back();
+			slot.m_free.pop_back();
+		}
+		else
+		{
+			retval.m_data = Allocate(retval.m_capacity);
+		}
+	}
+	else
+	{
+		// Too big to pool.
+		retval.m_capacity = size;
+		retval.m_data = Allocate(size);
+	}
+
+	// Zero-out the trailing vector's worth of extra space.
+	std::memset(retval.m_data+size, 0, padding_size);
+
+	return retval;
+}
+
+void BufferPool::Release(Buffer &buffer) noexcept
+{
+	if(buffer.m_size_class < f_num_classes)
+	{
+		Slot &slot = m_slots[buffer.m_size_class];
+		if(slot.m_free.size() < f_max_free_per_class)
+		{
+			slot.m_last_used = m_acquire_count;
+			slot.m_free.push_back(buffer.m_data);
+			return;
+		}
+	}
+
+	Free(buffer.m_data, buffer.m_capacity);
+}
+
+char * BufferPool::Allocate(size_t size)
+{
+	char *retval;
+	size_t alloc_size;
+
+	if(size >= f_huge_class_size)
+	{
+		// Get a region aligned to the huge page size, so that all of it is eligible for huge page backing.
+		// Note that we ask for the extra alignment slop up front and unmap what we don't need.
+		alloc_size = ((size + padding_size + f_huge_class_size - 1) / f_huge_class_size) * f_huge_class_size;
+		void *region = mmap(NULL, alloc_size + f_huge_class_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(region == MAP_FAILED)
+		{
+			throw std::bad_alloc();
+		}
+
+		char *begin = static_cast<char*>(region);
+		char *aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(begin) + f_huge_class_size - 1) & ~(f_huge_class_size - 1));
+		if(aligned != begin)
+		{
+			munmap(begin, aligned - begin);
+		}
+		if(aligned + alloc_size != begin + alloc_size + f_huge_class_size)
+		{
+			munmap(aligned + alloc_size, (begin + alloc_size + f_huge_class_size) - (aligned + alloc_size));
+		}
+		retval = aligned;
+
+#ifdef MADV_HUGEPAGE
+		if(madvise(retval, alloc_size, MADV_HUGEPAGE) == 0)
+		{
+			++m_stats.m_num_huge_allocations;
+		}
+#endif
+	}
+	else
+	{
+		/// @note overaligned_alloc() adds the padding for us.
+		alloc_size = size + padding_size;
+		retval = static_cast<char*>(overaligned_alloc(4096, size));
+	}
+
+	++m_stats.m_num_allocations;
+	m_stats.m_bytes_allocated += alloc_size;
+	m_bytes_held += alloc_size;
+	m_stats.m_peak_bytes_held = std::max(m_stats.m_peak_bytes_held, m_bytes_held);
+
+	LOG(INFO) << "Allocated buffer of " << size << " bytes at " << static_cast<void*>(retval);
+
+	return retval;
+}
+
+void BufferPool::Free(char *data, size_t size) noexcept
+{
+	size_t alloc_size;
+
+	if(size >= f_huge_class_size)
+	{
+		alloc_size = ((size + padding_size + f_huge_class_size - 1) / f_huge_class_size) * f_huge_class_size;
+		munmap(data, alloc_size);
+	}
+	else
+	{
+		alloc_size = size + padding_size;
+		std::free(data);
+	}
+
+	++m_stats.m_num_frees;
+	m_bytes_held -= alloc_size;
+}
+
+void BufferPool::Trim() noexcept
+{
+	for(uint8_t size_class = 0; size_class < f_num_classes; ++size_class)
+	{
+		Slot &slot = m_slots[size_class];
+		if(ClassSize(size_class) < f_huge_class_size || slot.m_free.empty()
+				|| m_acquire_count - slot.m_last_used <= f_max_idle_acquires)
+		{
+			continue;
+		}
+
+		for(char *data : slot.m_free)
+		{
+			Free(data, ClassSize(size_class));
+		}
+		slot.m_free.clear();
+	}
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_BUFFERPOOL_H_
+#define SRC_BUFFERPOOL_H_
+
+#include <config.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <array>
+#include <vector>
+#include <utility>
+
+/**
+ * Collects up buffer allocation stats for a BufferPool.
+ */
+struct BufferPoolStats
+{
+	/**
+	 * Using X-macros to make fields easier to add/rearrange/remove.
+	 */
+#define M_STATLIST \
+	X("Number of buffer requests", m_num_acquires) \
+	X("Number of requests satisfied from the pool", m_num_pool_hits) \
+	X("Number of buffers allocated", m_num_allocations) \
+	X("Number of buffers allocated with huge page backing", m_num_huge_allocations) \
+	X("Number of buffers freed", m_num_frees) \
+	X("Total bytes allocated", m_bytes_allocated) \
+	X("Peak bytes held by the pool", m_peak_bytes_held)
+
+#define X(d,s) size_t s {0};
+	M_STATLIST
+#undef X
+
+	/**
+	 * Friend function stream insertion operator.
+	 */
+	friend std::ostream& operator<<(std::ostream& os, const BufferPoolStats &bps)
+	{
+		return os
+#define X(d,s) << "\n" d ": " << bps. s
+		M_STATLIST
+#undef X
+		;
+	};
+
+#undef M_STATLIST
+};
+
+/**
+ * A per-thread pool of buffers for reading file data into.
+ *
+ * Buffers come in power-of-two size classes.  When a Buffer is released, it goes back into the pool's slot for its
+ * class instead of being freed, so the next request for a similar size is satisfied without going to the allocator.
+ * Large buffers are allocated with mmap() and, where supported, advised to be backed by transparent huge pages, which
+ * cuts down the number of TLB misses and page faults incurred when scanning large files.  Large buffers which
+ * haven't been used in a while are freed, so one huge file doesn't pin its buffer for the life of the thread.
+ *
+ * Every buffer is followed by a vector's worth of padding, which Acquire() zeroes just past the requested size, so
+ * the scanners can read past the end of the data without worrying about it.
+ *
+ * @note Not thread-safe.  The intended use is one BufferPool per thread, as in FileScanner::Run().
+ */
+class BufferPool
+{
+public:
+
+	/// Number of zeroed bytes guaranteed after the requested size of every buffer.
+	static constexpr size_t padding_size = 1024/8;
+
+	/**
+	 * Move-only handle to a buffer from a BufferPool.  Returns the buffer to the pool on destruction.
+	 * The pool must outlive all Buffers acquired from it.
+	 */
+	class Buffer
+	{
+	public:
+		Buffer() noexcept = default;
+		Buffer(Buffer &&other) noexcept { *this = std::move(other); };
+		Buffer& operator=(Buffer &&other) noexcept;
+		Buffer(const Buffer&) = delete;
+		Buffer& operator=(const Buffer&) = delete;
+		~Buffer() noexcept { reset(); };
+
+		char * data() const noexcept { return m_data; };
+
+		/// Usable size of the buffer, not counting the padding.
+		size_t capacity() const noexcept { return m_capacity; };
+
+		explicit operator bool() const noexcept { return m_data != nullptr; };
+
+		/// Return the buffer to its pool, if we have one.
+		void reset() noexcept;
+
+	private:
+		friend class BufferPool;
+
+		BufferPool *m_pool { nullptr };
+		char *m_data { nullptr };
+		size_t m_capacity { 0 };
+
+		/// Index of the pool slot this buffer goes back to.  f_num_classes == not pooled.
+		uint8_t m_size_class { 0 };
+	};
+
+	BufferPool() noexcept = default;
+	~BufferPool() noexcept;
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	/**
+	 * Get a buffer of at least @a size bytes, page-aligned, with BufferPool::padding_size zeroed bytes starting
+	 * at data()+size.  The contents of the rest of the buffer are unspecified.
+	 */
+	Buffer Acquire(size_t size);
+
+	const BufferPoolStats& GetStats() const noexcept { return m_stats; };
+
+private:
+
+	/// The smallest size class.
+	static constexpr size_t f_min_class_size = 64*1024;
+
+	/// Number of size classes.  Anything bigger than the largest one is allocated for the exact size and never pooled.
+	static constexpr size_t f_num_classes = 16;
+
+	/// Size classes at least this big are mmap()ed and eligible for huge pages.
+	static constexpr size_t f_huge_class_size = 2*1024*1024;
+
+	/// A pooled huge-class buffer which goes unused for this many Acquire()s is freed.
+	static constexpr uint64_t f_max_idle_acquires = 256;
+
+	/// Max number of free buffers kept per size class.  A thread rarely has more than two buffers in use at once.
+	static constexpr size_t f_max_free_per_class = 2;
+
+	static size_t ClassSize(uint8_t size_class) noexcept { return f_min_class_size << size_class; };
+
+	void Release(Buffer &buffer) noexcept;
+
+	char * Allocate(size_t size);
+	void Free(char *data, size_t size) noexcept;
+
+	/// Free any huge-class buffers which have been sitting idle too long.
+	void Trim() noexcept;
+
+	struct Slot
+	{
+		/// Free buffers of this class.
+		std::vector<char*> m_free;
+
+		/// Value of m_acquire_count when a buffer of this class was last handed out or returned.
+		uint64_t m_last_used { 0 };
+	};
+
+	std::array<Slot, f_num_classes> m_slots;
+
+	uint64_t m_acquire_count { 0 };
+
+	/// Total bytes currently allocated by this pool, both pooled and in use.
+	size_t m_bytes_held { 0 };
+
+	BufferPoolStats m_stats;
+};
+
+#endif /* SRC_BUFFERPOOL_H_ */
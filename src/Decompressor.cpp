@@ -0,0 +1,488 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "Decompressor.h"
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#include <libext/filesystem.hpp>
+#include <libext/Logger.h>
+
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+#if HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#if HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+#if HAVE_LIBBZ2
+#include <bzlib.h>
+#endif
+
+
+/// Table of compressed file extensions.
+static const struct { const char *m_ext; CompressionType m_type; } f_extensions[] = {
+	{ ".gz", CompressionType::GZIP },
+	{ ".tgz", CompressionType::GZIP },
+	{ ".zst", CompressionType::ZSTD },
+	{ ".xz", CompressionType::XZ },
+	{ ".txz", CompressionType::XZ },
+	{ ".bz2", CompressionType::BZIP2 },
+	{ ".tbz2", CompressionType::BZIP2 },
+};
+
+CompressionType Decompressor::DetectByName(const std::string &path, size_t *ext_len) noexcept
+{
+	for(const auto &e : f_extensions)
+	{
+		size_t len = std::strlen(e.m_ext);
+		if(path.length() > len && path.compare(path.length()-len, len, e.m_ext) == 0)
+		{
+			if(ext_len != nullptr)
+			{
+				*ext_len = len;
+			}
+			return e.m_type;
+		}
+	}
+
+	return CompressionType::NONE;
+}
+
+CompressionType Decompressor::DetectByMagic(const char *data, size_t len) noexcept
+{
+	const unsigned char *d = reinterpret_cast<const unsigned char *>(data);
+
+	if(len >= 2 && d[0] == 0x1F && d[1] == 0x8B)
+	{
+		return CompressionType::GZIP;
+	}
+	if(len >= 4 && d[0] == 0x28 && d[1] == 0xB5 && d[2] == 0x2F && d[3] == 0xFD)
+	{
+		return CompressionType::ZSTD;
+	}
+	if(len >= 6 && std::memcmp(d, "\xFD" "7zXZ\0", 6) == 0)
+	{
+		return CompressionType::XZ;
+	}
+	if(len >= 3 && d[0] == 'B' && d[1] == 'Z' && d[2] == 'h')
+	{
+		return CompressionType::BZIP2;
+	}
+
+	return CompressionType::NONE;
+}
+
+bool Decompressor::IsSupported(CompressionType type) noexcept
+{
+	switch(type)
+	{
+	case CompressionType::GZIP:
+#if HAVE_LIBZ
+		return true;
+#else
+		return false;
+#endif
+	case CompressionType::ZSTD:
+#if HAVE_LIBZSTD
+		return true;
+#else
+		return false;
+#endif
+	case CompressionType::XZ:
+#if HAVE_LIBLZMA
+		return true;
+#else
+		return false;
+#endif
+	case CompressionType::BZIP2:
+#if HAVE_LIBBZ2
+		return true;
+#else
+		return false;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char * Decompressor::GetName(CompressionType type) noexcept
+{
+	switch(type)
+	{
+	case CompressionType::GZIP:
+		return "gzip";
+	case CompressionType::ZSTD:
+		return "zstd";
+	case CompressionType::XZ:
+		return "xz";
+	case CompressionType::BZIP2:
+		return "bzip2";
+	default:
+		return "none";
+	}
+}
+
+Decompressor::Decompressor(int file_descriptor, const std::string &path)
+	: m_file_descriptor(file_descriptor), m_path(path), m_input_buffer(new char[f_input_buffer_size])
+{
+}
+
+bool Decompressor::FillInput()
+{
+	if(m_input_avail > 0)
+	{
+		return true;
+	}
+
+	while(!m_input_eof)
+	{
+		ssize_t retval = read(m_file_descriptor, m_input_buffer.get(), f_input_buffer_size);
+		if(retval < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			throw FileException("read() error on file '" + m_path + "'");
+		}
+		if(retval == 0)
+		{
+			m_input_eof = true;
+			break;
+		}
+		m_input_next = m_input_buffer.get();
+		m_input_avail = retval;
+		return true;
+	}
+
+	return false;
+}
+
+void Decompressor::ThrowCorrupt(const std::string &detail) const
+{
+	throw FileException("error decompressing file '" + m_path + "': " + detail, EIO);
+}
+
+
+#if HAVE_LIBZ
+/**
+ * gzip decompressor.  Handles files consisting of multiple concatenated gzip members, as produced by e.g. pigz or
+ * by cat'ing rotated logs together.
+ */
+class GzipDecompressor : public Decompressor
+{
+public:
+	GzipDecompressor(int file_descriptor, const std::string &path) : Decompressor(file_descriptor, path)
+	{
+		// 16+ == expect a gzip header and trailer.
+		if(inflateInit2(&m_zs, 16+MAX_WBITS) != Z_OK)
+		{
+			throw FileException("couldn't initialize zlib for file '" + path + "'", ENOMEM);
+		}
+	};
+	~GzipDecompressor() override { inflateEnd(&m_zs); };
+
+	size_t Read(char *buffer, size_t len) override
+	{
+		size_t produced = 0;
+
+		while(produced == 0 && !m_done)
+		{
+			if(!FillInput())
+			{
+				if(!m_at_member_boundary)
+				{
+					ThrowCorrupt("unexpected end of data");
+				}
+				m_done = true;
+				break;
+			}
+
+			m_zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(m_input_next));
+			m_zs.avail_in = m_input_avail;
+			m_zs.next_out = reinterpret_cast<Bytef*>(buffer);
+			m_zs.avail_out = len;
+
+			int ret = inflate(&m_zs, Z_NO_FLUSH);
+
+			m_input_next = reinterpret_cast<const char*>(m_zs.next_in);
+			m_input_avail = m_zs.avail_in;
+			produced = len - m_zs.avail_out;
+
+			if(ret == Z_STREAM_END)
+			{
+				// End of this member, there may be another one after it.
+				inflateReset(&m_zs);
+				m_at_member_boundary = true;
+			}
+			else if(ret == Z_OK || ret == Z_BUF_ERROR)
+			{
+				m_at_member_boundary = false;
+			}
+			else if(m_at_member_boundary && produced == 0)
+			{
+				// Trailing garbage after the last member.  gzip ignores this, so will we.
+				m_done = true;
+			}
+			else
+			{
+				ThrowCorrupt(m_zs.msg != nullptr ? m_zs.msg : "corrupt gzip data");
+			}
+		}
+
+		return produced;
+	};
+
+private:
+	z_stream m_zs {};
+	bool m_at_member_boundary { false };
+	bool m_done { false };
+};
+#endif
+
+#if HAVE_LIBZSTD
+/**
+ * Zstandard decompressor.  libzstd handles concatenated frames for us.
+ */
+class ZstdDecompressor : public Decompressor
+{
+public:
+	ZstdDecompressor(int file_descriptor, const std::string &path) : Decompressor(file_descriptor, path)
+	{
+		m_ds = ZSTD_createDStream();
+		if(m_ds == nullptr || ZSTD_isError(ZSTD_initDStream(m_ds)))
+		{
+			ZSTD_freeDStream(m_ds);
+			throw FileException("couldn't initialize libzstd for file '" + path + "'", ENOMEM);
+		}
+	};
+	~ZstdDecompressor() override { ZSTD_freeDStream(m_ds); };
+
+	size_t Read(char *buffer, size_t len) override
+	{
+		ZSTD_outBuffer out { buffer, len, 0 };
+
+		while(out.pos == 0)
+		{
+			if(!FillInput())
+			{
+				if(m_last_ret != 0)
+				{
+					// In the middle of a frame.
+					ThrowCorrupt("unexpected end of data");
+				}
+				break;
+			}
+
+			ZSTD_inBuffer in { m_input_next, m_input_avail, 0 };
+			m_last_ret = ZSTD_decompressStream(m_ds, &out, &in);
+			if(ZSTD_isError(m_last_ret))
+			{
+				ThrowCorrupt(ZSTD_getErrorName(m_last_ret));
+			}
+			m_input_next += in.pos;
+			m_input_avail -= in.pos;
+		}
+
+		return out.pos;
+	};
+
+private:
+	ZSTD_DStream *m_ds { nullptr };
+
+	/// The last return value of ZSTD_decompressStream(), 0 == at a frame boundary.
+	size_t m_last_ret { 0 };
+};
+#endif
+
+#if HAVE_LIBLZMA
+/**
+ * xz/lzma decompressor.
+ */
+class XzDecompressor : public Decompressor
+{
+public:
+	XzDecompressor(int file_descriptor, const std::string &path) : Decompressor(file_descriptor, path)
+	{
+		if(lzma_auto_decoder(&m_ls, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+		{
+			throw FileException("couldn't initialize liblzma for file '" + path + "'", ENOMEM);
+		}
+	};
+	~XzDecompressor() override { lzma_end(&m_ls); };
+
+	size_t Read(char *buffer, size_t len) override
+	{
+		m_ls.next_out = reinterpret_cast<uint8_t*>(buffer);
+		m_ls.avail_out = len;
+
+		while(m_ls.avail_out == len && !m_done)
+		{
+			// With LZMA_CONCATENATED, we have to tell the decoder when there's no more input.
+			lzma_action action = FillInput() ? LZMA_RUN : LZMA_FINISH;
+
+			m_ls.next_in = reinterpret_cast<const uint8_t*>(m_input_next);
+			m_ls.avail_in = m_input_avail;
+
+			lzma_ret ret = lzma_code(&m_ls, action);
+
+			m_input_next = reinterpret_cast<const char*>(m_ls.next_in);
+			m_input_avail = m_ls.avail_in;
+
+			if(ret == LZMA_STREAM_END)
+			{
+				m_done = true;
+			}
+			else if(ret != LZMA_OK)
+			{
+				ThrowCorrupt(ret == LZMA_BUF_ERROR ? "unexpected end of data" : "corrupt xz data");
+			}
+		}
+
+		return len - m_ls.avail_out;
+	};
+
+private:
+	lzma_stream m_ls = LZMA_STREAM_INIT;
+	bool m_done { false };
+};
+#endif
+
+#if HAVE_LIBBZ2
+/**
+ * bzip2 decompressor.  Handles multiple concatenated streams, as produced by e.g. pbzip2.
+ */
+class Bzip2Decompressor : public Decompressor
+{
+public:
+	Bzip2Decompressor(int file_descriptor, const std::string &path) : Decompressor(file_descriptor, path)
+	{
+		Init();
+	};
+	~Bzip2Decompressor() override { BZ2_bzDecompressEnd(&m_bs); };
+
+	size_t Read(char *buffer, size_t len) override
+	{
+		size_t produced = 0;
+
+		while(produced == 0 && !m_done)
+		{
+			if(!FillInput())
+			{
+				if(!m_at_stream_boundary)
+				{
+					ThrowCorrupt("unexpected end of data");
+				}
+				m_done = true;
+				break;
+			}
+
+			m_bs.next_in = const_cast<char*>(m_input_next);
+			m_bs.avail_in = m_input_avail;
+			m_bs.next_out = buffer;
+			m_bs.avail_out = len;
+
+			int ret = BZ2_bzDecompress(&m_bs);
+
+			m_input_next = m_bs.next_in;
+			m_input_avail = m_bs.avail_in;
+			produced = len - m_bs.avail_out;
+
+			if(ret == BZ_STREAM_END)
+			{
+				// End of this stream, there may be another one after it.
+				BZ2_bzDecompressEnd(&m_bs);
+				Init();
+				m_at_stream_boundary = true;
+			}
+			else if(ret == BZ_OK)
+			{
+				m_at_stream_boundary = false;
+			}
+			else if(m_at_stream_boundary && produced == 0)
+			{
+				// Trailing garbage after the last stream.
+				m_done = true;
+			}
+			else
+			{
+				ThrowCorrupt("corrupt bzip2 data");
+			}
+		}
+
+		return produced;
+	};
+
+private:
+	void Init()
+	{
+		m_bs = bz_stream {};
+		if(BZ2_bzDecompressInit(&m_bs, 0, 0) != BZ_OK)
+		{
+			throw FileException("couldn't initialize libbz2 for file '" + m_path + "'", ENOMEM);
+		}
+	};
+
+	bz_stream m_bs {};
+	bool m_at_stream_boundary { false };
+	bool m_done { false };
+};
+#endif
+
+
+std::unique_ptr<Decompressor> Decompressor::Create(CompressionType type, int file_descriptor, const std::string &path)
+{
+	std::unique_ptr<Decompressor> retval;
+
+	switch(type)
+	{
+#if HAVE_LIBZ
+	case CompressionType::GZIP:
+		retval.reset(new GzipDecompressor(file_descriptor, path));
+		break;
+#endif
+#if HAVE_LIBZSTD
+	case CompressionType::ZSTD:
+		retval.reset(new ZstdDecompressor(file_descriptor, path));
+		break;
+#endif
+#if HAVE_LIBLZMA
+	case CompressionType::XZ:
+		retval.reset(new XzDecompressor(file_descriptor, path));
+		break;
+#endif
+#if HAVE_LIBBZ2
+	case CompressionType::BZIP2:
+		retval.reset(new Bzip2Decompressor(file_descriptor, path));
+		break;
+#endif
+	default:
+		throw FileException(std::string("no support for ") + GetName(type) + " decompression compiled in, can't search file '" + path + "'", ENOTSUP);
+		break;
+	}
+
+	return retval;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_DECOMPRESSOR_H_
+#define SRC_DECOMPRESSOR_H_
+
+#include <config.h>
+
+#include <memory>
+#include <string>
+
+/**
+ * The compressed file formats we know about.
+ */
+enum class CompressionType
+{
+	NONE,	//!< Not compressed, or not in a format we recognize.
+	GZIP,	//!< gzip, via zlib.
+	ZSTD,	//!< Zstandard, via libzstd.
+	XZ,		//!< xz/lzma, via liblzma.
+	BZIP2,	//!< bzip2, via libbz2.
+};
+
+/**
+ * Base class for streaming decompressors.  A Decompressor reads compressed data from a file descriptor a buffer at a
+ * time, and hands back the decompressed data in whatever size pieces the caller asks for.  This lets StreamingFile
+ * search a compressed file in bounded memory, without ever writing the decompressed data anywhere.
+ *
+ * Which formats are supported depends on which libraries were available at compile-time; see IsSupported().
+ */
+class Decompressor
+{
+public:
+
+	/**
+	 * Determine the compression type implied by the extension of @a path, e.g. ".gz".
+	 *
+	 * @param path  The file path or basename.
+	 * @param ext_len  If not nullptr, receives the length of the compression extension, including the period.
+	 */
+	static CompressionType DetectByName(const std::string &path, size_t *ext_len = nullptr) noexcept;
+
+	/**
+	 * Determine the compression type from the magic number at the start of the file data.
+	 *
+	 * @param data  The first bytes of the file.
+	 * @param len   Number of bytes at @a data.  Should be at least GetMagicSize().
+	 */
+	static CompressionType DetectByMagic(const char *data, size_t len) noexcept;
+
+	/// Number of bytes from the start of a file DetectByMagic() needs to see.
+	static constexpr size_t GetMagicSize() noexcept { return 6; };
+
+	/// @returns true if support for decompressing @a type was compiled in.
+	static bool IsSupported(CompressionType type) noexcept;
+
+	/// @returns A human-readable name for @a type.
+	static const char * GetName(CompressionType type) noexcept;
+
+	/**
+	 * Factory Method for creating a Decompressor for @a type which reads from @a file_descriptor.
+	 *
+	 * @param type             The compression format.  Must be supported.
+	 * @param file_descriptor  The file to read, positioned at the start of the compressed data.
+	 * @param path             The file's path, for error messages.
+	 * @exception FileException  @a type isn't supported, or the decompression library couldn't be initialized.
+	 */
+	static std::unique_ptr<Decompressor> Create(CompressionType type, int file_descriptor, const std::string &path);
+
+	virtual ~Decompressor() = default;
+
+	/**
+	 * Decompress up to @a len bytes into @a buffer.
+	 *
+	 * @returns The number of bytes decompressed.  0 means the end of the compressed data has been reached.
+	 * @exception FileException  On read errors or corrupt data.
+	 */
+	virtual size_t Read(char *buffer, size_t len) = 0;
+
+protected:
+	Decompressor(int file_descriptor, const std::string &path);
+
+	/**
+	 * If all the compressed input we have has been consumed, read() more from the file.
+	 *
+	 * @returns false if there's no more input and we're at EOF.
+	 */
+	bool FillInput();
+
+	/// Throw a FileException about corrupt data in the file.
+	[[noreturn]] void ThrowCorrupt(const std::string &detail) const;
+
+	int m_file_descriptor;
+
+	std::string m_path;
+
+	/// Size of the compressed input buffer.
+	static constexpr size_t f_input_buffer_size = 128*1024;
+
+	std::unique_ptr<char[]> m_input_buffer;
+
+	/// The next unconsumed byte of compressed input.
+	const char *m_input_next { nullptr };
+
+	/// Number of unconsumed bytes at m_input_next.
+	size_t m_input_avail { 0 };
+
+	bool m_input_eof { false };
+};
+
+#endif /* SRC_DECOMPRESSOR_H_ */
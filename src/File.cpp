@@ -23,20 +23,147 @@
 
 #include <iostream>
 #include <system_error>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <csignal>
+#include <atomic>
 
 #include <fcntl.h>
 #include <libext/Logger.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h> // For preadv2().
 
 
-// @note This gets the unused mmap code below to build on FreeBSD (TrueOS).
+// @note This gets the mmap code below to build on FreeBSD (TrueOS).
 #if !defined(MAP_NORESERVE)
 #define MAP_NORESERVE 0
 #endif
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/// Number of zeroed bytes we guarantee after the end of the file data, so vectorized code can read past the end.
+/// This is the same amount of padding overaligned_alloc() gives us for the read() path.
+static constexpr size_t f_tail_padding = 1024/8;
+
+static long f_page_size = sysconf(_SC_PAGESIZE);
+
+/// Number of bytes at the start of a file which IsBinaryData() looks at.  This is the same size as GNU grep's
+/// initial buffer, and is small enough that we don't spend much on I/O for a file we'll end up skipping.
+static constexpr size_t f_binary_check_size = 32*1024;
+
+#if defined(HAVE_PREADV2) && HAVE_DECL_RWF_NOWAIT
+/// Cleared the first time the kernel tells us it doesn't support RWF_NOWAIT reads.
+static std::atomic<bool> f_nowait_supported {true};
+#endif
+
+/**
+ * A file mapping which some thread may be accessing.  The SIGBUS handler uses these to determine if a fault is due to
+ * the file having been truncated out from under us.  The mapping's data may be scanned by any number of threads at
+ * once (see FileScanner::ScanFileSegmented()), so we can't tell whose mapping faulted from thread-local state.
+ * @note Everything in here is a lock-free atomic, so accessing it from the signal handler is safe.
+ */
+struct ActiveMapping
+{
+	/// true while a File owns this slot.
+	std::atomic<bool> m_in_use;
+	/// Start of the mapping, or nullptr while the slot isn't published.  Set last, after m_size and m_truncated.
+	std::atomic<char*> m_begin;
+	std::atomic<size_t> m_size;
+	std::atomic<int> m_truncated;
+};
+static_assert(ATOMIC_BOOL_LOCK_FREE == 2 && ATOMIC_POINTER_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2
+		&& std::atomic<size_t>::is_always_lock_free, "The SIGBUS handler requires lock-free atomics");
+
+/// Maximum number of files which can be mmap()ed at once.  Each scanner thread only has one File at a time, so this is
+/// plenty.  If they're all in use, we read() the file instead.
+static constexpr int f_max_active_mappings = 256;
+
+/// The process-wide registry of active file mappings.
+static ActiveMapping f_active_mappings[f_max_active_mappings];
+
+/// Claim and publish a slot in f_active_mappings for the mapping at @a begin.  @returns The slot index, or -1 if none are free.
+static int register_mapping(char *begin, size_t size) noexcept
+{
+	for(int i = 0; i < f_max_active_mappings; ++i)
+	{
+		ActiveMapping &am = f_active_mappings[i];
+		if(!am.m_in_use.load(std::memory_order_relaxed) && !am.m_in_use.exchange(true, std::memory_order_acquire))
+		{
+			am.m_size.store(size, std::memory_order_relaxed);
+			am.m_truncated.store(0, std::memory_order_relaxed);
+			am.m_begin.store(begin, std::memory_order_release);
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void unregister_mapping(int slot) noexcept
+{
+	ActiveMapping &am = f_active_mappings[slot];
+	am.m_begin.store(nullptr, std::memory_order_relaxed);
+	am.m_in_use.store(false, std::memory_order_release);
+}
+
+static std::once_flag f_sigbus_handler_installed;
+
+/**
+ * SIGBUS handler.  If the faulting address is in one of the registered file mappings, the file was truncated while
+ * some thread was reading it.  We handle that by mapping zero-filled anonymous pages over the remainder of the file
+ * mapping and returning, which restarts the faulting instruction.  The File then reports the truncation via
+ * File::was_truncated().  Any other SIGBUS gets the default disposition.
+ */
+static void sigbus_handler(int sig, siginfo_t *info, void * /*context*/)
+{
+	char *fault_addr = static_cast<char*>(info->si_addr);
+
+	for(ActiveMapping &am : f_active_mappings)
+	{
+		char *begin = am.m_begin.load(std::memory_order_acquire);
+		size_t size = am.m_size.load(std::memory_order_relaxed);
+		if(begin == nullptr || fault_addr < begin || fault_addr >= begin + size)
+		{
+			continue;
+		}
+
+		char *page = fault_addr - (reinterpret_cast<uintptr_t>(fault_addr) % f_page_size);
+		size_t len = (begin + size) - page;
+		if(mmap(page, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+		{
+			am.m_truncated.store(1, std::memory_order_relaxed);
+			return;
+		}
+		break;
+	}
+
+	// Not ours, or we couldn't recover.  Restore the default action, which will take effect when the
+	// faulting instruction is restarted.
+	signal(sig, SIG_DFL);
+}
 
-File::File(std::shared_ptr<FileID> file_id, std::shared_ptr<ResizableArray<char>> storage) : m_fileid(std::move(file_id)), m_storage(storage)
+static void install_sigbus_handler()
+{
+	struct sigaction sa;
+	sa.sa_sigaction = sigbus_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	if(sigaction(SIGBUS, &sa, nullptr) != 0)
+	{
+		WARN() << "Couldn't install SIGBUS handler: " << LOG_STRERROR();
+	}
+}
+
+bool IsBinaryData(const char *data, size_t len) noexcept
+{
+	return std::memchr(data, '\0', std::min(len, f_binary_check_size)) != nullptr;
+}
+
+File::File(std::shared_ptr<FileID> file_id, std::shared_ptr<BufferPool> storage, size_t mmap_min_size, bool skip_binary)
+	: m_fileid(std::move(file_id)), m_storage(storage), m_skip_binary(skip_binary)
 {
 	int file_descriptor { -1 };
 
@@ -80,8 +207,9 @@ File::File(std::shared_ptr<FileID> file_id, std::shared_ptr<ResizableArray<char>
 		return;
 	}
 
+	m_use_mmap = (mmap_min_size != 0) && (static_cast<size_t>(file_size) >= mmap_min_size);
+
 	// Read or mmap the file into memory.
-	// Note that this closes the file descriptor.
 	// Note: per info here:
 	// http://stackoverflow.com/questions/34498825/io-blksize-seems-just-return-io-bufsize
 	// https://github.com/coreutils/coreutils/blob/master/src/ioblksize.h#L23-L57
@@ -95,13 +223,15 @@ File::File(std::shared_ptr<FileID> file_id, std::shared_ptr<ResizableArray<char>
 	if(m_file_data == MAP_FAILED)
 	{
 		// Mapping failed.
+		m_file_data = nullptr;
+		m_use_mmap = false;
 		ERROR() << "Couldn't map file '" << m_fileid->GetPath() << "'";
 		throw FileException("mmapping file failed", errno);
 	}
 }
 
 
-File::File(const std::string &filename, FileAccessMode fam, FileCreationFlag fcf, std::shared_ptr<ResizableArray<char>> storage)
+File::File(const std::string &filename, FileAccessMode fam, FileCreationFlag fcf, std::shared_ptr<BufferPool> storage)
 	: File(std::make_shared<FileID>(std::make_shared<FileID>(FileID(FileID::path_known_cwd_tag())), filename, fam, fcf), storage)
 {
 }
@@ -112,23 +242,196 @@ File::~File()
 	FreeFileData(m_file_data, m_fileid->GetFileSize());
 }
 
+StreamingFile::StreamingFile(std::shared_ptr<FileID> file_id, std::shared_ptr<BufferPool> storage, size_t chunk_size,
+		CompressionType compression)
+	: m_fileid(std::move(file_id)), m_storage(storage), m_read_size(chunk_size)
+{
+	m_file_descriptor = m_fileid->GetFileDescriptor();
+
+	if(m_file_descriptor == -1)
+	{
+		// Couldn't open the file, throw exception.
+		LOG(DEBUG) << "bad file descriptor: fd=" << m_file_descriptor;
+		throw FileException("StreamingFile constructor: bad file descriptor");
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	(void)posix_fadvise(m_file_descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	if(compression != CompressionType::NONE)
+	{
+		m_decompressor = Decompressor::Create(compression, m_file_descriptor, m_fileid->GetPath());
+	}
+
+	Reserve(m_read_size);
+}
+
+void StreamingFile::Reserve(size_t capacity)
+{
+	if(m_buffer != nullptr && capacity <= m_buffer_capacity)
+	{
+		return;
+	}
+
+	// Get a bigger buffer from the pool and move whatever we have into it.  The old one goes back to the pool.
+	BufferPool::Buffer new_buffer = m_storage->Acquire(capacity);
+	if(m_buffer_fill > 0)
+	{
+		std::memcpy(new_buffer.data(), m_buffer, m_buffer_fill);
+	}
+	m_pooled_buffer = std::move(new_buffer);
+	m_buffer = m_pooled_buffer.data();
+	m_buffer_capacity = capacity;
+}
+
+void StreamingFile::FillBuffer(size_t fill_to)
+{
+	while(!m_eof && m_buffer_fill < fill_to)
+	{
+		ssize_t retval;
+		if(m_decompressor)
+		{
+			retval = m_decompressor->Read(m_buffer+m_buffer_fill, fill_to-m_buffer_fill);
+		}
+		else
+		{
+			retval = read(m_file_descriptor, m_buffer+m_buffer_fill, fill_to-m_buffer_fill);
+		}
+		if(retval < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			throw FileException("read() error on file '" + m_fileid->GetPath() + "'");
+		}
+		if(retval == 0)
+		{
+			m_eof = true;
+			break;
+		}
+		m_buffer_fill += retval;
+	}
+}
+
+bool StreamingFile::IsBinary()
+{
+	FillBuffer(std::min(f_binary_check_size, m_buffer_capacity));
+
+	return IsBinaryData(m_buffer, m_buffer_fill);
+}
+
+bool StreamingFile::NextChunk()
+{
+	if(m_chunk_size > 0)
+	{
+		// Restore the bytes we zeroed last time, then move the carried-over partial line to the front of the buffer.
+		std::memcpy(m_buffer+m_chunk_size, m_saved_tail, std::min(sizeof(m_saved_tail), m_buffer_fill-m_chunk_size));
+		std::memmove(m_buffer, m_buffer+m_chunk_size, m_buffer_fill-m_chunk_size);
+		m_buffer_fill -= m_chunk_size;
+		m_chunk_size = 0;
+	}
+
+	while(true)
+	{
+		// Fill the buffer.
+		FillBuffer(m_buffer_capacity);
+
+		if(m_eof)
+		{
+			// Whatever's left is the last chunk.
+			m_chunk_size = m_buffer_fill;
+			break;
+		}
+
+		// Cut the chunk after the last complete line.
+		// Note that memrchr() isn't portable, and the partial line we're looking back over is usually short anyway.
+		const char *one_past_last_eol = m_buffer + m_buffer_fill;
+		while(one_past_last_eol != m_buffer && *(one_past_last_eol-1) != '\n')
+		{
+			--one_past_last_eol;
+		}
+		if(one_past_last_eol != m_buffer)
+		{
+			m_chunk_size = one_past_last_eol - m_buffer;
+			break;
+		}
+
+		// No newline in the whole buffer.  We have to grow it to fit the line.
+		Reserve(m_buffer_capacity * 2);
+	}
+
+	if(m_chunk_size == 0)
+	{
+		return false;
+	}
+
+	// Zero out the padding after the chunk, saving whatever was there first.
+	std::memcpy(m_saved_tail, m_buffer+m_chunk_size, sizeof(m_saved_tail));
+	std::memset(m_buffer+m_chunk_size, 0, sizeof(m_saved_tail));
+
+	return true;
+}
+
+bool File::was_truncated() const noexcept
+{
+	return m_mapping_slot >= 0 && f_active_mappings[m_mapping_slot].m_truncated.load(std::memory_order_relaxed) != 0;
+}
+
 const char* File::GetFileData(int file_descriptor, size_t file_size, size_t preferred_block_size)
 {
 	const char *file_data = static_cast<const char *>(MAP_FAILED);
 
-	if(false) /// @todo This is very broken right now.  (m_use_mmap)
+	if(m_use_mmap)
 	{
-		file_data = static_cast<const char *>(mmap(NULL, file_size, PROT_READ, MAP_PRIVATE /*| MAP_NORESERVE | MAP_POPULATE*/, file_descriptor, 0));
+		std::call_once(f_sigbus_handler_installed, install_sigbus_handler);
+
+		// Reserve an anonymous, zero-filled region big enough for the file plus the tail padding, then map the file
+		// over the front of it.  This way a vector read past the end of the file data never touches a page which
+		// is beyond the end of the file (SIGBUS) or not mapped at all (SIGSEGV), even when file_size is an exact
+		// multiple of the page size.
+		size_t mapped_size = ((file_size + f_tail_padding + f_page_size - 1) / f_page_size) * f_page_size;
+		void *region = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(region == MAP_FAILED)
+		{
+			return file_data;
+		}
 
+		file_data = static_cast<const char *>(mmap(region, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, file_descriptor, 0));
 		if(file_data == MAP_FAILED)
 		{
 			// Mapping failed.
-			close(file_descriptor);
+			auto saved_errno = errno;
+			munmap(region, mapped_size);
+			errno = saved_errno;
+			return file_data;
+		}
+
+		m_mapped_size = mapped_size;
+
+		// Let the SIGBUS handler know what we're looking at before anyone touches it.
+		m_mapping_slot = register_mapping(const_cast<char*>(file_data), file_size);
+		if(m_mapping_slot < 0)
+		{
+			// Too many files mapped at once.  We couldn't survive a truncation, so read() this one instead.
+			munmap(const_cast<char*>(file_data), mapped_size);
+			m_mapped_size = 0;
+			m_use_mmap = false;
+			return GetFileData(file_descriptor, file_size, preferred_block_size);
+		}
+
+		// Check for a binary file before we ask for the whole thing to be paged in.
+		if(m_skip_binary && IsBinaryData(file_data, file_size))
+		{
+			m_is_binary = true;
 			return file_data;
 		}
 
 		// Hint that we'll be sequentially reading the mmapped file soon.
-		posix_madvise(const_cast<char*>(file_data), file_size, POSIX_MADV_SEQUENTIAL | POSIX_MADV_WILLNEED);
+		// Note that these are not flags, they each have to be given in their own call.
+		(void)posix_madvise(const_cast<char*>(file_data), file_size, POSIX_MADV_SEQUENTIAL);
+		(void)posix_madvise(const_cast<char*>(file_data), file_size, POSIX_MADV_WILLNEED);
 	}
 	else
 	{
@@ -143,29 +446,82 @@ const char* File::GetFileData(int file_descriptor, size_t file_size, size_t pref
 		(void)posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_SEQUENTIAL /*| POSIX_FADV_WILLNEED*/);
 #endif
 
-		file_data = m_storage->realloc(file_size, preferred_block_size);
+		// Buffers from the pool are always page-aligned, which is at least as good as preferred_block_size would get us.
+		(void)preferred_block_size;
+		m_buffer = m_storage->Acquire(file_size);
+		file_data = m_buffer.data();
 
-		// Read in the whole file.
+		// Read in the file.
+		size_t total_read = 0;
 		ssize_t retval = 0;
-		while((retval = read(file_descriptor, const_cast<char*>(file_data), file_size)) > 0);
+
+#if defined(HAVE_PREADV2) && HAVE_DECL_RWF_NOWAIT
+		// First try to get the data without blocking.  If it's all in the page cache, this is the only read we'll need.
+		// If it isn't, we'll get a short read or EAGAIN, which tells us that the file was cold.  Kernels which
+		// don't support RWF_NOWAIT give us EOPNOTSUPP, in which case we quit asking.
+		if(f_nowait_supported.load(std::memory_order_relaxed))
+		{
+			struct iovec iov { const_cast<char*>(file_data), file_size };
+			retval = preadv2(file_descriptor, &iov, 1, 0, RWF_NOWAIT);
+			if(retval >= 0)
+			{
+				total_read = retval;
+				m_was_cold = (total_read < file_size);
+			}
+			else if(errno == EAGAIN)
+			{
+				m_was_cold = true;
+			}
+			else if(errno == EOPNOTSUPP)
+			{
+				f_nowait_supported.store(false, std::memory_order_relaxed);
+			}
+			retval = 0;
+			errno = 0;
+		}
+#endif
+
+		// If we're skipping binary files, get the first block in and check it before reading the rest.
+		size_t first_block_size = m_skip_binary ? std::min(file_size, f_binary_check_size) : 0;
+		while(total_read < first_block_size
+				&& (retval = pread(file_descriptor, const_cast<char*>(file_data)+total_read, first_block_size-total_read, total_read)) > 0)
+		{
+			total_read += retval;
+		}
+
+		if(m_skip_binary && IsBinaryData(file_data, total_read))
+		{
+			// No need to read the rest.
+			m_is_binary = true;
+		}
+		else
+		{
+			while(total_read < file_size
+					&& (retval = pread(file_descriptor, const_cast<char*>(file_data)+total_read, file_size-total_read, total_read)) > 0)
+			{
+				total_read += retval;
+			}
+		}
 		if(retval < 0)
 		{
 			// read error.
-			ERROR() << "read() error on file '" << "<<TODO>>" << "', descriptor " << file_descriptor << ": " << LOG_STRERROR();
+			ERROR() << "read() error on file '" << m_fileid->GetPath() << "', descriptor " << file_descriptor << ": " << LOG_STRERROR();
 			errno = 0;
 		}
 	}
 
-	// We don't need the file descriptor anymore.
-	///@todo close(file_descriptor);
-
 	return file_data;
 }
 
-void File::FreeFileData(const char* file_data, size_t file_size) noexcept
+void File::FreeFileData(const char* file_data, size_t file_size [[maybe_unused]]) noexcept
 {
-	if(m_use_mmap)
+	if(m_use_mmap && file_data != nullptr)
 	{
-		munmap(const_cast<char*>(file_data), file_size);
+		if(m_mapping_slot >= 0)
+		{
+			unregister_mapping(m_mapping_slot);
+			m_mapping_slot = -1;
+		}
+		munmap(const_cast<char*>(file_data), m_mapped_size);
 	}
 }
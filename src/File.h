@@ -27,7 +27,18 @@
 #include <stdexcept>
 
 #include "libext/FileID.h"
-#include "ResizableArray.h"
+#include "BufferPool.h"
+#include "Decompressor.h"
+
+/**
+ * Heuristic check for whether the first block of a file's contents indicates that it's a binary file and not text.
+ * Currently this is the same test GNU grep and ack use: a NUL byte anywhere in the first block.
+ *
+ * @param data  The start of the file data.
+ * @param len   Number of bytes available at @a data.  Only the first block's worth of these will be examined.
+ * @returns true if the data looks like it's from a binary file.
+ */
+bool IsBinaryData(const char *data, size_t len) noexcept;
 
 
 /**
@@ -37,15 +48,49 @@
 class File
 {
 public:
-	File(std::shared_ptr<FileID> file_id, std::shared_ptr<ResizableArray<char>> storage = std::make_shared<ResizableArray<char>>());
+	/**
+	 * Constructor.
+	 *
+	 * @param file_id        The file to read in.
+	 * @param storage        The BufferPool to get the buffer to read() the file data into from.
+	 * @param mmap_min_size  Files of at least this many bytes will be mmap()ed instead of read() into @a storage.
+	 *                       0 == never mmap().
+	 * @param skip_binary    If true, check the first block of the file with IsBinaryData(), and if it looks like a
+	 *                       binary file, don't bother reading in the rest of it.  See is_binary().
+	 */
+	File(std::shared_ptr<FileID> file_id, std::shared_ptr<BufferPool> storage = std::make_shared<BufferPool>(),
+			size_t mmap_min_size = 0, bool skip_binary = false);
 	File(const std::string &filename, FileAccessMode fam, FileCreationFlag fcf,
-			std::shared_ptr<ResizableArray<char>> storage = std::make_shared<ResizableArray<char>>());
+			std::shared_ptr<BufferPool> storage = std::make_shared<BufferPool>());
 	~File();
 
 	size_t size() const noexcept { return m_fileid->GetFileSize(); };
 
 	const char * data() const noexcept { return m_file_data; };
 
+	/// Returns true if the file data was mmap()ed instead of read() in.
+	bool is_mmapped() const noexcept { return m_use_mmap; };
+
+	/**
+	 * Returns true if the file was mmap()ed and was found to have been truncated by someone else while we were
+	 * accessing it.  In that case, data() past the new end of the file will read as zeros, and any results obtained
+	 * from scanning it should be discarded.  A truncation noticed by any thread reading data() counts, so check this
+	 * only after all of them are done.
+	 */
+	bool was_truncated() const noexcept;
+
+	/**
+	 * Returns true if we had to wait on I/O to read() the file in, i.e. not all of its data was already in the
+	 * page cache.  Always false for mmap()ed files, and on platforms where we can't tell.
+	 */
+	bool was_cold() const noexcept { return m_was_cold; };
+
+	/**
+	 * Returns true if the File was constructed with skip_binary == true and it turned out to be a binary file.
+	 * In that case only the first block of data() is valid, and the file shouldn't be scanned.
+	 */
+	bool is_binary() const noexcept { return m_is_binary; };
+
 	/**
 	 * Returns the name of this File as passed to the constructor.
 	 * @return  The name of this File as passed to the constructor.
@@ -58,8 +103,6 @@ private:
 	 * Return a pointer to a buffer containing the contents of the file described by #file_descriptor.
 	 * May be mmap()'ed or read() into a newed buffer depending on m_use_mmap.
 	 *
-	 * @note file_descriptor will be closed after this function returns.
-	 *
 	 * @param file_descriptor  File descriptor (from open()) of the file to read in / mmap.
 	 * @param file_size        Size of the file.
 	 * @return
@@ -76,13 +119,120 @@ private:
 
 	std::shared_ptr<FileID> m_fileid;
 
-	/// The ResizableArray that we'll get file data storage from.
-	std::shared_ptr<ResizableArray<char>> m_storage;
+	/// The BufferPool that we'll get file data storage from.
+	std::shared_ptr<BufferPool> m_storage;
+
+	/// The buffer the file data was read() into, if it wasn't mmap()ed.
+	BufferPool::Buffer m_buffer;
 
 	const char *m_file_data { nullptr };
 
+	/// true if m_file_data was mmap()ed.
 	bool m_use_mmap { false };
 
+	/// The size of the mapping at m_file_data, including the zero-filled tail padding.  Only valid if m_use_mmap is true.
+	size_t m_mapped_size { 0 };
+
+	/// Our slot in the registry of active mappings the SIGBUS handler consults, or -1 if we're not mmap()ed.
+	int m_mapping_slot { -1 };
+
+	/// true if reading the file data blocked on I/O.
+	bool m_was_cold { false };
+
+	/// Whether to stop reading after the first block if the file looks like a binary file.
+	bool m_skip_binary { false };
+
+	/// true if the file was found to be a binary file.
+	bool m_is_binary { false };
+
+};
+
+/**
+ * A read-only file which is too large to be read into memory all at once.  The contents are instead read sequentially
+ * in chunks of bounded size, each consisting of only complete lines (except possibly at the end of the file).  Any
+ * partial line at the end of a read is carried over to the start of the next chunk.  This bounds the amount of memory
+ * needed to scan the file, regardless of its size.
+ *
+ * @note A single line longer than the chunk size will grow the buffer until the whole line fits.
+ */
+class StreamingFile
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param file_id     The file to read.
+	 * @param storage     The BufferPool to get the buffer to read chunks into from.
+	 * @param chunk_size  The number of bytes to read per chunk.
+	 * @param compression  If not CompressionType::NONE, the file is compressed in this format, and the chunks will be
+	 *                     of the decompressed data.
+	 */
+	StreamingFile(std::shared_ptr<FileID> file_id, std::shared_ptr<BufferPool> storage, size_t chunk_size,
+			CompressionType compression = CompressionType::NONE);
+	~StreamingFile() = default;
+
+	/**
+	 * Read the next chunk of the file.
+	 *
+	 * @returns false if there is no more data in the file.
+	 */
+	bool NextChunk();
+
+	/**
+	 * Read just enough of the file to check if it's a binary file, per IsBinaryData().
+	 * Must be called before the first call to NextChunk().
+	 *
+	 * @returns true if the file looks like a binary file.
+	 */
+	bool IsBinary();
+
+	/// Pointer to the start of the current chunk.  It is followed by a vector's worth of zeroed padding.
+	const char * data() const noexcept { return m_buffer; };
+
+	/// Size of the current chunk.
+	size_t size() const noexcept { return m_chunk_size; };
+
+	std::string name() const noexcept { return m_fileid->GetPath(); };
+
+private:
+
+	/// Make sure the buffer can hold at least @a capacity bytes, preserving the first m_buffer_fill bytes.
+	void Reserve(size_t capacity);
+
+	/// read() from the file until either there are at least @a fill_to bytes in the buffer or we hit EOF.
+	void FillBuffer(size_t fill_to);
+
+	std::shared_ptr<FileID> m_fileid;
+
+	/// The BufferPool that we'll get chunk storage from.
+	std::shared_ptr<BufferPool> m_storage;
+
+	/// The buffer m_buffer points into.
+	BufferPool::Buffer m_pooled_buffer;
+
+	int m_file_descriptor { -1 };
+
+	/// If the file is compressed, the Decompressor we read it through.
+	std::unique_ptr<Decompressor> m_decompressor;
+
+	/// Nominal number of bytes per chunk.
+	size_t m_read_size;
+
+	char *m_buffer { nullptr };
+
+	/// Usable size of m_buffer, not counting the padding.
+	size_t m_buffer_capacity { 0 };
+
+	/// Number of valid bytes in m_buffer.
+	size_t m_buffer_fill { 0 };
+
+	/// Number of bytes at the start of m_buffer making up the current chunk.
+	size_t m_chunk_size { 0 };
+
+	/// The bytes after the end of the current chunk which we zeroed out, saved so we can restore them.
+	char m_saved_tail[1024/8];
+
+	bool m_eof { false };
 };
 
 #endif /* FILE_H_ */
@@ -27,6 +27,7 @@
 #include "FileScannerPCRE.h"
 #include "FileScannerPCRE2.h"
 #include "File.h"
+#include "BatchFileReader.h"
 #include "Match.h"
 #include "MatchList.h"
 
@@ -37,19 +38,62 @@
 #include <libext/Logger.h>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <deque>
+#include <algorithm>
 #include <cstring> // For memchr().
 #include <cstddef> // For ptrdiff_t
 #include <cctype>
+#include <fcntl.h> // For posix_fadvise().
+#include <unistd.h> // For pread().
 #ifndef HAVE_SCHED_SETAFFINITY
 #else
 	#include <sched.h>
 #endif
 
-#include "ResizableArray.h"
+#include "BufferPool.h"
 
 
 static std::mutex f_assign_affinity_mutex;
 
+/// Number of files to read per io_uring submission.
+static constexpr size_t f_io_uring_batch_size = 32;
+
+/// Files larger than this won't be read via io_uring batches.
+static constexpr size_t f_io_uring_max_file_size = 16*1024;
+
+/// Chunk size for scanning decompressed data.  We have no idea how big the decompressed data will be, and most
+/// compressed files are small, so don't tie up a full --stream-chunk-size buffer for each one.
+static constexpr size_t f_decompression_chunk_size = 1024*1024;
+
+/**
+ * The shared state of one buffer which ScanFileSegmented() has split up for the scanner threads.  The buffer itself
+ * belongs to the thread which split it, and it waits for all segments to be scanned before it goes away.
+ */
+struct FileScanner::SegmentedScan
+{
+	const char *m_data { nullptr };
+
+	/// Segment i is [m_bounds[i], m_bounds[i+1]).  Every segment but the last ends in a '\n'.
+	std::vector<size_t> m_bounds;
+
+	/// The matches found in each segment, with line numbers relative to the start of the segment.
+	std::vector<MatchList> m_match_lists;
+
+	/// The number of '\n's in each segment.
+	std::vector<size_t> m_num_lines;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+
+	/// Number of segments which haven't been scanned yet.  Protected by m_mutex.
+	size_t m_num_remaining { 0 };
+
+	/// The first exception thrown while scanning any of the segments.  Protected by m_mutex.
+	std::exception_ptr m_exception;
+};
+
 /// Resolver function for determining the best version of CountLinesSinceLastMatch to call.
 /// Does its work at static init time, so incurs no call-time overhead.
 extern "C"	void * resolve_CountLinesSinceLastMatch(void);
@@ -97,7 +141,7 @@ FileScanner::FileScanner(sync_queue<std::shared_ptr<FileID>> &in_queue,
 		bool word_regexp,
 		bool pattern_is_literal) : m_regex(regex), m_ignore_case(ignore_case), m_word_regexp(word_regexp), m_pattern_is_literal(pattern_is_literal),
 				m_in_queue(in_queue), m_output_queue(output_queue),
-				m_next_core(0), m_use_mmap(false), m_manually_assign_cores(false)
+				m_next_core(0), m_manually_assign_cores(false)
 {
 	LiteralMatch = resolve_LiteralMatch(this);
 }
@@ -106,6 +150,12 @@ FileScanner::~FileScanner()
 {
 }
 
+void FileScanner::ThreadLocalSetup(int thread_count)
+{
+	m_num_scanner_threads = thread_count;
+	m_num_active_scanners = thread_count;
+}
+
 void FileScanner::Run(int thread_index)
 {
 	// Set the name of the thread.
@@ -117,30 +167,187 @@ void FileScanner::Run(int thread_index)
 		AssignToNextCore();
 	}
 
-	// Create a reusable, resizable buffer for the File() reads.
-	auto file_data_storage = std::make_shared<ResizableArray<char>>();
+	// Create a pool of reusable buffers for the File() reads.
+	auto file_data_storage = std::make_shared<BufferPool>();
+
+	// Set up batched reads of small files, if we can.
+	BatchFileReader batch_reader(m_use_io_uring ? f_io_uring_batch_size : 0, f_io_uring_max_file_size);
+	std::vector<std::shared_ptr<FileID>> batch;
+	batch.reserve(std::max(batch_reader.GetMaxBatchSize(), m_prefetch_depth+1));
+	long long num_batched_files {0};
+
+	// Files we've pulled off the input queue which have to be read the normal way.  All of them have had
+	// a prefetch issued, and we keep up to m_prefetch_depth of them in here while we work on the one at the front.
+	std::deque<std::shared_ptr<FileID>> prefetch_window;
+	long long num_cold_files {0};
+
+	long long num_binary_files {0};
 
 	using namespace std::chrono;
 	steady_clock::duration accum_elapsed_time {0};
 	long long total_bytes_read {0};
 
-	// Pull new filenames off the input queue until it's closed.
+	// Pull new filenames off the input queue until it's closed and we've worked through everything we pulled.
 	std::shared_ptr<FileID> next_file;
 	MatchList ml;
-	while(m_in_queue.pull_front(std::move(next_file)) != queue_op_status::closed)
+	ScanSegment segment;
+	while(true)
 	{
+		batch.clear();
+
+		// If another thread is working on a big file, help it out before starting on our next one.
+		while(m_num_segmented_scans.load(std::memory_order_relaxed) > 0
+				&& m_segment_queue.try_pull_front(segment) == queue_op_status::success)
+		{
+			ScanOneSegment(thread_index, segment);
+		}
+
+		if(prefetch_window.size() <= m_prefetch_depth)
+		{
+			// There's room in the prefetch window.
+			if(prefetch_window.empty())
+			{
+				// Nothing else to do, block until we get more work.
+				if(m_in_queue.pull_front(std::move(next_file)) == queue_op_status::closed)
+				{
+					break;
+				}
+				if(!next_file)
+				{
+					// Not a file, just a wakeup from ScanFileSegmented().  Go see what segments need scanning.
+					continue;
+				}
+				batch.push_back(std::move(next_file));
+			}
+
+			// Grab as many more files as are immediately available, up to the batch size or enough to fill the window.
+			size_t max_new_files = batch_reader.IsValid() ? batch_reader.GetMaxBatchSize()
+					: m_prefetch_depth + 1 - prefetch_window.size();
+			while(batch.size() < max_new_files && m_in_queue.try_pull_front(next_file) == queue_op_status::success)
+			{
+				if(next_file)
+				{
+					batch.push_back(std::move(next_file));
+				}
+			}
+		}
+
+		if(m_search_compressed)
+		{
+			// Compressed files have to be decompressed as they're read, so they can't go through the batch reader.
+			auto first_compressed = std::stable_partition(batch.begin(), batch.end(), [](const std::shared_ptr<FileID> &f){
+				return Decompressor::DetectByName(f->GetPath()) == CompressionType::NONE;
+			});
+			for(auto it = first_compressed; it != batch.end(); ++it)
+			{
+				if(m_prefetch_depth > 0)
+				{
+					PrefetchFile(**it);
+				}
+				prefetch_window.push_back(std::move(*it));
+			}
+			batch.erase(first_compressed, batch.end());
+		}
+
+		if(batch_reader.IsValid() && !batch.empty())
+		{
+			steady_clock::time_point start = steady_clock::now();
+			batch_reader.Read(batch);
+			accum_elapsed_time += (steady_clock::now() - start);
+		}
+
+		for(size_t i = 0; i < batch.size(); ++i)
+		{
+			const char *batch_data = batch_reader.data(i);
+
+			if(batch_data != nullptr)
+			{
+				// The batch reader got the whole file for us.
+				++num_batched_files;
+				total_bytes_read += batch_reader.size(i);
+				if(batch_reader.size(i) == 0)
+				{
+					LOG(INFO) << "WARNING: Filesize of \'" << batch[i]->GetPath() << "\' is 0, skipping.";
+					continue;
+				}
+				if(m_skip_binary && IsBinaryData(batch_data, batch_reader.size(i)))
+				{
+					LOG(INFO) << "File \'" << batch[i]->GetPath() << "\' looks like a binary file, skipping.";
+					++num_binary_files;
+					continue;
+				}
+				ScanFile(thread_index, batch_data, batch_reader.size(i), 1, ml);
+				QueueMatchList(*batch[i], ml);
+				continue;
+			}
+
+			// Otherwise, it'll have to be read the normal way.  Get the kernel started on that now.
+			if(m_prefetch_depth > 0)
+			{
+				PrefetchFile(*batch[i]);
+			}
+			prefetch_window.push_back(std::move(batch[i]));
+		}
+
+		if(prefetch_window.empty())
+		{
+			continue;
+		}
+
+		// Read and scan the file at the front of the window.
+		auto file = std::move(prefetch_window.front());
+		prefetch_window.pop_front();
 		try
 		{
 			// Try to open and read the file.  This could throw.
-			LOG(INFO) << "Attempting to scan file \'" << next_file->GetPath() << "\', fd=" << next_file->GetFileDescriptor();
+			LOG(INFO) << "Attempting to scan file \'" << file->GetPath() << "\', fd=" << file->GetFileDescriptor();
+
+			// Open the file before asking for its size, so the size comes from an fstat() of the descriptor and not an
+			// fstatat() relative to a directory descriptor which may have been closed by now.
+			file->GetFileDescriptor();
+
+			if(m_search_compressed)
+			{
+				CompressionType compression = GetCompressionType(*file);
+				if(compression != CompressionType::NONE)
+				{
+					// Decompress it a chunk at a time.
+					size_t chunk_size = (m_stream_chunk_size != 0) ? std::min(m_stream_chunk_size, f_decompression_chunk_size)
+							: f_decompression_chunk_size;
+					total_bytes_read += ScanStreamingFile(thread_index, file, file_data_storage, ml, num_binary_files,
+							chunk_size, compression);
+					continue;
+				}
+			}
+
+			if(m_stream_chunk_size != 0 && static_cast<size_t>(file->GetFileSize()) > m_stream_chunk_size)
+			{
+				// Too big to read in all at once.
+				total_bytes_read += ScanStreamingFile(thread_index, file, file_data_storage, ml, num_binary_files,
+						m_stream_chunk_size);
+				continue;
+			}
 
 			steady_clock::time_point start = steady_clock::now();
 
-			File f(next_file, file_data_storage);
+			File f(file, file_data_storage, m_mmap_min_size, m_skip_binary);
 
 			steady_clock::time_point end = steady_clock::now();
 			accum_elapsed_time += (end - start);
 
+			if(f.was_cold())
+			{
+				++num_cold_files;
+			}
+
+			if(f.is_binary())
+			{
+				// We only read the first block, and we won't be scanning it.
+				LOG(INFO) << "File \'" << f.name() << "\' looks like a binary file, skipping.";
+				++num_binary_files;
+				continue;
+			}
+
 			auto bytes_read = f.size();
 			total_bytes_read += bytes_read;
 			LOG(INFO) << "Num/total bytes read: " << bytes_read << " / " << total_bytes_read;
@@ -155,27 +362,33 @@ void FileScanner::Run(int thread_index)
 			size_t file_size = f.size();
 
 			// Scan the file data for occurrences of the regex, sending matches to the MatchList ml.
-			ScanFile(thread_index, file_data, file_size, ml);
+			ScanFileSegmented(thread_index, file_data, file_size, 1, ml);
 
-			if(!ml.empty())
+			if(f.was_truncated())
 			{
-				ml.SetFilename(next_file->GetPath());
-				// Force move semantics here.
-				m_output_queue.push_back(std::move(ml));
+				// Someone truncated the file while we were scanning its mmap()ed data.  Whatever we found past the
+				// new end of the file is bogus, so throw it all away.
+				WARN() << "File '" << f.name() << "' was truncated while being searched, skipping.";
 				ml.clear();
+				continue;
 			}
+
+			QueueMatchList(*file, ml);
 		}
 		catch(const FileException &error)
 		{
-			// The File constructor threw an exception.
+			// The File constructor threw an exception, or a StreamingFile ran into trouble partway through.
+			// Either way, don't let any matches we'd already found get attributed to the next file.
 			ERROR() << error.what();
 			LOG(DEBUG) << "Caught FileException: " << error.what();
+			ml.clear();
 		}
 		catch(const std::system_error& error)
 		{
 			// A system error.  Currently should only be errors from File.
 			ERROR() << error.code() << " - " << error.code().message();
 			LOG(DEBUG) << "Caught std::system_error: " << error.code() << " - " << error.code().message();
+			ml.clear();
 		}
 		catch(...)
 		{
@@ -184,8 +397,244 @@ void FileScanner::Run(int thread_index)
 		}
 	}
 
+	// We're out of files, but other threads may still be working on large ones they could use some help with.
+	// Keep scanning segments until the last thread is done with its files.
+	if(--m_num_active_scanners == 0)
+	{
+		m_segment_queue.close();
+	}
+	while(m_segment_queue.pull_front(segment) == queue_op_status::success)
+	{
+		ScanOneSegment(thread_index, segment);
+	}
+
 	duration<double> elapsed = duration_cast<duration<double>>(accum_elapsed_time);
 	LOG(INFO) << "Total bytes read = " << total_bytes_read << ", elapsed time = " << elapsed.count() << ", Bytes/Sec=" << total_bytes_read/elapsed.count() << std::endl;
+	LOG(INFO) << "Files read via batched io_uring reads = " << num_batched_files;
+	LOG(INFO) << "Files which blocked on I/O despite a prefetch depth of " << m_prefetch_depth << " = " << num_cold_files;
+	LOG(INFO) << "Binary files skipped = " << num_binary_files;
+	LOG(INFO) << "Buffer pool stats:" << file_data_storage->GetStats();
+}
+
+void FileScanner::PrefetchFile(FileID &file) noexcept
+{
+#ifdef HAVE_POSIX_FADVISE
+	try
+	{
+		// We need the descriptor anyway, and FileID will hang on to it for when we get around to the read.
+		int fd = file.GetFileDescriptor();
+		off_t len = file.GetFileSize();
+
+		if(m_stream_chunk_size != 0 && static_cast<size_t>(len) > m_stream_chunk_size)
+		{
+			// Only ask for the first chunk, there's no telling how big this thing is.
+			len = m_stream_chunk_size;
+		}
+
+		// Ask the kernel to start reading the file into the page cache in the background.
+		(void)posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+	}
+	catch(...)
+	{
+		// Whatever the problem is, we'll hit it again and report it when we really try to read the file.
+	}
+#else
+	(void)file;
+#endif
+}
+
+size_t FileScanner::ScanStreamingFile(int thread_index, const std::shared_ptr<FileID> &file,
+		const std::shared_ptr<BufferPool> &storage, MatchList &ml, long long &num_binary_files,
+		size_t chunk_size, CompressionType compression)
+{
+	StreamingFile sf(file, storage, chunk_size, compression);
+
+	if(m_skip_binary && sf.IsBinary())
+	{
+		LOG(INFO) << "File \'" << sf.name() << "\' looks like a binary file, skipping.";
+		++num_binary_files;
+		return 0;
+	}
+
+	size_t line_no = 1;
+	size_t total_size = 0;
+	bool queued_any = false;
+
+	while(sf.NextChunk())
+	{
+		ScanFileSegmented(thread_index, sf.data(), sf.size(), line_no, ml);
+
+		// Every chunk but possibly the last ends in a '\n', so the next chunk starts at the beginning of a line.
+		line_no += CountLinesSinceLastMatch(sf.data(), sf.data()+sf.size());
+		total_size += sf.size();
+
+		// Send this chunk's matches on now, so a file which matches a lot doesn't pile them all up in memory.
+		if(!ml.empty())
+		{
+			ml.SetIsContinuation(queued_any);
+			QueueMatchList(*file, ml);
+			queued_any = true;
+		}
+	}
+
+	LOG(INFO) << "Streamed " << total_size << " bytes of file '" << sf.name() << "' (compression: " << Decompressor::GetName(compression) << ")";
+
+	return total_size;
+}
+
+void FileScanner::ScanFileSegmented(int thread_index, const char * __restrict__ file_data, size_t file_size,
+		size_t first_line_no, MatchList &ml)
+{
+	size_t num_segments = (m_segment_size == 0 || m_num_scanner_threads < 2) ? 1 : file_size / m_segment_size;
+
+	if(num_segments < 2)
+	{
+		// Not worth splitting up.
+		ScanFile(thread_index, file_data, file_size, first_line_no, ml);
+		return;
+	}
+
+	auto scan = std::make_shared<SegmentedScan>();
+	scan->m_data = file_data;
+
+	// Split the data up into roughly equal segments, moving each boundary forward to the start of the next line so
+	// that no line is split between two segments.
+	scan->m_bounds.reserve(num_segments+1);
+	scan->m_bounds.push_back(0);
+	for(size_t i = 1; i < num_segments; ++i)
+	{
+		size_t nominal_bound = std::max(i * (file_size / num_segments), scan->m_bounds.back());
+		const char *eol = static_cast<const char*>(std::memchr(file_data+nominal_bound, '\n', file_size-nominal_bound));
+		if(eol == nullptr || eol+1 == file_data+file_size)
+		{
+			// The rest of the data is one line.
+			break;
+		}
+		scan->m_bounds.push_back(eol+1 - file_data);
+	}
+	scan->m_bounds.push_back(file_size);
+	num_segments = scan->m_bounds.size() - 1;
+
+	if(num_segments < 2)
+	{
+		// It's mostly one huge line.
+		ScanFile(thread_index, file_data, file_size, first_line_no, ml);
+		return;
+	}
+
+	scan->m_match_lists.resize(num_segments);
+	scan->m_num_lines.resize(num_segments, 0);
+	scan->m_num_remaining = num_segments;
+
+	LOG(INFO) << "Splitting " << file_size << " bytes into " << num_segments << " segments.";
+
+	// Hand the segments out.
+	++m_num_segmented_scans;
+	for(size_t i = 0; i < num_segments; ++i)
+	{
+		m_segment_queue.push_back(ScanSegment{scan, i});
+	}
+
+	// Threads which are idle will be blocked waiting on the input queue, not the segment queue.  Wake up as many as
+	// could usefully help with an empty FileID.  If the input queue has already been closed, they're either busy or
+	// already waiting on the segment queue.  We're one of the input queue's consumers, so don't block if it's full.
+	int num_wakeups = std::min(num_segments, static_cast<size_t>(m_num_scanner_threads-1));
+	for(int i = 0; i < num_wakeups; ++i)
+	{
+		m_in_queue.force_push_back(std::shared_ptr<FileID>());
+	}
+
+	// Pitch in ourselves.
+	ScanSegment segment;
+	while(m_segment_queue.try_pull_front(segment) == queue_op_status::success)
+	{
+		ScanOneSegment(thread_index, segment);
+	}
+
+	// Wait for the other threads to finish the segments they've taken.
+	{
+		std::unique_lock<std::mutex> lock(scan->m_mutex);
+		scan->m_cv.wait(lock, [&scan](){ return scan->m_num_remaining == 0; });
+	}
+	--m_num_segmented_scans;
+
+	if(scan->m_exception)
+	{
+		std::rethrow_exception(scan->m_exception);
+	}
+
+	// Stitch the results back together in order, converting the line numbers to absolute ones as we go.
+	size_t line_number_offset = first_line_no - 1;
+	for(size_t i = 0; i < num_segments; ++i)
+	{
+		ml.AppendMatches(std::move(scan->m_match_lists[i]), line_number_offset);
+		line_number_offset += scan->m_num_lines[i];
+	}
+}
+
+void FileScanner::ScanOneSegment(int thread_index, const ScanSegment &segment) noexcept
+{
+	SegmentedScan &scan = *segment.m_scan;
+	const size_t i = segment.m_index;
+	const char *segment_data = scan.m_data + scan.m_bounds[i];
+	const size_t segment_size = scan.m_bounds[i+1] - scan.m_bounds[i];
+
+	std::exception_ptr exception;
+	try
+	{
+		ScanFile(thread_index, segment_data, segment_size, 1, scan.m_match_lists[i]);
+		scan.m_num_lines[i] = CountLinesSinceLastMatch(segment_data, segment_data+segment_size);
+	}
+	catch(...)
+	{
+		// Let the owning thread deal with it.
+		exception = std::current_exception();
+	}
+
+	std::lock_guard<std::mutex> lock(scan.m_mutex);
+	if(exception && !scan.m_exception)
+	{
+		scan.m_exception = exception;
+	}
+	if(--scan.m_num_remaining == 0)
+	{
+		scan.m_cv.notify_all();
+	}
+}
+
+CompressionType FileScanner::GetCompressionType(FileID &file) const
+{
+	if(Decompressor::DetectByName(file.GetPath()) == CompressionType::NONE)
+	{
+		return CompressionType::NONE;
+	}
+
+	// The extension says it's compressed, make sure the contents agree.
+	char magic[Decompressor::GetMagicSize()];
+	ssize_t magic_size = pread(file.GetFileDescriptor(), magic, sizeof(magic), 0);
+	if(magic_size <= 0)
+	{
+		return CompressionType::NONE;
+	}
+
+	CompressionType retval = Decompressor::DetectByMagic(magic, magic_size);
+	if(retval == CompressionType::NONE)
+	{
+		LOG(INFO) << "File '" << file.GetPath() << "' has a compressed file extension but isn't compressed.";
+	}
+
+	return retval;
+}
+
+void FileScanner::QueueMatchList(const FileID &file, MatchList &ml)
+{
+	if(!ml.empty())
+	{
+		ml.SetFilename(file.GetPath());
+		// Force move semantics here.
+		m_output_queue.push_back(std::move(ml));
+		ml.clear();
+	}
 }
 
 void FileScanner::AssignToNextCore()
@@ -26,10 +26,13 @@
 #include <string>
 #include <memory>
 #include <functional>
+#include <atomic>
 
 #include "libext/FileID.h"
 #include "sync_queue_impl_selector.h"
 #include "MatchList.h"
+#include "BufferPool.h"
+#include "Decompressor.h"
 
 
 extern "C" void* resolve_CountLinesSinceLastMatch(void);
@@ -99,7 +102,56 @@ public:
 			bool pattern_is_literal);
 	virtual ~FileScanner();
 
-	virtual void ThreadLocalSetup(int thread_count) { (void)thread_count; };
+	/**
+	 * Called once before the @a thread_count threads calling Run() are started.  Derived classes which override this
+	 * must call this base class version.
+	 */
+	virtual void ThreadLocalSetup(int thread_count);
+
+	/**
+	 * Set the size at or above which files will be mmap()ed instead of read().
+	 *
+	 * @param mmap_min_size  Minimum file size in bytes to mmap().  0 == never mmap().
+	 */
+	void SetMmapMinSize(size_t mmap_min_size) noexcept { m_mmap_min_size = mmap_min_size; };
+
+	/**
+	 * Set whether small files should be read in batches via io_uring, where supported.
+	 */
+	void SetUseIOUring(bool use_io_uring) noexcept { m_use_io_uring = use_io_uring; };
+
+	/**
+	 * Set the size above which files will be read and scanned in chunks of that size instead of all at once.
+	 *
+	 * @param stream_chunk_size  Chunk size in bytes.  0 == never stream.
+	 */
+	void SetStreamChunkSize(size_t stream_chunk_size) noexcept { m_stream_chunk_size = stream_chunk_size; };
+
+	/**
+	 * Set how many files each scanner thread will pull off the input queue and ask the OS to start reading in
+	 * ahead of the one it's currently working on.
+	 *
+	 * @param prefetch_depth  Number of files to prefetch.  0 == no prefetching.
+	 */
+	void SetPrefetchDepth(size_t prefetch_depth) noexcept { m_prefetch_depth = prefetch_depth; };
+
+	/**
+	 * Set whether files which look like binary files (see IsBinaryData()) should be skipped instead of scanned.
+	 */
+	void SetSkipBinary(bool skip_binary) noexcept { m_skip_binary = skip_binary; };
+
+	/**
+	 * Set whether files with compressed file extensions (e.g. ".gz") should be decompressed and their contents searched.
+	 */
+	void SetSearchCompressed(bool search_compressed) noexcept { m_search_compressed = search_compressed; };
+
+	/**
+	 * Set the size of the segments which large files (or StreamingFile chunks) are split into, so that idle scanner
+	 * threads can help search them.
+	 *
+	 * @param segment_size  Nominal segment size in bytes.  Data less than twice this size isn't split.  0 == never split.
+	 */
+	void SetSegmentSize(size_t segment_size) noexcept { m_segment_size = segment_size; };
 
 	void Run(int thread_index);
 
@@ -245,9 +297,62 @@ private:
 	 *
 	 * @param file_data
 	 * @param file_size
+	 * @param first_line_no  Line number of the first line in @a file_data.  Normally 1, but will be larger
+	 *                       when scanning a later chunk of a StreamingFile.
 	 * @param ml
 	 */
-	virtual void ScanFile(int thread_index, const char * __restrict__ file_data, size_t file_size, MatchList &ml) = 0;
+	virtual void ScanFile(int thread_index, const char * __restrict__ file_data, size_t file_size, size_t first_line_no, MatchList &ml) = 0;
+
+	/**
+	 * Scan @a file_data like ScanFile(), but if it's big enough, split it into line-aligned segments and let any
+	 * scanner threads which are between files help search them.  Returns once all segments have been searched and
+	 * their matches have been appended to @a ml in order, with absolute line numbers.
+	 */
+	void ScanFileSegmented(int thread_index, const char * __restrict__ file_data, size_t file_size, size_t first_line_no, MatchList &ml);
+
+	/// A buffer which ScanFileSegmented() has split into segments.  Defined in FileScanner.cpp.
+	struct SegmentedScan;
+
+	/// A single segment of a SegmentedScan, as handed out to the scanner threads via m_segment_queue.
+	struct ScanSegment
+	{
+		std::shared_ptr<SegmentedScan> m_scan;
+		size_t m_index { 0 };
+	};
+
+	/**
+	 * Scan one segment of a SegmentedScan, and let its owner know when it's done.
+	 */
+	void ScanOneSegment(int thread_index, const ScanSegment &segment) noexcept;
+
+	/**
+	 * If @a ml isn't empty, name it after @a file, push it to the output queue, and clear it for reuse.
+	 */
+	void QueueMatchList(const FileID &file, MatchList &ml);
+
+	/**
+	 * Open @a file and tell the OS we'll need its contents soon, so it can start reading them in while we're busy
+	 * with other files.  Any errors are ignored; they'll be reported when we actually read the file.
+	 */
+	void PrefetchFile(FileID &file) noexcept;
+
+	/**
+	 * Scan @a file as a StreamingFile, i.e. in chunks of @a chunk_size bytes, and queue any matches after each chunk.
+	 * If it turns out to be a binary file and we're skipping those, increments @a num_binary_files instead.
+	 *
+	 * @returns The number of bytes scanned.
+	 */
+	size_t ScanStreamingFile(int thread_index, const std::shared_ptr<FileID> &file,
+			const std::shared_ptr<BufferPool> &storage, MatchList &ml, long long &num_binary_files,
+			size_t chunk_size, CompressionType compression = CompressionType::NONE);
+
+	/**
+	 * If @a file has a compressed file extension, check its magic number to see which format it's really in.
+	 * @a file must already be open.
+	 *
+	 * @returns The compression format of @a file, CompressionType::NONE if it isn't compressed.
+	 */
+	CompressionType GetCompressionType(FileID &file) const;
 
 	sync_queue<std::shared_ptr<FileID>>& m_in_queue;
 
@@ -255,7 +360,38 @@ private:
 
 	int m_next_core;
 
-	bool m_use_mmap;
+	/// Files this size or larger will be mmap()ed.  0 == never mmap().
+	size_t m_mmap_min_size { 0 };
+
+	/// Whether to read small files in batches via io_uring.
+	bool m_use_io_uring { false };
+
+	/// Files larger than this are scanned in chunks of this size.  0 == never.
+	size_t m_stream_chunk_size { 0 };
+
+	/// Number of files each thread will prefetch ahead of the one it's scanning.
+	size_t m_prefetch_depth { 0 };
+
+	/// Whether to skip files which look like binary files.
+	bool m_skip_binary { false };
+
+	/// Whether to search the decompressed contents of compressed files.
+	bool m_search_compressed { false };
+
+	/// Nominal size of the segments ScanFileSegmented() splits large buffers into.  0 == never split.
+	size_t m_segment_size { 0 };
+
+	/// Number of threads running Run().
+	int m_num_scanner_threads { 1 };
+
+	/// Number of threads still pulling files off m_in_queue.  The last one out closes m_segment_queue.
+	std::atomic<int> m_num_active_scanners { 1 };
+
+	/// Number of SegmentedScans in progress, so threads can skip checking m_segment_queue when there's nothing in it.
+	std::atomic<int> m_num_segmented_scans { 0 };
+
+	/// Segments of large files waiting for a scanner thread to search them.
+	sync_queue<ScanSegment> m_segment_queue;
 
 	/**
 	 * Switch to make Run() assign its std::thread to different cores on the machine.
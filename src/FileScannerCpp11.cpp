@@ -48,7 +48,7 @@ FileScannerCpp11::~FileScannerCpp11()
 }
 
 void FileScannerCpp11::ScanFile(int thread_index [[maybe_unused]], const char * __restrict__ file_data [[maybe_unused]],
-		size_t file_size [[gnu::unused]], MatchList &ml [[gnu::unused]])
+		size_t file_size [[gnu::unused]], size_t first_line_no [[gnu::unused]], MatchList &ml [[gnu::unused]])
 {
 #ifdef USE_CXX11_REGEX
 	// Scan the mmapped file for the regex.
@@ -58,7 +58,7 @@ void FileScannerCpp11::ScanFile(int thread_index [[maybe_unused]], const char *
 	{
 		//std::cout << "Match in file " << next_string << std::endl;
 
-		long long lineno = 1+std::count(file_data, file_data+rit->position(), '\n');
+		long long lineno = first_line_no+std::count(file_data, file_data+rit->position(), '\n');
 		auto line_ending = "\n";
 		auto line_start = std::find_end(file_data, file_data+rit->position(),
 				line_ending, line_ending+1);
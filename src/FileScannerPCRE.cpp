@@ -135,17 +135,18 @@ FileScannerPCRE::~FileScannerPCRE()
 #endif
 }
 
-void FileScannerPCRE::ScanFile(int thread_index, const char* __restrict__ file_data, size_t file_size, MatchList& ml)
+void FileScannerPCRE::ScanFile(int thread_index, const char* __restrict__ file_data, size_t file_size, size_t first_line_no, MatchList& ml)
 {
 #if HAVE_LIBPCRE == 0
 	(void)thread_index;
 	(void)file_data;
 	(void)file_size;
+	(void)first_line_no;
 	(void)ml;
 #else
 	// Match output vector.  We won't support submatches, so we only need two entries, plus a third for pcre's own use.
 	int ovector[3] = {-1, 0, 0};
-	size_t line_no = 1;
+	size_t line_no = first_line_no;
 	size_t prev_lineno = 0;
 	const char *prev_lineno_search_end = file_data;
 	// Up-cast file_size, which is a size_t (unsigned) to a ptrdiff_t (signed) which should be able to handle the
@@ -308,6 +308,8 @@ struct default_delete<pcre2_match_context>
 
 void FileScannerPCRE2::ThreadLocalSetup(int thread_count)
 {
+	FileScanner::ThreadLocalSetup(thread_count);
+
 	for(int i = 0; i<thread_count; ++i)
 	{
 #if HAVE_LIBPCRE2
@@ -320,7 +322,7 @@ void FileScannerPCRE2::ThreadLocalSetup(int thread_count)
 	}
 }
 
-void FileScannerPCRE2::ScanFile(int thread_index, const char* __restrict__ file_data, size_t file_size, MatchList& ml)
+void FileScannerPCRE2::ScanFile(int thread_index, const char* __restrict__ file_data, size_t file_size, size_t first_line_no, MatchList& ml)
 {
 #if HAVE_LIBPCRE2
 	try
@@ -328,7 +330,7 @@ void FileScannerPCRE2::ScanFile(int thread_index, const char* __restrict__ file_
 	// Pointer to the offset vector returned by pcre2_match().
 	PCRE2_SIZE *ovector;
 
-	size_t line_no {1};
+	size_t line_no {first_line_no};
 	size_t prev_lineno {0};
 	const char *prev_lineno_search_end {file_data};
 	size_t start_offset { 0 };
@@ -380,7 +380,9 @@ int FileScanner::LiteralMatch_sse4_2(const char *file_data, size_t file_size, si
 								(const void *)m_literal_search_string.get(), m_literal_search_string_len);
 	}
 
-	if(str_match == nullptr)
+	// memmem_short_pattern() reads whole vectors, and can find a match which starts past the end of the data if
+	// there's more data after it, e.g. when we're searching one segment of a larger buffer.
+	if(str_match == nullptr || str_match + m_literal_search_string_len > file_data + file_size)
 	{
 		// No match.
 		rc = -1; /// @note Both PCRE_ERROR_NOMATCH and PCRE2_ERROR_NOMATCH are both -1.
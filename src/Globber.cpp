@@ -20,10 +20,12 @@
 #include <config.h>
 #include <future/string.hpp>
 #include <future/string_view.hpp>
+#include <future/memory.hpp>
 
 #include "Globber.h"
 
 #include <libext/DirTree.h>
+#include <libext/DirListingCache.h>
 
 #include "TypeManager.h"
 #include "DirInclusionManager.h"
@@ -57,8 +59,28 @@ void Globber::Run()
 	auto dir_basename_filter = [this](const std::string &basename) noexcept { return m_dir_inc_manager.DirShouldBeExcluded(basename); };
 
 	DirTree dt(m_out_queue, file_basename_filter, dir_basename_filter, m_recurse_subdirs, m_follow_symlinks);
+	dt.SetUseGetdents(m_use_getdents);
+	dt.SetInodeOrder(m_inode_order);
+	dt.SetUseIgnoreFiles(m_use_ignore_files);
+	dt.SetOneFileSystem(m_one_file_system);
+	dt.SetMaxDepth(m_max_depth);
+	dt.SetMaxFileSize(m_max_file_size);
+	dt.SetMinMtime(m_min_mtime);
+
+	std::unique_ptr<DirListingCache> listing_cache;
+	if(!m_dir_listing_cache_path.empty())
+	{
+		listing_cache = std::make_unique<DirListingCache>(m_dir_listing_cache_path);
+		listing_cache->Load();
+		dt.SetDirListingCache(listing_cache.get());
+	}
 
 	dt.Scandir(m_start_paths, m_dirjobs);
 
+	if(listing_cache)
+	{
+		listing_cache->Save();
+	}
+
 	return;
 }
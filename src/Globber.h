@@ -47,6 +47,30 @@ public:
 			sync_queue<std::shared_ptr<FileID>> &out_queue);
 	~Globber() = default;
 
+	/// Set whether directories should be read in bulk with getdents64(), where supported.
+	void SetUseGetdents(bool use_getdents) noexcept { m_use_getdents = use_getdents; };
+
+	/// Set whether the files found in each directory should be sent for scanning in inode number order.
+	void SetInodeOrder(bool inode_order) noexcept { m_inode_order = inode_order; };
+
+	/// Set the file to keep the directory listing cache in.  Empty means no cache.
+	void SetDirListingCachePath(std::string path) { m_dir_listing_cache_path = std::move(path); };
+
+	/// Set whether to obey any .gitignore and .ignore files found during the traversal.
+	void SetUseIgnoreFiles(bool use_ignore_files) noexcept { m_use_ignore_files = use_ignore_files; };
+
+	/// Set whether to stay on the filesystem each start path is on.
+	void SetOneFileSystem(bool one_file_system) noexcept { m_one_file_system = one_file_system; };
+
+	/// Set the maximum number of directory levels to descend below the start paths, or -1 for no limit.
+	void SetMaxDepth(int max_depth) noexcept { m_max_depth = max_depth; };
+
+	/// Set the size above which files are skipped, or -1 for no limit.
+	void SetMaxFileSize(off_t max_file_size) noexcept { m_max_file_size = max_file_size; };
+
+	/// Set the modification time before which files are skipped, or all zeroes for no limit.
+	void SetMinMtime(const struct timespec &min_mtime) noexcept { m_min_mtime = min_mtime; };
+
 	void Run();
 
 private:
@@ -66,6 +90,22 @@ private:
 
 	int m_dirjobs;
 
+	bool m_use_getdents { true };
+
+	bool m_inode_order { false };
+
+	std::string m_dir_listing_cache_path;
+
+	bool m_use_ignore_files { false };
+
+	bool m_one_file_system { false };
+
+	int m_max_depth { -1 };
+
+	off_t m_max_file_size { -1 };
+
+	struct timespec m_min_mtime { 0, 0 };
+
 	sync_queue<std::shared_ptr<FileID>>& m_out_queue;
 };
 
@@ -33,16 +33,31 @@ void MatchList::SetFilename(std::string filename)
 
 void MatchList::AddMatch(Match &&match)
 {
+	m_num_match_text_bytes += match.m_pre_match.size() + match.m_match.size() + match.m_post_match.size();
 	m_match_list.push_back(std::move(match));
 }
 
+void MatchList::AppendMatches(MatchList &&other, size_t line_number_offset)
+{
+	for(Match &match : other.m_match_list)
+	{
+		match.m_line_number += line_number_offset;
+		m_match_list.push_back(std::move(match));
+	}
+	m_num_match_text_bytes += other.m_num_match_text_bytes;
+	other.m_match_list.clear();
+	other.m_num_match_text_bytes = 0;
+}
+
 void MatchList::clear() noexcept
 {
 	m_filename.clear();
 	m_match_list.clear();
+	m_num_match_text_bytes = 0;
+	m_is_continuation = false;
 }
 
-void MatchList::Print(std::ostream &sstrm, OutputContext &output_context) const
+void MatchList::Print(std::ostream &sstrm, OutputContext &output_context, bool print_file_header) const
 {
 	std::string no_dotslash_fn;
 	const std::string empty_color_string {""};
@@ -87,11 +102,14 @@ void MatchList::Print(std::ostream &sstrm, OutputContext &output_context) const
 		// Render to a TTY device.
 
 		// Print file header.
-		if(color) composition_buffer += *color_filename;
-		composition_buffer += no_dotslash_fn;
-		if(color) composition_buffer += *color_default;
-		composition_buffer += '\n';
-		sstrm << composition_buffer;
+		if(print_file_header)
+		{
+			if(color) composition_buffer += *color_filename;
+			composition_buffer += no_dotslash_fn;
+			if(color) composition_buffer += *color_default;
+			composition_buffer += '\n';
+			sstrm << composition_buffer;
+		}
 
 		// Print the individual matches.
 		for(const Match& it : m_match_list)
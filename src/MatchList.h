@@ -59,7 +59,21 @@ public:
 	/// Add a match to this MatchList.  Note that this is done by moving, not copying, the given %match.
 	void AddMatch(Match &&match);
 
-	void Print(std::ostream &sstrm, OutputContext &output_context) const;
+	/// Move all the Matches in @a other onto the end of this MatchList, adding @a line_number_offset to their line numbers.
+	void AppendMatches(MatchList &&other, size_t line_number_offset);
+
+	/// Returns the filename set by SetFilename().
+	const std::string& GetFilename() const noexcept { return m_filename; };
+
+	/// Mark this MatchList as holding more Matches from the same file as the previous MatchList sent for it.  This is how
+	/// a file which is scanned in chunks gets its matches to the output a chunk at a time.
+	void SetIsContinuation(bool is_continuation) noexcept { m_is_continuation = is_continuation; };
+
+	bool IsContinuation() const noexcept { return m_is_continuation; };
+
+	/// Print the Matches to @a sstrm.  If @a print_file_header is false and the output is grouped under file headers,
+	/// the header is left off, so the Matches continue the group printed by the previous call.
+	void Print(std::ostream &sstrm, OutputContext &output_context, bool print_file_header = true) const;
 
 	/// Returns a bool indicating whether the MatchList is empty.
 	/// @note You might expect that this needs to indicate 'empty' after a move-from has occurred.
@@ -71,6 +85,9 @@ public:
 
 	std::vector<Match>::size_type GetNumberOfMatchedLines() const noexcept;
 
+	/// Returns the number of bytes of text (the filename and the matched lines) this MatchList is holding onto.
+	size_t GetNumTextBytes() const noexcept { return m_filename.size() + m_num_match_text_bytes; };
+
 private:
 
 	/// The filename where the Matches in this MatchList were found.
@@ -78,6 +95,12 @@ private:
 
 	/// The Matches found in this file.
 	std::vector<Match> m_match_list;
+
+	/// Total size of the strings in m_match_list.
+	size_t m_num_match_text_bytes { 0 };
+
+	/// true if this MatchList continues the previous one sent for the same file.
+	bool m_is_continuation { false };
 };
 
 // Require MatchList to be nothrow move constructible so that a container of them can use move on reallocation.
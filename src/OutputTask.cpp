@@ -62,15 +62,21 @@ void OutputTask::Run()
 	MatchList ml;
 	bool first_matchlist_printed = false;
 	std::stringstream sstrm;
+	std::string last_filename;
 
 	while(m_input_queue.pull_front(std::move(ml)) != queue_op_status::closed)
 	{
-		if(first_matchlist_printed && m_output_is_tty)
+		// A file which was scanned in chunks arrives as a sequence of MatchLists.  If nothing from another file got
+		// printed in between, keep them all in one group.
+		bool continues_last_group = ml.IsContinuation() && ml.GetFilename() == last_filename;
+
+		if(first_matchlist_printed && m_output_is_tty && !continues_last_group)
 		{
 			// Print a blank line between the match lists (i.e. the groups of matches in one file).
 			std::cout << '\n';
 		}
-		ml.Print(sstrm, *m_output_context);
+		ml.Print(sstrm, *m_output_context, !continues_last_group);
+		last_filename.assign(ml.GetFilename());
 		std::cout << sstrm.str();
 		std::cout.flush();
 		sstrm.str(std::string());
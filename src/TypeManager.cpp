@@ -21,6 +21,7 @@
 
 #include <libext/hints.hpp>
 #include "TypeManager.h"
+#include "Decompressor.h"
 
 #include <algorithm>
 #include <set>
@@ -134,6 +135,26 @@ TypeManager::TypeManager()
 }
 
 bool TypeManager::FileShouldBeScanned(const name_string_type& name) const noexcept
+{
+	if(FileShouldBeScannedUncompressed(name))
+	{
+		return true;
+	}
+
+	if(m_search_compressed)
+	{
+		// See if the name would be scanned without its compressed file extension, e.g. "foo.log" for "foo.log.gz".
+		size_t ext_len = 0;
+		if(Decompressor::DetectByName(name, &ext_len) != CompressionType::NONE)
+		{
+			return FileShouldBeScannedUncompressed(name.substr(0, name.length()-ext_len));
+		}
+	}
+
+	return false;
+}
+
+bool TypeManager::FileShouldBeScannedUncompressed(const name_string_type& name) const noexcept
 {
 	// Find the name's extension.
 	auto last_period_offset = name.find_last_of('.');
@@ -61,6 +61,12 @@ public:
 	 */
 	bool FileShouldBeScanned(const name_string_type &name) const noexcept;
 
+	/**
+	 * Set whether compressed files should be considered for scanning.  If enabled, a file with a compressed file
+	 * extension (e.g. "foo.log.gz") is also scanned if its name without that extension ("foo.log") would be.
+	 */
+	void SetSearchCompressed(bool search_compressed) noexcept { m_search_compressed = search_compressed; };
+
 	/**
 	 * Add the given file type to the types which will be scanned.  For handling the
 	 * --type= command line param.  The first time this function is called, all currently-
@@ -151,6 +157,12 @@ private:
 
 	bool IsExcludedByAnyGlob(const std::string &name) const noexcept;
 
+	/// FileShouldBeScanned(), without the compressed file handling.
+	bool FileShouldBeScannedUncompressed(const name_string_type &name) const noexcept;
+
+	/// Whether FileShouldBeScanned() should look past compressed file extensions.
+	bool m_search_compressed { false };
+
 	/// Flag to keep track of the first call to type().
 	bool m_first_type_has_been_seen = { false };
 
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_LIBEXT_CONCURRENTHASHSET_HPP_
+#define SRC_LIBEXT_CONCURRENTHASHSET_HPP_
+
+#include <config.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * A thread-safe hash set which is only ever inserted into, e.g. the set of directories a traversal has visited.
+ *
+ * The keys are spread over a fixed number of shards, each an ordinary std::unordered_set with its own lock, so
+ * threads inserting different keys almost never contend.  Each shard grows independently as it fills up.
+ */
+template <typename Key, typename Hash = std::hash<Key>>
+class ConcurrentHashSet
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param expected_size  Estimate of the number of keys which will be inserted.  Only used to size the shards
+	 *                       initially; they'll grow if needed.
+	 * @param num_shards     Number of independently-locked shards.  Rounded up to a power of two.
+	 */
+	explicit ConcurrentHashSet(size_t expected_size, size_t num_shards = 64)
+	{
+		while((static_cast<size_t>(1) << m_shard_bits) < num_shards)
+		{
+			++m_shard_bits;
+		}
+		num_shards = static_cast<size_t>(1) << m_shard_bits;
+
+		m_shards.reserve(num_shards);
+		for(size_t i=0; i<num_shards; ++i)
+		{
+			m_shards.emplace_back(new Shard());
+			m_shards.back()->m_set.reserve(expected_size / num_shards + 1);
+		}
+	}
+
+	ConcurrentHashSet(const ConcurrentHashSet&) = delete;
+	ConcurrentHashSet& operator=(const ConcurrentHashSet&) = delete;
+
+	/**
+	 * Insert @a key.
+	 *
+	 * @returns true if @a key wasn't already in the set.
+	 */
+	bool insert(const Key &key)
+	{
+		const size_t hash = Hash{}(key);
+		Shard &shard = *m_shards[ShardIndex(hash)];
+
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		return shard.m_set.insert(key).second;
+	}
+
+	/// @returns The number of keys in the set.  Only exact if nothing is inserting at the same time.
+	size_t size() const
+	{
+		size_t retval = 0;
+		for(const auto &shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard->m_mutex);
+			retval += shard->m_set.size();
+		}
+		return retval;
+	}
+
+private:
+
+	/// Each on its own cache line, so threads working on different shards don't fight over the locks' cache lines.
+	struct alignas(64) Shard
+	{
+		mutable std::mutex m_mutex;
+		std::unordered_set<Key, Hash> m_set;
+	};
+
+	/**
+	 * Pick the shard from the top bits of a Fibonacci-hashed @a hash.  The shards' own unordered_sets use the hash
+	 * modulo their bucket counts, so taking the shard from the low bits would leave every key in a shard with the same
+	 * residue and cluster them.  Also, std::hash<> for integers is often the identity, and inode numbers are anything
+	 * but uniformly distributed.
+	 */
+	size_t ShardIndex(size_t hash) const noexcept
+	{
+		if(m_shard_bits == 0)
+		{
+			return 0;
+		}
+		return static_cast<size_t>((static_cast<uint64_t>(hash) * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - m_shard_bits));
+	}
+
+	unsigned int m_shard_bits { 0 };
+
+	std::vector<std::unique_ptr<Shard>> m_shards;
+};
+
+#endif /* SRC_LIBEXT_CONCURRENTHASHSET_HPP_ */
@@ -0,0 +1,275 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "DirListingCache.h"
+
+#include "Logger.h"
+
+#include <cstdio> // For rename().
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h> // For getpid().
+
+/**
+ * The file starts with this, followed by one record per directory:
+ *
+ *     uint64 dev, uint64 ino, int64 mtime_sec, int64 mtime_nsec, uint32 idle_saves, uint32 num_entries
+ *
+ * and then, for each entry:
+ *
+ *     uint64 d_ino, uint8 d_type, uint16 name_length, name bytes (not NUL-terminated)
+ *
+ * Everything is in host byte order; the cache describes local filesystems, so it isn't meant to be portable.  Bump the
+ * version digits if the format changes.
+ */
+static constexpr char f_magic[8] = {'U','C','G','D','L','C','0','1'};
+
+/// Listings modified less than this many seconds before we started aren't cached.  Generous enough to cover
+/// filesystems with 1- and 2-second timestamp granularity.
+static constexpr time_t f_racy_mtime_seconds = 2;
+
+/// Drop records which went unused for this many consecutive saves.
+static constexpr uint32_t f_max_idle_saves = 16;
+
+namespace
+{
+
+template <typename T>
+void append_pod(std::string *buffer, T value)
+{
+	buffer->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/// Bounds-checked reader for the contents of a cache file.
+class BufferReader
+{
+public:
+	explicit BufferReader(const std::string &buffer) : m_pos(buffer.data()), m_end(buffer.data() + buffer.size()) {};
+
+	bool empty() const noexcept { return m_pos == m_end; };
+
+	template <typename T>
+	bool Read(T *value) noexcept
+	{
+		if(static_cast<size_t>(m_end - m_pos) < sizeof(T))
+		{
+			return false;
+		}
+		std::memcpy(value, m_pos, sizeof(T));
+		m_pos += sizeof(T);
+		return true;
+	}
+
+	bool Read(std::string *value, size_t len)
+	{
+		if(static_cast<size_t>(m_end - m_pos) < len)
+		{
+			return false;
+		}
+		value->assign(m_pos, len);
+		m_pos += len;
+		return true;
+	}
+
+private:
+	const char *m_pos;
+	const char *m_end;
+};
+
+inline bool operator==(const struct timespec &a, const struct timespec &b) noexcept
+{
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+} // namespace
+
+
+DirListingCache::DirListingCache(std::string path) : m_path(std::move(path))
+{
+	clock_gettime(CLOCK_REALTIME, &m_start_time);
+}
+
+bool DirListingCache::Load()
+{
+	std::ifstream in(m_path, std::ios::binary);
+	if(!in)
+	{
+		LOG(INFO) << "No directory listing cache at '" << m_path << "', starting with an empty one.";
+		return false;
+	}
+
+	const std::string contents { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+	if(in.bad())
+	{
+		WARN() << "Could not read directory listing cache '" << m_path << "', ignoring it.";
+		return false;
+	}
+
+	BufferReader reader(contents);
+	char magic[sizeof(f_magic)];
+	if(!reader.Read(&magic) || std::memcmp(magic, f_magic, sizeof(f_magic)) != 0)
+	{
+		LOG(INFO) << "'" << m_path << "' isn't a directory listing cache we understand, ignoring it.";
+		return false;
+	}
+
+	decltype(m_records) records;
+
+	while(!reader.empty())
+	{
+		uint64_t dev, ino;
+		int64_t mtime_sec, mtime_nsec;
+		uint32_t idle_saves, num_entries;
+
+		if(!reader.Read(&dev) || !reader.Read(&ino) || !reader.Read(&mtime_sec) || !reader.Read(&mtime_nsec)
+				|| !reader.Read(&idle_saves) || !reader.Read(&num_entries))
+		{
+			WARN() << "Directory listing cache '" << m_path << "' is truncated, ignoring it.";
+			return false;
+		}
+
+		auto listing = std::make_shared<Listing>();
+		listing->reserve(num_entries);
+		for(uint32_t i=0; i<num_entries; ++i)
+		{
+			uint64_t d_ino;
+			uint8_t d_type;
+			uint16_t name_len;
+			std::string name;
+
+			if(!reader.Read(&d_ino) || !reader.Read(&d_type) || !reader.Read(&name_len) || !reader.Read(&name, name_len))
+			{
+				WARN() << "Directory listing cache '" << m_path << "' is truncated, ignoring it.";
+				return false;
+			}
+
+			listing->push_back(Entry{std::move(name), static_cast<ino_t>(d_ino), d_type});
+		}
+
+		struct timespec mtime;
+		mtime.tv_sec = mtime_sec;
+		mtime.tv_nsec = mtime_nsec;
+		records[dev_ino_pair(static_cast<dev_t>(dev), static_cast<ino_t>(ino))] =
+				Record{mtime, std::move(listing), idle_saves, false};
+	}
+
+	LOG(INFO) << "Loaded " << records.size() << " directory listings from cache '" << m_path << "'.";
+
+	m_records = std::move(records);
+	m_dirty = false;
+
+	return true;
+}
+
+bool DirListingCache::Save()
+{
+	if(!m_dirty)
+	{
+		LOG(INFO) << "Directory listing cache '" << m_path << "' is unchanged, not writing it.";
+		return true;
+	}
+
+	std::string buffer(f_magic, sizeof(f_magic));
+	size_t num_written = 0;
+
+	for(auto &it : m_records)
+	{
+		Record &record = it.second;
+
+		uint32_t idle_saves = record.m_used ? 0 : record.m_idle_saves + 1;
+		if(idle_saves > f_max_idle_saves)
+		{
+			continue;
+		}
+
+		append_pod<uint64_t>(&buffer, it.first.dev());
+		append_pod<uint64_t>(&buffer, it.first.ino());
+		append_pod<int64_t>(&buffer, record.m_mtime.tv_sec);
+		append_pod<int64_t>(&buffer, record.m_mtime.tv_nsec);
+		append_pod<uint32_t>(&buffer, idle_saves);
+		append_pod<uint32_t>(&buffer, record.m_listing->size());
+		for(const auto &entry : *record.m_listing)
+		{
+			append_pod<uint64_t>(&buffer, entry.m_d_ino);
+			append_pod<uint8_t>(&buffer, entry.m_d_type);
+			append_pod<uint16_t>(&buffer, entry.m_name.size());
+			buffer.append(entry.m_name);
+		}
+		++num_written;
+	}
+
+	// Write it to a temporary file next to the real one and rename() it into place, so nobody ever sees half a cache.
+	std::string temp_path = m_path + ".tmp." + std::to_string(getpid());
+	{
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+		out.write(buffer.data(), buffer.size());
+		out.close();
+		if(!out)
+		{
+			WARN() << "Could not write directory listing cache '" << temp_path << "'.";
+			std::remove(temp_path.c_str());
+			return false;
+		}
+	}
+	if(std::rename(temp_path.c_str(), m_path.c_str()) != 0)
+	{
+		WARN() << "Could not replace directory listing cache '" << m_path << "': " << LOG_STRERROR();
+		std::remove(temp_path.c_str());
+		return false;
+	}
+
+	LOG(INFO) << "Wrote " << num_written << " directory listings to cache '" << m_path << "'.";
+
+	m_dirty = false;
+
+	return true;
+}
+
+std::shared_ptr<const DirListingCache::Listing> DirListingCache::Lookup(dev_ino_pair dir, const struct timespec &mtime)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_records.find(dir);
+	if(it == m_records.end() || !(it->second.m_mtime == mtime))
+	{
+		return nullptr;
+	}
+
+	it->second.m_used = true;
+	return it->second.m_listing;
+}
+
+void DirListingCache::Store(dev_ino_pair dir, const struct timespec &mtime, Listing &&listing)
+{
+	if(mtime.tv_sec >= m_start_time.tv_sec - f_racy_mtime_seconds)
+	{
+		// The directory could still be changing without its mtime changing.  Don't trust this listing.
+		return;
+	}
+
+	auto shared_listing = std::make_shared<const Listing>(std::move(listing));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_records[dir] = Record{mtime, std::move(shared_listing), 0, true};
+	m_dirty = true;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_LIBEXT_DIRLISTINGCACHE_H_
+#define SRC_LIBEXT_DIRLISTINGCACHE_H_
+
+#include <config.h>
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "filesystem.hpp"
+
+/**
+ * A persistent, on-disk cache of directory listings, keyed by the directory's dev/ino pair and validated by its
+ * modification time.
+ *
+ * Creating, deleting, or renaming an entry in a directory updates the directory's mtime, so as long as the mtime is
+ * unchanged, the names, inode numbers and d_types we read last time are still what readdir() would give us.  The one
+ * hole in that is a directory modified twice within the filesystem's timestamp granularity, so we never cache a listing
+ * whose mtime is too close to the time we read it.
+ *
+ * The listings are raw: they're what the directory contains, not what we decided to do with it, so one cache can be
+ * shared by searches with different file type and ignore-dir filters.
+ *
+ * Lookup() and Store() are thread-safe.  Load() and Save() aren't, and are meant to be called before and after the
+ * traversal.
+ */
+class DirListingCache
+{
+public:
+
+	/// One directory entry.
+	struct Entry
+	{
+		std::string m_name;
+		ino_t m_d_ino;
+		unsigned char m_d_type;
+	};
+
+	using Listing = std::vector<Entry>;
+
+	/**
+	 * Constructor.  Doesn't touch the filesystem; call Load() for that.
+	 *
+	 * @param path  The cache file.
+	 */
+	explicit DirListingCache(std::string path);
+	~DirListingCache() = default;
+
+	DirListingCache(const DirListingCache&) = delete;
+	DirListingCache& operator=(const DirListingCache&) = delete;
+
+	/**
+	 * Read the cache file.  A missing, truncated, or otherwise unusable cache file is treated as an empty cache.
+	 *
+	 * @returns true if the file was read.
+	 */
+	bool Load();
+
+	/**
+	 * Write the cache file back out if anything was stored since Load().  The file is replaced atomically, so
+	 * concurrent ucg runs sharing a cache file will see either the old or the new one, never a mix.
+	 *
+	 * @returns true on success, or if there was nothing to write.
+	 */
+	bool Save();
+
+	/**
+	 * Look up the listing for directory @a dir, whose current modification time is @a mtime.
+	 *
+	 * @returns The cached listing, or nullptr if there isn't one or it's out of date.
+	 */
+	std::shared_ptr<const Listing> Lookup(dev_ino_pair dir, const struct timespec &mtime);
+
+	/**
+	 * Cache @a listing as the contents of directory @a dir, which had modification time @a mtime when it was read.
+	 * Ignored if @a mtime is too recent to be trusted.
+	 */
+	void Store(dev_ino_pair dir, const struct timespec &mtime, Listing &&listing);
+
+private:
+
+	struct Record
+	{
+		struct timespec m_mtime;
+
+		std::shared_ptr<const Listing> m_listing;
+
+		/// Number of consecutive Save()s this record went unused for.  Records which get too old are dropped, so
+		/// directories which have been deleted or are never searched any more don't stay in the file forever.
+		uint32_t m_idle_saves;
+
+		bool m_used;
+	};
+
+	std::string m_path;
+
+	/// When we started.  Directories modified after (roughly) this aren't cached.
+	struct timespec m_start_time;
+
+	std::mutex m_mutex;
+
+	std::unordered_map<dev_ino_pair, Record> m_records;
+
+	/// true if Store() has changed anything.
+	bool m_dirty { false };
+};
+
+#endif /* SRC_LIBEXT_DIRLISTINGCACHE_H_ */
@@ -33,23 +33,202 @@
 #include <queue>
 #include <map>
 #include <algorithm>
+#include <chrono>
 
 #include <future/memory.hpp>
 #include <libext/filesystem.hpp> // For AT_FDCWD, AT_NO_AUTOMOUNT, openat(), etc.
+#include <libext/IOUring.h>
+#include <libext/DirentReader.h>
+#include <libext/DirListingCache.h>
+#include <libext/IgnoreRules.h>
 
 /// Estimate that we'll traverse no more than 10000 directories in one traversal.
-/// m_dir_has_been_visited will resize/rehash if it needs more space.
+/// m_dir_has_been_visited's shards will each resize/rehash if they need more space.
 constexpr auto M_INITIAL_NUM_DIR_ESTIMATE = 10000;
 
+/// Size of each traversal thread's getdents64() buffer.  Enough for several thousand entries per call.
+static constexpr size_t f_getdents_buffer_size = 256*1024;
+
+/// Maximum number of directory entries we'll stat() in one batch.
+static constexpr size_t f_stat_batch_size = 64;
+
+/// While reading a directory, hand the files found so far to the scanners once there are this many of them...
+static constexpr size_t f_file_flush_count = 1024;
+
+/// ...or once the oldest of them has been waiting this long, whichever comes first.  Small directories are read in
+/// much less time than this, so they still go out in a single push.
+static constexpr std::chrono::microseconds f_file_flush_interval {2000};
+
+/// Only look at the clock every this many entries.  Must be a power of two.
+static constexpr size_t f_file_flush_clock_check_interval = 64;
+
+/// Number of command-line paths in each of the work items they're dealt out to the traversal threads in.
+static constexpr size_t f_start_path_chunk_size = 64;
+
+/// true if @a name is "." or "..".
+static inline bool is_dot_or_dotdot(const std::string &name) noexcept
+{
+	return name[0] == '.' && (name.size() == 1 || (name.size() == 2 && name[1] == '.'));
+}
+
+/**
+ * Per-thread helper which stat()s a batch of directory entries.  Where io_uring and statx() are available, the whole
+ * batch goes to the kernel in one IORING_OP_STATX submission, so on network filesystems the lookups are in flight at
+ * the same time instead of one after the other.  Anything the ring can't do gets a plain fstatat_minimal().
+ */
+class DirTree::StatBatch
+{
+public:
+	explicit StatBatch(size_t max_batch_size) : m_max_batch_size(max_batch_size) {};
+
+	size_t GetMaxBatchSize() const noexcept { return m_max_batch_size; };
+
+	/**
+	 * stat() all of @a entries relative to @a dir_fd, filling in their m_statbuf and m_errno.  AT_STATX_DONT_SYNC is
+	 * dropped from @a flags for entries with m_needs_current_attrs set.
+	 *
+	 * @returns The number of entries which were stat()ed via io_uring.
+	 */
+	size_t Stat(int dir_fd, std::vector<DeferredDirent> &entries, int flags, unsigned int mask);
+
+private:
+
+	static int entry_flags(const DeferredDirent &entry, int flags) noexcept
+	{
+		return entry.m_needs_current_attrs ? (flags & ~AT_STATX_DONT_SYNC) : flags;
+	}
+
+	size_t m_max_batch_size;
+
+#if HAVE_LINUX_IO_URING && HAVE_STATX
+	/// Created the first time we need it, since most filesystems give us the file type in the dirent.
+	std::unique_ptr<IOUring> m_ring;
+
+	/// Set if we couldn't create the ring, or it failed.  We don't try again.
+	bool m_ring_failed { false };
+
+	std::vector<struct statx> m_statx_bufs;
+#endif
+};
+
+size_t DirTree::StatBatch::Stat(int dir_fd, std::vector<DeferredDirent> &entries, int flags, unsigned int mask)
+{
+	size_t num_batched = 0;
+
+	for(auto &entry : entries)
+	{
+		entry.m_errno = -1;
+	}
+
+#if HAVE_LINUX_IO_URING && HAVE_STATX
+	if(!m_ring && !m_ring_failed)
+	{
+		auto ring = std::make_unique<IOUring>(m_max_batch_size);
+		if(ring->IsValid())
+		{
+			m_ring = std::move(ring);
+			m_statx_bufs.resize(m_max_batch_size);
+		}
+		else
+		{
+			LOG(INFO) << "io_uring not available, falling back to stat()ing directory entries one at a time: " << LOG_STRERROR();
+			m_ring_failed = true;
+		}
+	}
+
+	if(m_ring)
+	{
+		for(size_t i=0; i<entries.size(); ++i)
+		{
+			io_uring_sqe *sqe = m_ring->GetSQE();
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = dir_fd;
+			sqe->addr = reinterpret_cast<uintptr_t>(entries[i].m_name.c_str());
+			sqe->len = mask;
+			sqe->off = reinterpret_cast<uintptr_t>(&m_statx_bufs[i]);
+			sqe->statx_flags = entry_flags(entries[i], flags);
+			sqe->user_data = i;
+		}
+
+		unsigned num_pending = entries.size();
+		int retval = m_ring->Submit(num_pending);
+		if(retval < 0)
+		{
+			LOG(INFO) << "io_uring submit failed, disabling batched stat()s: " << LOG_STRERROR(-retval);
+			m_ring.reset();
+			m_ring_failed = true;
+			num_pending = 0;
+		}
+
+		while(num_pending > 0)
+		{
+			io_uring_cqe *cqe = m_ring->PeekCQE();
+			if(cqe == nullptr)
+			{
+				if(m_ring->Wait(1) < 0)
+				{
+					// Don't trust anything we've gotten back, and don't use the ring again.
+					LOG(INFO) << "io_uring wait failed, disabling batched stat()s.";
+					for(auto &entry : entries)
+					{
+						entry.m_errno = -1;
+					}
+					num_batched = 0;
+					m_ring.reset();
+					m_ring_failed = true;
+					break;
+				}
+				continue;
+			}
+
+			if(cqe->res == 0)
+			{
+				auto &entry = entries[cqe->user_data];
+				std::memset(&entry.m_statbuf, 0, sizeof(entry.m_statbuf));
+				statx_to_stat(m_statx_bufs[cqe->user_data], &entry.m_statbuf);
+				entry.m_errno = 0;
+				++num_batched;
+			}
+			else if(cqe->res == -EINVAL)
+			{
+				// Kernel's io_uring doesn't know IORING_OP_STATX (it's from 5.6).  Don't bother with it again.
+				m_ring_failed = true;
+			}
+
+			m_ring->SeenCQE();
+			--num_pending;
+		}
+
+		if(m_ring_failed && m_ring)
+		{
+			LOG(INFO) << "io_uring doesn't support statx, falling back to stat()ing directory entries one at a time.";
+			m_ring.reset();
+		}
+	}
+#endif
+
+	// Do anything that didn't work out above the slow way.  This also gets us the real errno for any failures.
+	for(auto &entry : entries)
+	{
+		if(entry.m_errno != 0)
+		{
+			entry.m_errno = (fstatat_minimal(dir_fd, entry.m_name.c_str(), &entry.m_statbuf, entry_flags(entry, flags), mask) == 0)
+					? 0 : errno;
+		}
+	}
+
+	return num_batched;
+}
+
 DirTree::DirTree(sync_queue<std::shared_ptr<FileID>>& output_queue,
 		const file_basename_filter_type &file_basename_filter,
 		const dir_basename_filter_type &dir_basename_filter,
 		bool recurse,
 		bool follow_symlinks)
 	: m_recurse(recurse), m_follow_symlinks(follow_symlinks), m_out_queue(output_queue),
-	  m_file_basename_filter(file_basename_filter), m_dir_basename_filter(dir_basename_filter)
+	  m_file_basename_filter(file_basename_filter), m_dir_basename_filter(dir_basename_filter),
+	  m_dir_has_been_visited(M_INITIAL_NUM_DIR_ESTIMATE)
 {
-	m_dir_has_been_visited.reserve(M_INITIAL_NUM_DIR_ESTIMATE);
 }
 
 DirTree::~DirTree()
@@ -61,65 +240,35 @@ void DirTree::Scandir(std::vector<std::string> start_paths, int dirjobs)
 	m_dirjobs = dirjobs;
 
 	// Start at the cwd of the process (~AT_FDCWD)
-	std::shared_ptr<FileID> root_file_id = std::make_shared<FileID>(FileID::path_known_cwd_tag());
+	m_root_file_id = std::make_shared<FileID>(FileID::path_known_cwd_tag());
 
 	// OpenDir() it just so that FStatAt() works.
-	DIR *d = root_file_id->OpenDir();
+	DIR *d = m_root_file_id->OpenDir();
+
+	m_dir_scheduler = std::make_unique<WorkStealingScheduler<DirWorkItem>>(m_dirjobs);
 
 	//
-	// Step 1: Process the paths and/or filenames specified by the user on the command line.
-	// We always use only a single thread (the current one) for this step.
+	// Step 1: Deal the paths and/or filenames specified by the user on the command line out to the traversal threads,
+	// in chunks.  They'll find out what each one is, so that with tens of thousands of them, the stat()s happen in
+	// parallel and the files at the front of the list get scanned while the ones further back are still being looked
+	// at.  The threads pull from the back of their own deques, so deal the chunks out back to front.
 	//
 
-	for(auto p : start_paths)
+	const size_t num_chunks = (start_paths.size() + f_start_path_chunk_size - 1) / f_start_path_chunk_size;
+	for(size_t chunk = num_chunks; chunk-- > 0; )
 	{
-		// Clean up the paths coming from the command line.
-		p = clean_up_path(p);
-
-		/// @note At the moment, we're doing the equivalent of fts' COMFOLLOW here;
-		/// we follow symlinks during the fstatat() call in the FileID constructor by not specifying
-		/// AT_SYMLINK_NOFOLLOW.  So, we shouldn't get a FT_SYMLINK back from GetFileType().
-		auto file_or_dir = std::make_shared<FileID>(FileID(root_file_id, p));
-		auto type = file_or_dir->GetFileType();
-		switch(type)
+		DirWorkItem item;
+		auto first = start_paths.begin() + chunk * f_start_path_chunk_size;
+		auto last = start_paths.begin() + std::min(start_paths.size(), (chunk+1) * f_start_path_chunk_size);
+		item.m_start_paths.reserve(last - first);
+		for(auto p = first; p != last; ++p)
 		{
-		case FT_REG:
-		{
-			// Explicitly not filtering files specified on command line.
-			file_or_dir->SetFileDescriptorMode(FAM_RDONLY, FCF_NOATIME | FCF_NOCTTY);
-			m_out_queue.push_back(file_or_dir);
-			break;
-		}
-		case FT_DIR:
-		{
-			// Explicitly not filtering nor obeying no-recurse for dirs specified on command line.
-			file_or_dir->SetFileDescriptorMode(FAM_RDONLY, FCF_DIRECTORY | FCF_NOATIME | FCF_NOCTTY | FCF_NONBLOCK);
-			m_dir_queue.push_back(file_or_dir);
-			break;
-		}
-		case FT_SYMLINK:
-		{
-			// Should never get this.
-			ERROR() << "Got filetype of symlink while following symlinks";
-			break;
-		}
-		case FT_STAT_FAILED:
-		{
-			// Couldn't get any info on this path.
-			NOTICE() << "Could not get stat info at path \'" << file_or_dir->GetPath() << "\': "
-												<< LOG_STRERROR(errno) << ". Skipping.";
-			break;
-		}
-		default:
-		{
-			// Ignore all other types.
-			NOTICE() << "Unsupported file type at path \'" << file_or_dir->GetPath() << "\': " << ". Skipping.";
-			break;
-		}
+			// Clean up the paths coming from the command line.
+			item.m_start_paths.push_back(clean_up_path(*p));
 		}
+		m_dir_scheduler->Push(chunk % m_dirjobs, std::move(item));
 	}
 
-	root_file_id->CloseDir(d);
 
 	// Create and start the directory traversal threads.
 	std::vector<std::thread> threads;
@@ -131,41 +280,192 @@ void DirTree::Scandir(std::vector<std::string> start_paths, int dirjobs)
 
 	LOG(INFO) << "Globber threads = " << threads.size();
 
-	// Wait for the producer+consumer threads to finish.
-	m_dir_queue.wait_for_worker_completion(m_dirjobs);
-
-	m_dir_queue.close();
-
-	// Wait for all the threads to finish.
+	// Wait for all the threads to finish.  They'll exit on their own once there are no directories left anywhere.
 	for(auto &thr : threads)
 	{
 		thr.join();
 	}
 
+	m_dir_scheduler.reset();
+	m_root_file_id->CloseDir(d);
+
 	// Log the traversal stats.
 	LOG(INFO) << m_stats;
-	LOG(INFO) << "FileID stats:\n" << *root_file_id;
+	LOG(INFO) << "FileID stats:\n" << *m_root_file_id;
+	m_root_file_id.reset();
+}
+
+void DirTree::ProcessStartPath(std::string &&path, DirTraversalStats &stats,
+		std::deque<std::shared_ptr<FileID>> *local_file_queue, std::vector<DirWorkItem> *local_dir_queue)
+{
+	stats.m_num_start_paths++;
+
+	/// @note At the moment, we're doing the equivalent of fts' COMFOLLOW here;
+	/// we follow symlinks during the fstatat() call in the FileID constructor by not specifying
+	/// AT_SYMLINK_NOFOLLOW.  So, we shouldn't get a FT_SYMLINK back from GetFileType().
+	auto file_or_dir = std::make_shared<FileID>(FileID(m_root_file_id, path));
+	auto type = file_or_dir->GetFileType();
+	switch(type)
+	{
+	case FT_REG:
+	{
+		// Explicitly not filtering files specified on command line.
+		file_or_dir->SetFileDescriptorMode(FAM_RDONLY, FCF_NOATIME | FCF_NOCTTY);
+		local_file_queue->push_back(std::move(file_or_dir));
+		break;
+	}
+	case FT_DIR:
+	{
+		if(m_max_depth == 0)
+		{
+			// Only searching the files given on the command line.
+			LOG(INFO) << "Not reading '" << file_or_dir->GetPath() << "', --max-depth is 0.";
+			break;
+		}
+		// Explicitly not filtering nor obeying no-recurse for dirs specified on command line.
+		file_or_dir->SetFileDescriptorMode(FAM_RDONLY, FCF_DIRECTORY | FCF_NOATIME | FCF_NOCTTY | FCF_NONBLOCK);
+		local_dir_queue->push_back(DirWorkItem{std::move(file_or_dir), nullptr});
+		break;
+	}
+	case FT_SYMLINK:
+	{
+		// Should never get this.
+		ERROR() << "Got filetype of symlink while following symlinks";
+		break;
+	}
+	case FT_STAT_FAILED:
+	{
+		// Couldn't get any info on this path.
+		NOTICE() << "Could not get stat info at path \'" << file_or_dir->GetPath() << "\': "
+											<< LOG_STRERROR(errno) << ". Skipping.";
+		break;
+	}
+	default:
+	{
+		// Ignore all other types.
+		NOTICE() << "Unsupported file type at path \'" << file_or_dir->GetPath() << "\': " << ". Skipping.";
+		break;
+	}
+	}
 }
 
 void DirTree::ReaddirLoop(int dirjob_num)
 {
-	std::shared_ptr<FileID> dse;
+	DirWorkItem dir;
+	std::shared_ptr<FileID> &dse = dir.m_dir;
 	DIR *d {nullptr};
 	struct dirent *dp {nullptr};
 
+	// Reads the entries of each directory, reusing one big buffer.
+	DirentReader dirent_reader(f_getdents_buffer_size, m_use_getdents);
+
 	DirTraversalStats stats;
 
 	// Create a local queue to collect up any files we find without locking the main queue.
 	std::deque<std::shared_ptr<FileID>> local_file_queue;
 
+	// Likewise for the subdirectories, which we push onto our own scheduler deque when we're done with each directory.
+	std::vector<DirWorkItem> local_dir_queue;
+
+	// Entries we'll have to stat() to find out what they are.
+	StatBatch stat_batch(f_stat_batch_size);
+	std::vector<DeferredDirent> deferred;
+	deferred.reserve(f_stat_batch_size);
+
+	// The listing of the directory we're reading, if we're going to cache it.
+	DirListingCache::Listing new_listing;
+
+	// When the first file now in local_file_queue was found, and how many entries we've processed in this directory.
+	std::chrono::steady_clock::time_point oldest_file_time;
+	size_t num_dirents_processed = 0;
+
+	// Hand the files collected so far to the scanners.
+	auto flush_files = [&]() {
+		if(m_inode_order)
+		{
+			// The dev/ino pairs all came from the dirents, so this doesn't cost any stat()s.
+			std::sort(local_file_queue.begin(), local_file_queue.end(),
+					[](const std::shared_ptr<FileID> &a, const std::shared_ptr<FileID> &b){
+						return a->GetUniqueFileIdentifier() < b->GetUniqueFileIdentifier();
+					});
+		}
+		m_out_queue.push_back(local_file_queue);
+		local_file_queue.clear();
+	};
+
+	// Process one entry of the current directory, stat()ing any we've had to put aside once there are enough of them.
+	auto process_dirent = [&](std::string &&name, ino_t d_ino, unsigned char d_type) {
+		const bool had_files = !local_file_queue.empty();
+
+		ProcessDirent(dir, std::move(name), d_ino, d_type, stats, &local_file_queue, &local_dir_queue, &deferred);
+
+		if(deferred.size() >= stat_batch.GetMaxBatchSize())
+		{
+			ProcessDeferredDirents(dir, dirfd(d), stat_batch, &deferred, stats, &local_file_queue, &local_dir_queue);
+		}
+
+		// In a huge directory, don't make the scanners wait until we've read the whole thing.  Send what we have once
+		// there's a decent-sized batch of it, or once it's been sitting here a while.
+		++num_dirents_processed;
+		if(local_file_queue.empty())
+		{
+			return;
+		}
+		if(!had_files || (num_dirents_processed & (f_file_flush_clock_check_interval-1)) == 0)
+		{
+			auto now = std::chrono::steady_clock::now();
+			if(!had_files)
+			{
+				oldest_file_time = now;
+			}
+			else if(now - oldest_file_time >= f_file_flush_interval)
+			{
+				stats.m_num_partial_file_batches++;
+				flush_files();
+				return;
+			}
+		}
+		if(local_file_queue.size() >= f_file_flush_count)
+		{
+			stats.m_num_partial_file_batches++;
+			flush_files();
+		}
+	};
+
 	// Set the name of this thread, for logging and debug purposes.
 	set_thread_name("READDIR_" + std::to_string(dirjob_num));
 
-	while(m_dir_queue.pull_front(std::move(dse)) != queue_op_status::closed)
+	// Send the files and subdirectories found while working on the current work item to where they go next.
+	auto hand_off_results = [&]() {
+		if(!local_file_queue.empty())
+		{
+			flush_files();
+		}
+
+		// Push the subdirectories in reverse, so we pull them in the order we found them.
+		std::reverse(local_dir_queue.begin(), local_dir_queue.end());
+		m_dir_scheduler->Push(dirjob_num, local_dir_queue);
+		local_dir_queue.clear();
+	};
+
+	while(m_dir_scheduler->Pull(dirjob_num, dir))
 	{
+		if(!dir.m_start_paths.empty())
+		{
+			// Not a directory, a chunk of the command line.
+			for(auto &path : dir.m_start_paths)
+			{
+				ProcessStartPath(std::move(path), stats, &local_file_queue, &local_dir_queue);
+			}
+			dir.m_start_paths.clear();
+			hand_off_results();
+			continue;
+		}
+
 		LOG(DEBUG) << "Examining files in directory '" << dse->GetPath() << "'";
 
 		local_file_queue.clear();
+		num_dirents_processed = 0;
 
 		// Get a DIR* representing the directory specified by dse.
 		d = dse->OpenDir();
@@ -176,66 +476,164 @@ void DirTree::ReaddirLoop(int dirjob_num)
 			continue;
 		}
 
-		// Read all entries in this directory.
-		do
+		if(m_use_ignore_files)
+		{
+			// These have to apply to this directory's own entries, so read them first.
+			LoadIgnoreRules(dir, dirfd(d), stats);
+		}
+
+		// If we're caching directory listings, and this directory hasn't changed since we cached its listing, we don't
+		// have to read it again.  Note that we still need it open, since its descriptor is what the files and
+		// subdirectories in it get opened relative to.
+		std::shared_ptr<const DirListingCache::Listing> cached_listing;
+		struct stat dir_stat;
+		bool cache_this_dir = false;
+		if(m_listing_cache != nullptr)
 		{
-			if((dp = readdir(d)) != NULL)
+			// The mtime has to be current, so no AT_STATX_DONT_SYNC here.
+			if(fstatat_minimal(dirfd(d), "", &dir_stat, AT_EMPTY_PATH, STATX_INO | STATX_MTIME) == 0)
 			{
-				ProcessDirent(dse, dp, stats, &local_file_queue);
+				cached_listing = m_listing_cache->Lookup(dev_ino_pair(dir_stat.st_dev, dir_stat.st_ino), dir_stat.st_mtim);
+				cache_this_dir = !cached_listing;
 			}
-		} while(dp != NULL);
+		}
 
-		// Check if readdir is just done with this directory, or encountered an error.
-		if(errno != 0)
+		if(cached_listing)
 		{
-			WARN() << "Could not read directory: " << LOG_STRERROR(errno) << ". Skipping.";
-			errno = 0;
+			stats.m_num_dir_listing_cache_hits++;
+			for(const auto &entry : *cached_listing)
+			{
+				process_dirent(std::string(entry.m_name), entry.m_d_ino, entry.m_d_type);
+			}
 		}
+		else
+		{
+			// Read all entries in this directory.
+			dirent_reader.Open(d);
+			do
+			{
+				if((dp = dirent_reader.Read()) != NULL)
+				{
+					std::string name = dirent_get_name(dp);
+					if(cache_this_dir && !is_dot_or_dotdot(name))
+					{
+						new_listing.push_back(DirListingCache::Entry{name, dp->d_ino, dirent_get_type(dp)});
+					}
+					process_dirent(std::move(name), dp->d_ino, dirent_get_type(dp));
+				}
+			} while(dp != NULL);
 
-		if(!local_file_queue.empty())
+			// Check if readdir is just done with this directory, or encountered an error.
+			if(errno != 0)
+			{
+				WARN() << "Could not read directory: " << LOG_STRERROR(errno) << ". Skipping.";
+				errno = 0;
+				cache_this_dir = false;
+			}
+
+			if(cache_this_dir)
+			{
+				stats.m_num_dir_listing_cache_misses++;
+				m_listing_cache->Store(dev_ino_pair(dir_stat.st_dev, dir_stat.st_ino), dir_stat.st_mtim, std::move(new_listing));
+			}
+			new_listing.clear();
+		}
+
+		if(!deferred.empty())
 		{
-			m_out_queue.push_back(local_file_queue);
+			ProcessDeferredDirents(dir, dirfd(d), stat_batch, &deferred, stats, &local_file_queue, &local_dir_queue);
 		}
 
+		hand_off_results();
+
 		dse->CloseDir(d);
 	}
 
+	stats.m_num_getdents_calls = dirent_reader.GetNumSyscalls();
+	stats.m_num_dirs_stolen = m_dir_scheduler->GetNumSteals(dirjob_num);
 	m_stats += stats;
 }
 
 
-void DirTree::ProcessDirent(const std::shared_ptr<FileID>& dse, struct dirent* current_dirent, DirTraversalStats &stats,
-		std::deque<std::shared_ptr<FileID>> *local_file_queue)
+void DirTree::LoadIgnoreRules(DirWorkItem &dir, int dir_fd, DirTraversalStats &stats)
 {
-	struct stat statbuf;
+	std::shared_ptr<IgnoreRules> new_rules;
+
+	// Rules added later take precedence, and .ignore files override .gitignore files, so read them in this order.
+	for(const char *name : {".gitignore", ".ignore"})
+	{
+		int fd = openat(dir_fd, name, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+		if(fd == -1)
+		{
+			// Most directories don't have either.
+			continue;
+		}
 
-	bool is_dir {false};
-	bool is_file {false};
-	bool is_symlink {false};
-	bool is_unknown {true};
+		std::string contents;
+		char buffer[4096];
+		ssize_t num_read;
+		while((num_read = read(fd, buffer, sizeof(buffer))) > 0)
+		{
+			contents.append(buffer, num_read);
+		}
+		if(num_read == -1)
+		{
+			WARN() << "Could not read '" << dir.m_dir->GetPath() << "/" << name << "': " << LOG_STRERROR() << ". Skipping.";
+		}
+		close(fd);
+		if(num_read == -1)
+		{
+			continue;
+		}
+
+		if(!new_rules)
+		{
+			new_rules = std::make_shared<IgnoreRules>(dir.m_ignore_rules, dir.m_dir->GetPath());
+		}
+		new_rules->AddRules(contents);
+		stats.m_num_ignore_files_read++;
+	}
+
+	if(new_rules && !new_rules->empty())
+	{
+		dir.m_ignore_rules = std::move(new_rules);
+	}
+}
+
+void DirTree::ProcessDirent(const DirWorkItem &dir, std::string &&dname, ino_t d_ino, unsigned char d_type,
+		DirTraversalStats &stats,
+		std::deque<std::shared_ptr<FileID>> *local_file_queue, std::vector<DirWorkItem> *local_dir_queue,
+		std::vector<DeferredDirent> *deferred)
+{
+	const auto &dse = dir.m_dir;
 
-#if defined(_DIRENT_HAVE_D_TYPE)
 	// Reject anything that isn't a directory, a regular file, or a symlink.
-	// If it's DT_UNKNOWN, we'll have to do a stat to find out.
-	is_dir = (current_dirent->d_type == DT_DIR);
-	is_file = (current_dirent->d_type == DT_REG);
-	is_symlink = (current_dirent->d_type == DT_LNK);
-	is_unknown = (current_dirent->d_type == DT_UNKNOWN);
+	// If it's DT_UNKNOWN, we'll have to do a stat to find out.  That's always the case if struct dirent has no d_type;
+	// dirent_get_type() reports DT_UNKNOWN.
+	bool is_dir = (d_type == DT_DIR);
+	bool is_file = (d_type == DT_REG);
+	bool is_symlink = (d_type == DT_LNK);
+	bool is_unknown = (d_type == DT_UNKNOWN);
 	if(!is_file && !is_dir && !is_symlink && !is_unknown)
 	{
 		// It's a type we don't care about.
 		stats.m_num_filetype_without_stat++;
 		return;
 	}
-	if(!is_unknown)
+	// If we're staying on one filesystem, any directory could be a mount point.  Its dirent's d_ino is that of the
+	// directory underneath the mount, so only a stat() can tell us which device it's really on.  No point finding out
+	// if it's too deep to read anyway.
+	bool needs_dev = (m_one_file_system && is_dir && !IsAtMaxDepth(dir));
+	// Likewise, the size and time limits need stat info for files.
+	bool needs_stat_info = (is_file && HasFileStatFilters());
+	if(!is_unknown && !needs_dev && !needs_stat_info)
 	{
 		// We know the type from the dirent.
 		stats.m_num_filetype_without_stat++;
 	}
-#endif
-	const char *dname = current_dirent->d_name;
+
 	// Skip "." and "..".
-	if(dname[0] == '.' && (dname[1] == 0 || (dname[1] == '.' && dname[2] == 0)))
+	if(is_dot_or_dotdot(dname))
 	{
 		// Always skip "." and "..", unless they're specified on the command line.
 		stats.m_num_dotdirs_found++;
@@ -244,127 +642,225 @@ void DirTree::ProcessDirent(const std::shared_ptr<FileID>& dse, struct dirent* c
 		return;
 	}
 
-	struct stat *statbuff_ptr = nullptr;
+	if(needs_stat_info && !m_file_basename_filter(dname))
+	{
+		// Don't stat() files we wouldn't search anyway.
+		stats.m_num_filetype_without_stat++;
+		stats.m_num_files_found++;
+		stats.m_num_files_rejected++;
+		return;
+	}
 
-	if((is_unknown) || (m_follow_symlinks && is_symlink))
+	if((is_unknown) || (m_follow_symlinks && is_symlink) || needs_dev || needs_stat_info)
 	{
-		// We now have one of two situations:
+		// We now have one of three situations:
 		// - The dirent didn't know what the type of the file was, or
 		// - The dirent told us this was a symlink, and we're doing a logical traversal.
 		//   Now we have to actually stat this entry and see what it is.
 		//   Note that if the situation is m_logical+is_symlink, we want to find out
 		//   where it goes, so we follow the symlink.
+		// - It's a directory, and we need to know whether it's on our filesystem, or
+		// - It's a file, and we need its size or modification time.
+		// Put it aside, and stat it along with any others in this directory in one batch.
+		// Anything but a known directory may turn out to be a file we have to check against the size and time limits.
+		deferred->push_back(DeferredDirent{std::move(dname), d_ino, {}, 0, HasFileStatFilters() && !is_dir});
+		return;
+	}
 
-		stats.m_num_filetype_stats++;
+	ProcessEntry(dir, std::move(dname), is_file ? FT_REG : is_dir ? FT_DIR : FT_SYMLINK,
+			dse->GetDev(), d_ino, stats, local_file_queue, local_dir_queue);
+}
 
-		// Stat the filename using the directory as the at-descriptor.
-		dse->FStatAt(dname, &statbuf, AT_NO_AUTOMOUNT | (!m_follow_symlinks ? AT_SYMLINK_NOFOLLOW : 0));
+void DirTree::ProcessDeferredDirents(const DirWorkItem &dir, int dir_fd, StatBatch &stat_batch,
+		std::vector<DeferredDirent> *deferred, DirTraversalStats &stats,
+		std::deque<std::shared_ptr<FileID>> *local_file_queue, std::vector<DirWorkItem> *local_dir_queue)
+{
+	const auto &dse = dir.m_dir;
+
+	stats.m_num_filetype_stats += deferred->size();
+
+	// For most entries, all we need is the type.  The file scanner gets the size from the descriptor after it opens the
+	// file.  So cached attributes will do, and we can spare network filesystems a round trip to the server for every
+	// entry.  The exception is anything which may be a file we have to check against the size and time limits.  On
+	// NFS or FUSE, cached attributes can be stale, and a recently modified file is exactly what --changed-within and
+	// --newer are looking for, so those entries get current ones (see StatBatch::Stat()).
+	/// @note This shouldn't ever come back as a symlink if we're doing a logical traversal, since
+	///       statx() follows symlinks by default.  We add the AT_SYMLINK_NOFOLLOW flag and then
+	///       ignore any symlinks returned if we're doing a physical traversal.
+	/// @note statx() always returns the device, so checking for mount points doesn't need anything more in the mask.
+	///       AT_NO_AUTOMOUNT gets us the automount point itself rather than mounting whatever's behind it.
+	int flags = AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC | (!m_follow_symlinks ? AT_SYMLINK_NOFOLLOW : 0);
+	unsigned int mask = STATX_TYPE | (HasFileStatFilters() ? (STATX_SIZE | STATX_MTIME) : 0);
+	stats.m_num_filetype_stats_batched += stat_batch.Stat(dir_fd, *deferred, flags, mask);
+
+	for(auto &entry : *deferred)
+	{
+		if(entry.m_errno != 0)
+		{
+			WARN() << "Attempt to stat file '" << entry.m_name << "' in directory '" << dse->GetPath() << "' failed: "
+					<< LOG_STRERROR(entry.m_errno);
+			continue;
+		}
 
-		is_dir = S_ISDIR(statbuf.st_mode);
-		is_file = S_ISREG(statbuf.st_mode);
-		/// @note This shouldn't ever come back as a symlink if we're doing a logical traversal, since
-		///       fstatat() follows symlinks by default.  We add the AT_SYMLINK_NOFOLLOW flag and then
-		///       ignore any symlinks returned if we're doing a physical traversal.
-		is_symlink = S_ISLNK(statbuf.st_mode);
-		if(is_dir || is_file || is_symlink)
+		const auto mode = entry.m_statbuf.st_mode;
+		FileType type = S_ISREG(mode) ? FT_REG : S_ISDIR(mode) ? FT_DIR : S_ISLNK(mode) ? FT_SYMLINK : FT_UNKNOWN;
+		if(type == FT_UNKNOWN)
 		{
-			is_unknown = false;
+			// Is the file type still unknown?
+			WARN() << "cannot determine file type: " << entry.m_name << ", " << mode;
+			continue;
 		}
 
-		// Capture the stat info we just got for the FileID object we'll create below.
-		statbuff_ptr = &statbuf;
+		if(m_one_file_system && type == FT_DIR && entry.m_statbuf.st_dev != dse->GetDev())
+		{
+			// A mount point.  Don't go there.
+			LOG(INFO) << "'" << dse->GetPath() << "/" << entry.m_name << "' is on a different filesystem, skipping.";
+			stats.m_num_directories_found++;
+			stats.m_num_dirs_rejected++;
+			stats.m_num_mount_points_pruned++;
+			continue;
+		}
+
+		ProcessEntry(dir, std::move(entry.m_name), type, dse->GetDev(), entry.m_d_ino, stats, local_file_queue,
+				local_dir_queue, &entry.m_statbuf);
 	}
 
-	// Is the file type still unknown?
-	if(is_unknown)
+	deferred->clear();
+}
+
+bool DirTree::PassesFileStatFilters(const struct stat &stat_buf) const noexcept
+{
+	if(m_max_file_size >= 0 && stat_buf.st_size > m_max_file_size)
 	{
-		WARN() << "cannot determine file type: " << dname << ", " << statbuf.st_mode;
-		return;
+		return false;
 	}
 
-	// We now know the type for certain.
-	// Is this a file type we're interested in?
-	if(is_file || is_dir || is_symlink)
+	if(stat_buf.st_mtim.tv_sec < m_min_mtime.tv_sec
+			|| (stat_buf.st_mtim.tv_sec == m_min_mtime.tv_sec && stat_buf.st_mtim.tv_nsec < m_min_mtime.tv_nsec))
 	{
-		// We'll need the file's basename.
-		std::string bname {dirent_get_name(current_dirent)};
-
-		LOG(INFO) << "Considering dirent name='" << bname << "'";
-
-		if(is_file)
-		{
-			// It's a normal file.
-			LOG(INFO) << "... normal file.";
-			stats.m_num_files_found++;
+		return false;
+	}
 
-			// Check for inclusion.
-			if(m_file_basename_filter(bname))
-			{
-				// Based on the file name, this file should be scanned.
+	return true;
+}
 
-				LOG(INFO) << "... should be scanned.";
+void DirTree::ProcessEntry(const DirWorkItem &dir, std::string &&bname, FileType type, dev_t d, ino_t i,
+		DirTraversalStats &stats, std::deque<std::shared_ptr<FileID>> *local_file_queue,
+		std::vector<DirWorkItem> *local_dir_queue, const struct stat *stat_buf)
+{
+	const auto &dse = dir.m_dir;
 
-				std::shared_ptr<FileID> file_to_scan {std::make_shared<FileID>(FileID::path_known_relative_tag(), dse, bname,
-						statbuff_ptr,
-						FT_REG,
-						dse->GetDev(), current_dirent->d_ino,
-						FAM_RDONLY, FCF_NOCTTY | FCF_NOATIME)};
+	// We now know the type for certain.
+	LOG(INFO) << "Considering dirent name='" << bname << "'";
 
-				// Queue it up.
-				local_file_queue->push_back(std::move(file_to_scan));
+	if(type == FT_REG)
+	{
+		// It's a normal file.
+		LOG(INFO) << "... normal file.";
+		stats.m_num_files_found++;
 
-				// Count the number of files we found that were included in the search.
-				stats.m_num_files_scanned++;
-			}
-			else
+		// Check for inclusion.
+		if(m_file_basename_filter(bname))
+		{
+			if(dir.m_ignore_rules && dir.m_ignore_rules->IsIgnored(dse->GetPath(), bname, false))
 			{
+				LOG(INFO) << "... excluded by ignore file rules.";
+				stats.m_num_entries_ignored++;
 				stats.m_num_files_rejected++;
+				return;
 			}
-		}
-		else if(is_dir)
-		{
-			LOG(INFO) << "... directory.";
-			stats.m_num_directories_found++;
 
-			if(!m_recurse || m_dir_basename_filter(bname))
+			if(stat_buf != nullptr && HasFileStatFilters() && !PassesFileStatFilters(*stat_buf))
 			{
-				// This name is in the dir exclude list.  Exclude the dir and all subdirs from the scan.
-				LOG(INFO) << "... should be ignored.";
-				stats.m_num_dirs_rejected++;
+				LOG(INFO) << "... excluded by size or modification time.";
+				stats.m_num_files_size_or_time_rejected++;
+				stats.m_num_files_rejected++;
 				return;
 			}
 
-			auto dir_atfd = std::make_shared<FileID>(FileID::path_known_relative_tag(), dse, bname, statbuff_ptr, FT_DIR,
-					dse->GetDev(), current_dirent->d_ino,
-					FAM_RDONLY, FCF_DIRECTORY | FCF_NOATIME | FCF_NOCTTY | FCF_NONBLOCK);
+			// Based on the file name, this file should be scanned.
 
-			if(m_follow_symlinks)
-			{
-				// We have to detect any symlink cycles ourselves.
-				if(HasDirBeenVisited(dir_atfd->GetUniqueFileIdentifier()))
-				{
-					// Found cycle.
-					WARN() << "'" << dir_atfd->GetPath() << "': already visited this directory, possible recursive directory loop?";
-					stats.m_num_dirs_rejected++;
-					return;
-				}
-			}
+			LOG(INFO) << "... should be scanned.";
+
+			std::shared_ptr<FileID> file_to_scan {std::make_shared<FileID>(FileID::path_known_relative_tag(), dse, bname,
+					nullptr,
+					FT_REG,
+					d, i,
+					FAM_RDONLY, FCF_NOCTTY | FCF_NOATIME)};
 
-			m_dir_queue.push_back(std::move(dir_atfd));
+			// Queue it up.
+			local_file_queue->push_back(std::move(file_to_scan));
+
+			// Count the number of files we found that were included in the search.
+			stats.m_num_files_scanned++;
 		}
-		else if(is_symlink)
+		else
 		{
-			if(m_follow_symlinks)
-			{
-				// Logical traversal, should never get here.
-				ERROR() << "found unresolved symlink during logical traversal";
-			}
-			else
+			stats.m_num_files_rejected++;
+		}
+	}
+	else if(type == FT_DIR)
+	{
+		LOG(INFO) << "... directory.";
+		stats.m_num_directories_found++;
+
+		if(!m_recurse || m_dir_basename_filter(bname))
+		{
+			// This name is in the dir exclude list.  Exclude the dir and all subdirs from the scan.
+			LOG(INFO) << "... should be ignored.";
+			stats.m_num_dirs_rejected++;
+			return;
+		}
+
+		if(IsAtMaxDepth(dir))
+		{
+			// Its contents would be deeper than we're going.
+			LOG(INFO) << "... beyond the depth limit.";
+			stats.m_num_dirs_depth_pruned++;
+			stats.m_num_dirs_rejected++;
+			return;
+		}
+
+		if(dir.m_ignore_rules && dir.m_ignore_rules->IsIgnored(dse->GetPath(), bname, true))
+		{
+			// Prune the whole subtree without ever opening it.
+			LOG(INFO) << "... excluded by ignore file rules.";
+			stats.m_num_entries_ignored++;
+			stats.m_num_dirs_rejected++;
+			return;
+		}
+
+		auto dir_atfd = std::make_shared<FileID>(FileID::path_known_relative_tag(), dse, bname, nullptr, FT_DIR,
+				d, i,
+				FAM_RDONLY, FCF_DIRECTORY | FCF_NOATIME | FCF_NOCTTY | FCF_NONBLOCK);
+
+		if(m_follow_symlinks)
+		{
+			// We have to detect any symlink cycles ourselves.
+			if(HasDirBeenVisited(dir_atfd->GetUniqueFileIdentifier()))
 			{
-				// Physical traversal, just ignore the symlink.
-				LOG(INFO) << "Found symlink during physical traversal: '" << dse->GetPath() << "/" << bname << "'";
+				// Found cycle.
+				WARN() << "'" << dir_atfd->GetPath() << "': already visited this directory, possible recursive directory loop?";
+				stats.m_num_dirs_rejected++;
+				return;
 			}
-			return;
 		}
+
+		// The subdirectory inherits our ignore rules, and adds any of its own when it's read.
+		local_dir_queue->push_back(DirWorkItem{std::move(dir_atfd), dir.m_ignore_rules, dir.m_depth + 1});
+	}
+	else if(type == FT_SYMLINK)
+	{
+		if(m_follow_symlinks)
+		{
+			// Logical traversal, should never get here.
+			ERROR() << "found unresolved symlink during logical traversal";
+		}
+		else
+		{
+			// Physical traversal, just ignore the symlink.
+			LOG(INFO) << "Found symlink during physical traversal: '" << dse->GetPath() << "/" << bname << "'";
+		}
+		return;
 	}
 }
@@ -25,11 +25,15 @@
 #include <vector>
 #include <string>
 #include <functional>
-#include <unordered_set>
 
 /// @todo Break this dependency on the output queue class.
 #include "../sync_queue_impl_selector.h"
 #include "FileID.h"
+#include "WorkStealingScheduler.hpp"
+#include "ConcurrentHashSet.hpp"
+
+class DirListingCache;
+class IgnoreRules;
 
 #include <dirent.h>
 
@@ -53,7 +57,19 @@ class DirTraversalStats
 	X("Number of files rejected", m_num_files_rejected) \
 	X("Number of files sent for scanning", m_num_files_scanned) \
 	X("Number of files which required a stat() call to determine type", m_num_filetype_stats) \
-	X("Number of files which did not require a stat() call to determine type", m_num_filetype_without_stat)
+	X("Number of those stat() calls which were batched via io_uring", m_num_filetype_stats_batched) \
+	X("Number of files which did not require a stat() call to determine type", m_num_filetype_without_stat) \
+	X("Number of getdents64() calls", m_num_getdents_calls) \
+	X("Number of directories stolen from another traversal thread", m_num_dirs_stolen) \
+	X("Number of directory listings reused from the listing cache", m_num_dir_listing_cache_hits) \
+	X("Number of directories missing from the listing cache or changed since", m_num_dir_listing_cache_misses) \
+	X("Number of .gitignore/.ignore files read", m_num_ignore_files_read) \
+	X("Number of files and directories excluded by .gitignore/.ignore rules", m_num_entries_ignored) \
+	X("Number of mount points not descended into", m_num_mount_points_pruned) \
+	X("Number of directories not descended into due to the depth limit", m_num_dirs_depth_pruned) \
+	X("Number of files excluded by size or modification time", m_num_files_size_or_time_rejected) \
+	X("Number of partial file batches sent while still reading a directory", m_num_partial_file_batches) \
+	X("Number of command-line paths", m_num_start_paths)
 
 public:
 #define X(d,s) size_t s {0};
@@ -125,6 +141,52 @@ public:
 	 */
 	void Scandir(std::vector<std::string> start_paths, int dirjobs);
 
+	/// Set whether directories should be read in bulk with getdents64(), where supported, instead of with readdir().
+	void SetUseGetdents(bool use_getdents) noexcept { m_use_getdents = use_getdents; };
+
+	/**
+	 * Set whether the files found in each directory should be sent for scanning sorted by inode number instead of in
+	 * the order the directory lists them.  On ext4, XFS, and the like, inode order roughly follows where the data is on
+	 * the disk, while directory order is effectively random, so this turns cold-cache reads from a rotating disk into
+	 * something much closer to a sequential read.
+	 */
+	void SetInodeOrder(bool inode_order) noexcept { m_inode_order = inode_order; };
+
+	/**
+	 * Set the cache of directory listings to use, or nullptr for none.  Directories which haven't changed since their
+	 * listings were cached aren't read again, and the listings of any others are added to the cache.  The caller owns
+	 * @a listing_cache, and is responsible for loading and saving it.
+	 */
+	void SetDirListingCache(DirListingCache *listing_cache) noexcept { m_listing_cache = listing_cache; };
+
+	/**
+	 * Set whether to obey any .gitignore and .ignore files found during the traversal.  Each directory's rules are
+	 * compiled once and inherited by its subdirectories, and excluded subdirectories are never opened.
+	 */
+	void SetUseIgnoreFiles(bool use_ignore_files) noexcept { m_use_ignore_files = use_ignore_files; };
+
+	/**
+	 * Set whether to stay on the filesystem each start path is on, like find's -xdev.  Subdirectories on any other
+	 * device (mount points, including untriggered automounts) are counted and skipped without being opened.
+	 */
+	void SetOneFileSystem(bool one_file_system) noexcept { m_one_file_system = one_file_system; };
+
+	/**
+	 * Set the maximum number of directory levels to descend below the start paths.  0 means don't read the start
+	 * directories at all, and -1, the default, means no limit.
+	 */
+	void SetMaxDepth(int max_depth) noexcept { m_max_depth = max_depth; };
+
+	/**
+	 * Set the size in bytes above which files are skipped, or -1 for no limit.  Together with SetMinMtime(), this
+	 * means every file which passes the name filters gets stat()ed, in batches, while its directory is being read,
+	 * so that excluded files are never opened.  Files named on the command line aren't filtered.
+	 */
+	void SetMaxFileSize(off_t max_file_size) noexcept { m_max_file_size = max_file_size; };
+
+	/// Set the modification time before which files are skipped, or all zeroes (the default) for no limit.
+	void SetMinMtime(const struct timespec &min_mtime) noexcept { m_min_mtime = min_mtime; };
+
 private:
 
 	/// Flag indicating whether to recurse into subdirectories.
@@ -135,8 +197,63 @@ private:
 
 	int m_dirjobs {4};
 
-	/// Directory queue.  Used internally.
-	sync_queue<std::shared_ptr<FileID>> m_dir_queue;
+	/// Whether to read directories with getdents64().
+	bool m_use_getdents { true };
+
+	/// Whether to sort each directory's files by inode number.
+	bool m_inode_order { false };
+
+	/// The directory listing cache, if any.
+	DirListingCache *m_listing_cache { nullptr };
+
+	/// Whether to obey .gitignore and .ignore files.
+	bool m_use_ignore_files { false };
+
+	/// Whether to skip subdirectories on other devices.
+	bool m_one_file_system { false };
+
+	/// @name Limits on what gets searched.
+	/// @{
+	int m_max_depth { -1 };
+	off_t m_max_file_size { -1 };
+	struct timespec m_min_mtime { 0, 0 };
+	/// @}
+
+	/// @returns true if the files in directories need to be stat()ed to check them against the size and time limits.
+	bool HasFileStatFilters() const noexcept
+	{
+		return m_max_file_size >= 0 || m_min_mtime.tv_sec != 0 || m_min_mtime.tv_nsec != 0;
+	};
+
+	/// @returns true if a file with stat info @a stat_buf passes the size and time limits.
+	bool PassesFileStatFilters(const struct stat &stat_buf) const noexcept;
+
+	/**
+	 * A directory waiting to be read, and the .gitignore/.ignore rules in effect in it.  Or, if m_start_paths isn't
+	 * empty, a chunk of the paths given on the command line which have yet to be stat()ed to find out what they are.
+	 */
+	struct DirWorkItem
+	{
+		std::shared_ptr<FileID> m_dir;
+
+		/// nullptr if there aren't any.
+		std::shared_ptr<const IgnoreRules> m_ignore_rules;
+
+		/// How many levels below its start path this directory is.  The start paths are 0.
+		int m_depth { 0 };
+
+		/// Command-line paths, already cleaned up.  Empty for a directory.
+		std::vector<std::string> m_start_paths {};
+	};
+
+	/// @returns true if the subdirectories of @a dir are beyond the depth limit, and so shouldn't be read.
+	bool IsAtMaxDepth(const DirWorkItem &dir) const noexcept { return m_max_depth >= 0 && dir.m_depth + 1 >= m_max_depth; };
+
+	/// The directories waiting to be read, spread over the traversal threads.  Only exists during Scandir().
+	std::unique_ptr<WorkStealingScheduler<DirWorkItem>> m_dir_scheduler;
+
+	/// The process's cwd, which the start paths are relative to.  Open for FStatAt() during Scandir().
+	std::shared_ptr<FileID> m_root_file_id;
 
 	/// File output queue.
 	sync_queue<std::shared_ptr<FileID>>& m_out_queue;
@@ -146,26 +263,69 @@ private:
 
 	DirTraversalStats m_stats;
 
-	using visited_set = std::unordered_set<dev_ino_pair>;
-	std::mutex m_dir_mutex;
-	visited_set m_dir_has_been_visited;
+	/// The directories we've visited, for detecting symlink cycles during logical traversals.  Sharded, since every
+	/// traversal thread checks every directory it finds against it.
+	ConcurrentHashSet<dev_ino_pair> m_dir_has_been_visited;
 	bool HasDirBeenVisited(dev_ino_pair di)
 	{
-		std::lock_guard<std::mutex> lock(m_dir_mutex);
-		return !m_dir_has_been_visited.insert(di).second;
+		return !m_dir_has_been_visited.insert(di);
 	}
 
 	void ReaddirLoop(int dirjob_num);
 
 	/**
-	 * Process a single directory entry (dirent) structure #de, with parent #dse.  Push any files found on the #m_out_queue,
-	 * push any directories found on the #m_dir_queue.  Maintain statistics in #stats.
-	 *
-	 * @param dse
-	 * @param de
+	 * Find out what the command-line path @a path is, and append it to @a local_file_queue if it's a file, or to
+	 * @a local_dir_queue if it's a directory.  Neither are filtered.
+	 */
+	void ProcessStartPath(std::string &&path, DirTraversalStats &stats,
+			std::deque<std::shared_ptr<FileID>> *local_file_queue, std::vector<DirWorkItem> *local_dir_queue);
+
+	/**
+	 * Read any .gitignore and .ignore files in directory @a dir, open as @a dir_fd, and if there are any, replace
+	 * @a dir's ignore rules with a new set which adds theirs to the ones it inherited.
+	 */
+	void LoadIgnoreRules(DirWorkItem &dir, int dir_fd, DirTraversalStats &stats);
+
+	/// A directory entry whose type can only be determined by stat()ing it.
+	struct DeferredDirent
+	{
+		std::string m_name;
+		ino_t m_d_ino;
+		struct stat m_statbuf;
+		int m_errno;
+		/// true if the stat info will be checked against the size or time limits, so cached attributes won't do.
+		bool m_needs_current_attrs;
+	};
+
+	/// Per-thread helper which stat()s a batch of DeferredDirents at once.  Defined in DirTree.cpp.
+	class StatBatch;
+
+	/**
+	 * Process a single directory entry named @a dname, with inode number @a d_ino and dirent type @a d_type, in parent
+	 * directory @a dir.  Append any files found to @a local_file_queue, and any directories found to @a local_dir_queue.
+	 * Maintain statistics in #stats.  If the type of the entry can't be determined without a stat(), it's appended to
+	 * @a deferred instead.
+	 */
+	void ProcessDirent(const DirWorkItem &dir, std::string &&dname, ino_t d_ino, unsigned char d_type,
+			DirTraversalStats &stats,
+			std::deque<std::shared_ptr<FileID>> *local_file_queue, std::vector<DirWorkItem> *local_dir_queue,
+			std::vector<DeferredDirent> *deferred);
+
+	/**
+	 * stat() all the entries in @a deferred relative to @a dir_fd, process them as ProcessDirent() would have, and
+	 * clear @a deferred.
+	 */
+	void ProcessDeferredDirents(const DirWorkItem &dir, int dir_fd, StatBatch &stat_batch,
+			std::vector<DeferredDirent> *deferred, DirTraversalStats &stats,
+			std::deque<std::shared_ptr<FileID>> *local_file_queue, std::vector<DirWorkItem> *local_dir_queue);
+
+	/**
+	 * Process a directory entry of known @a type, which is one of FT_REG, FT_DIR, or FT_SYMLINK.  @a d and @a i
+	 * are its device and inode.  @a stat_buf is its stat info, if we had to stat() it.
 	 */
-	void ProcessDirent(const std::shared_ptr<FileID>& dse, struct dirent *de, DirTraversalStats &stats,
-			std::deque<std::shared_ptr<FileID>> *local_file_queue);
+	void ProcessEntry(const DirWorkItem &dir, std::string &&bname, FileType type, dev_t d, ino_t i,
+			DirTraversalStats &stats, std::deque<std::shared_ptr<FileID>> *local_file_queue,
+			std::vector<DirWorkItem> *local_dir_queue, const struct stat *stat_buf = nullptr);
 
 };
 
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "DirentReader.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <unistd.h>
+#if HAVE_DECL_SYS_GETDENTS64
+#include <sys/syscall.h>
+#endif
+
+/// The layout getdents64() fills the buffer with, from the getdents(2) man page.
+struct linux_dirent64
+{
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+/// We hand out the records in the getdents64() buffer as struct dirent *'s, so everything DirTree looks at has to be
+/// in the same place.  This is the case for glibc on 64-bit platforms, and on 32-bit ones with _FILE_OFFSET_BITS=64.
+static constexpr bool f_dirent_is_dirent64 =
+#if defined(_DIRENT_HAVE_D_TYPE) && defined(_DIRENT_HAVE_D_RECLEN) && defined(_DIRENT_HAVE_D_OFF)
+		sizeof(dirent::d_ino) == sizeof(linux_dirent64::d_ino)
+		&& offsetof(dirent, d_ino) == offsetof(linux_dirent64, d_ino)
+		&& offsetof(dirent, d_reclen) == offsetof(linux_dirent64, d_reclen)
+		&& offsetof(dirent, d_type) == offsetof(linux_dirent64, d_type)
+		&& offsetof(dirent, d_name) == offsetof(linux_dirent64, d_name);
+#else
+		false;
+#endif
+
+
+DirentReader::DirentReader(size_t buffer_size, bool use_getdents)
+{
+#if HAVE_DECL_SYS_GETDENTS64
+	if(use_getdents && f_dirent_is_dirent64 && buffer_size > 0)
+	{
+		m_buffer.reset(new char[buffer_size]);
+		m_buffer_size = buffer_size;
+	}
+#else
+	(void)buffer_size;
+	(void)use_getdents;
+#endif
+}
+
+DirentReader::~DirentReader()
+{
+}
+
+void DirentReader::Open(DIR *d) noexcept
+{
+	m_dir = d;
+	m_next = 0;
+	m_end = 0;
+	m_at_eof = false;
+}
+
+struct dirent* DirentReader::Read() noexcept
+{
+	if(!m_buffer)
+	{
+		errno = 0;
+		return readdir(m_dir);
+	}
+
+#if HAVE_DECL_SYS_GETDENTS64
+	if(m_next >= m_end)
+	{
+		if(m_at_eof)
+		{
+			errno = 0;
+			return nullptr;
+		}
+
+		// Refill the buffer.  We own the DIR*'s descriptor from here on; readdir() must not be mixed in.
+		++m_num_syscalls;
+		long num_bytes = syscall(SYS_getdents64, dirfd(m_dir), m_buffer.get(), m_buffer_size);
+		if(num_bytes <= 0)
+		{
+			// 0 == end of directory, otherwise errno is set.
+			if(num_bytes == 0)
+			{
+				errno = 0;
+			}
+			m_at_eof = true;
+			return nullptr;
+		}
+
+		m_next = 0;
+		m_end = num_bytes;
+	}
+
+	auto de = reinterpret_cast<struct dirent*>(m_buffer.get() + m_next);
+	m_next += reinterpret_cast<linux_dirent64*>(de)->d_reclen;
+	return de;
+#else
+	return nullptr;
+#endif
+}
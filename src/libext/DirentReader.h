@@ -0,0 +1,96 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_LIBEXT_DIRENTREADER_H_
+#define SRC_LIBEXT_DIRENTREADER_H_
+
+#include <config.h>
+
+#include <cstddef>
+#include <memory>
+
+#include <dirent.h>
+
+/**
+ * Reads the entries of directories in bulk.
+ *
+ * readdir() goes through a buffer of only ~32KB which glibc allocates and frees for every DIR*, so a directory with
+ * hundreds of thousands of entries takes hundreds of getdents64() system calls.  On Linux, DirentReader calls
+ * getdents64() directly with a much larger buffer, which it keeps for its whole lifetime.  A traversal thread which
+ * owns one can read every directory it visits through the same buffer.
+ *
+ * Where getdents64() isn't available, or the kernel's dirent64 layout doesn't match struct dirent, or it's been
+ * disabled, this just calls readdir().
+ */
+class DirentReader
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param buffer_size   Size of the getdents64() buffer, in bytes.
+	 * @param use_getdents  false == always use readdir().
+	 */
+	DirentReader(size_t buffer_size, bool use_getdents);
+	~DirentReader();
+
+	DirentReader(const DirentReader&) = delete;
+	DirentReader& operator=(const DirentReader&) = delete;
+
+	/// @returns true if this reader will use getdents64().
+	bool UsesGetdents() const noexcept { return m_buffer != nullptr; };
+
+	/**
+	 * Start reading the entries of @a d, which must not have had readdir() called on it yet.
+	 * Any entries not yet returned from the previous directory are discarded.
+	 */
+	void Open(DIR *d) noexcept;
+
+	/**
+	 * Get the next directory entry.  Like readdir(), the entry is only valid until the next call.
+	 *
+	 * @returns The next entry, or nullptr at the end of the directory or on an error.  errno is 0 at the end of the
+	 *          directory, and set to the error otherwise.
+	 */
+	struct dirent* Read() noexcept;
+
+	/// @returns The number of getdents64() calls made so far.
+	size_t GetNumSyscalls() const noexcept { return m_num_syscalls; };
+
+private:
+
+	DIR *m_dir { nullptr };
+
+	/// The getdents64() buffer, or nullptr if we're using readdir().
+	std::unique_ptr<char[]> m_buffer;
+	size_t m_buffer_size { 0 };
+
+	/// Offset of the next entry in m_buffer.
+	size_t m_next { 0 };
+
+	/// Number of valid bytes in m_buffer.
+	size_t m_end { 0 };
+
+	/// Whether getdents64() has told us there are no more entries.
+	bool m_at_eof { false };
+
+	size_t m_num_syscalls { 0 };
+};
+
+#endif /* SRC_LIBEXT_DIRENTREADER_H_ */
@@ -23,15 +23,182 @@
 
 #include "filesystem.hpp"
 
+#include <algorithm>
+#include <sys/resource.h> // For getrlimit().
 
-FileDescriptorCache::FileDescriptorCache()
+
+/// The process-wide cache gets this fraction of RLIMIT_NOFILE.  The rest is left for the files being scanned,
+/// the directories being read, and whatever else the process has open.
+static constexpr size_t f_rlimit_divisor = 4;
+
+/// Bounds on the size of the process-wide cache.
+/// @{
+static constexpr size_t f_min_cache_size = 8;
+static constexpr size_t f_max_cache_size = 4096;
+/// @}
+
+std::atomic<FileDescriptorCache::key_type> FileDescriptorCache::m_next_key { FileDescriptorCache::invalid_key + 1 };
+
+
+FileDescriptorCache::Lease::Lease(Lease &&other) noexcept
+	: m_cache(other.m_cache), m_entry(other.m_entry), m_fd(other.m_fd)
+{
+	other.m_cache = nullptr;
+	other.m_fd = -1;
+}
+
+FileDescriptorCache::Lease& FileDescriptorCache::Lease::operator=(Lease &&other) noexcept
 {
-	// TODO Auto-generated constructor stub
+	if(this != &other)
+	{
+		reset();
+		m_cache = other.m_cache;
+		m_entry = other.m_entry;
+		m_fd = other.m_fd;
+		other.m_cache = nullptr;
+		other.m_fd = -1;
+	}
+	return *this;
+}
 
+void FileDescriptorCache::Lease::reset() noexcept
+{
+	if(m_cache != nullptr)
+	{
+		m_cache->Unpin(m_entry);
+		m_cache = nullptr;
+	}
+	m_fd = -1;
+}
+
+
+FileDescriptorCache::FileDescriptorCache(size_t max_size) : m_max_size(std::max<size_t>(max_size, 1))
+{
+	m_map.reserve(m_max_size);
 }
 
 FileDescriptorCache::~FileDescriptorCache()
 {
-	// TODO Auto-generated destructor stub
+	for(auto &entry : m_lru_list)
+	{
+		close(entry.m_fd);
+	}
+}
+
+FileDescriptorCache& FileDescriptorCache::Instance()
+{
+	static FileDescriptorCache f_instance([](){
+		size_t max_size = f_max_cache_size;
+		struct rlimit rl;
+		if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+		{
+			max_size = std::min<size_t>(std::max<size_t>(rl.rlim_cur / f_rlimit_divisor, f_min_cache_size), f_max_cache_size);
+		}
+		LOG(INFO) << "Directory file descriptor cache size: " << max_size;
+		return max_size;
+	}());
+
+	return f_instance;
+}
+
+FileDescriptorCache::key_type FileDescriptorCache::NewKey() noexcept
+{
+	return m_next_key.fetch_add(1, std::memory_order_relaxed);
+}
+
+FileDescriptorCache::Lease FileDescriptorCache::Lookup(key_type key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_map.find(key);
+	if(it == m_map.end())
+	{
+		++m_stats.m_num_misses;
+		return Lease();
+	}
+
+	++m_stats.m_num_hits;
+
+	// Move it to the front of the LRU list and pin it.
+	m_lru_list.splice(m_lru_list.begin(), m_lru_list, it->second);
+	++it->second->m_num_pins;
+
+	return Lease(this, it->second);
 }
 
+void FileDescriptorCache::Insert(key_type key, int fd)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if(m_map.count(key) != 0)
+	{
+		// Someone beat us to it.
+		close(fd);
+		return;
+	}
+
+	// Make room.
+	EvictDownTo(m_max_size - 1);
+
+	m_lru_list.push_front(Entry{key, fd, 0});
+	m_map.emplace(key, m_lru_list.begin());
+
+	++m_stats.m_num_inserts;
+	m_stats.m_max_size = std::max(m_stats.m_max_size, m_map.size());
+}
+
+bool FileDescriptorCache::ReleaseIdle()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto old_size = m_map.size();
+
+	EvictDownTo(0);
+
+	++m_stats.m_num_emfile_releases;
+
+	return m_map.size() < old_size;
+}
+
+FileDescriptorCacheStats FileDescriptorCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+size_t FileDescriptorCache::size() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_map.size();
+}
+
+void FileDescriptorCache::Unpin(lru_list_type::iterator entry) noexcept
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	--entry->m_num_pins;
+
+	if(m_map.size() > m_max_size)
+	{
+		// Everything was pinned the last time we needed to evict something.  Catch up now.
+		EvictDownTo(m_max_size);
+	}
+}
+
+void FileDescriptorCache::EvictDownTo(size_t target_size) noexcept
+{
+	// Walk from the least recently used end, skipping any entries which are pinned.  If they're all pinned,
+	// we'll just have to go over the limit for a while.
+	auto it = m_lru_list.end();
+	while(m_map.size() > target_size && it != m_lru_list.begin())
+	{
+		--it;
+		if(it->m_num_pins == 0)
+		{
+			close(it->m_fd);
+			m_map.erase(it->m_key);
+			it = m_lru_list.erase(it);
+			++m_stats.m_num_evictions;
+		}
+	}
+}
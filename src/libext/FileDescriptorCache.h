@@ -22,21 +22,179 @@
 
 #include <config.h>
 
+#include <cstdint>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <ostream>
+
 #include "FileDescriptor.hpp"
 #include "filesystem.hpp"
 
-/*
+/**
+ * Hit/miss statistics for a FileDescriptorCache.
+ */
+struct FileDescriptorCacheStats
+{
+	/**
+	 * Using X-macros to make fields easier to add/rearrange/remove.
+	 */
+#define M_STATLIST \
+	X("Number of lookups which found a cached descriptor", m_num_hits) \
+	X("Number of lookups which did not", m_num_misses) \
+	X("Number of descriptors inserted", m_num_inserts) \
+	X("Number of descriptors evicted", m_num_evictions) \
+	X("Number of times we ran out of descriptors and released idle ones", m_num_emfile_releases) \
+	X("Maximum number of descriptors cached at once", m_max_size)
+
+#define X(d,s) size_t s {0};
+	M_STATLIST
+#undef X
+
+	/**
+	 * Friend function stream insertion operator.
+	 */
+	friend std::ostream& operator<<(std::ostream& os, const FileDescriptorCacheStats &fdcs)
+	{
+		return os
+#define X(d,s) << "\n" d ": " << fdcs. s
+		M_STATLIST
+#undef X
+		;
+	};
+
+#undef M_STATLIST
+};
+
+
+/**
+ * A bounded cache of open directory file descriptors, evicted in least-recently-used order.
  *
+ * Directories are identified by a key obtained from NewKey(), which their owner (normally a FileID) keeps for its
+ * lifetime.  Unlike a pointer or a dev/ino pair, a key is never reused, so a stale entry can never be mistaken for a
+ * different directory.
+ *
+ * A descriptor handed out by Lookup() is pinned, and won't be evicted and closed until the returned Lease goes away.
+ * This lets one thread openat() relative to a cached directory while other threads are inserting new ones.
  */
 class FileDescriptorCache
 {
 public:
-	FileDescriptorCache();
+	using key_type = std::uint64_t;
+
+	/// Key value which is never in the cache.
+	static constexpr key_type invalid_key = 0;
+
+private:
+	struct Entry
+	{
+		key_type m_key;
+		int m_fd;
+		int m_num_pins;
+	};
+
+	/// Most recently used entries are at the front.
+	using lru_list_type = std::list<Entry>;
+
+public:
+
+	/**
+	 * Handle to a pinned cached file descriptor.  Move-only.
+	 */
+	class Lease
+	{
+	public:
+		Lease() noexcept = default;
+		Lease(Lease &&other) noexcept;
+		Lease& operator=(Lease &&other) noexcept;
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		~Lease() noexcept { reset(); };
+
+		/// The cached descriptor, or -1 if the lookup missed.
+		int fd() const noexcept { return m_fd; };
+
+		explicit operator bool() const noexcept { return m_fd >= 0; };
+
+		/// Unpin the descriptor.  The Lease is empty afterwards.
+		void reset() noexcept;
+
+	private:
+		friend class FileDescriptorCache;
+
+		Lease(FileDescriptorCache *cache, lru_list_type::iterator entry) noexcept
+			: m_cache(cache), m_entry(entry), m_fd(entry->m_fd) {};
+
+		FileDescriptorCache *m_cache { nullptr };
+		lru_list_type::iterator m_entry;
+		int m_fd { -1 };
+	};
+
+	/**
+	 * Constructor.
+	 *
+	 * @param max_size  Number of descriptors the cache may hold before it starts closing the least recently used ones.
+	 */
+	explicit FileDescriptorCache(size_t max_size);
 	~FileDescriptorCache();
 
+	FileDescriptorCache(const FileDescriptorCache&) = delete;
+	FileDescriptorCache& operator=(const FileDescriptorCache&) = delete;
+
+	/**
+	 * The process-wide directory descriptor cache.  Its size is derived from RLIMIT_NOFILE the first time this is called.
+	 */
+	static FileDescriptorCache& Instance();
+
+	/// Returns a new, never-before-used key.
+	static key_type NewKey() noexcept;
+
+	/**
+	 * Look up the descriptor for @a key, making it the most recently used one.
+	 *
+	 * @returns A Lease pinning the descriptor, or an empty Lease if it isn't cached.
+	 */
+	Lease Lookup(key_type key);
+
+	/**
+	 * Add @a fd to the cache under @a key.  The cache takes ownership of @a fd, and will close() it when it's evicted.
+	 * If @a key is already cached, @a fd is closed instead.
+	 */
+	void Insert(key_type key, int fd);
+
+	/**
+	 * Close all descriptors which aren't currently pinned.  Call this after an open() fails with EMFILE, then retry.
+	 *
+	 * @returns true if any descriptors were closed, i.e. if retrying might help.
+	 */
+	bool ReleaseIdle();
+
+	FileDescriptorCacheStats GetStats() const;
+
+	size_t size() const;
+
+	size_t max_size() const noexcept { return m_max_size; };
+
 private:
 
+	/// Unpin the entry a Lease referred to.
+	void Unpin(lru_list_type::iterator entry) noexcept;
+
+	/// Close least recently used unpinned entries until we're down to @a target_size.  m_mutex must be held.
+	void EvictDownTo(size_t target_size) noexcept;
+
+	const size_t m_max_size;
+
+	mutable std::mutex m_mutex;
+
+	lru_list_type m_lru_list;
+
+	std::unordered_map<key_type, lru_list_type::iterator> m_map;
+
+	FileDescriptorCacheStats m_stats;
 
+	static std::atomic<key_type> m_next_key;
 };
 
 #endif /* SRC_LIBEXT_FILEDESCRIPTORCACHE_H_ */
@@ -20,7 +20,6 @@
 #include <config.h>
 
 
-#include <future/memory.hpp> // For std::make_unique<>
 #include <libext/string.hpp>
 
 #include "FileID.h"
@@ -29,7 +28,10 @@
 #include <unistd.h> // For close().
 #include <sys/stat.h>
 
+#include <new> // For placement new.
+
 #include "DoubleCheckedLock.hpp"
+#include "FileDescriptorCache.h"
 
 #define M_ENABLE_FD_STATS 0
 
@@ -68,15 +70,18 @@ public:
 		}
 	}
 
-	const std::string& GetBasename() const noexcept;
+	std::string GetBasename() const { return m_path.substr(m_basename_offset); };
+
+	/// The basename as a C string, without copying it.
+	const char* GetBasenameCStr() const noexcept { return m_path.c_str() + m_basename_offset; };
 
-	/// Resolve and cache this FileID's path.  Recursively visits its parent directories to do so.
-	FileID::IsValid ResolvePath() const noexcept;
+	/// An absolute basename is always the whole path.
+	bool IsBasenameAbsolute() const noexcept { return m_basename_offset == 0 && is_pathname_absolute(m_path); };
 
 	FileID::IsValid GetFileDescriptor();
 
 //protected:
-	std::ostream& dump_stats(std::ostream &ostrm, const FileID::impl &impl)
+	std::ostream& dump_stats(std::ostream &ostrm, const FileID::impl &impl) const
 	{
 		return ostrm << "Max descriptors, regular: " << impl.m_atomic_fd_max_reg << "\n"
 				<< "Max descriptors, dir: " << impl.m_atomic_fd_max_dir << "\n"
@@ -85,6 +90,18 @@ public:
 
 	int GetTempDirFileDesc() const noexcept;
 
+	/**
+	 * open() this file with the given @a flags.  If the directory it's in has a descriptor in the
+	 * FileDescriptorCache, openat() relative to that instead of making the kernel walk the whole path again.
+	 * If we're out of file descriptors, release the cache's idle ones and try again.
+	 *
+	 * @returns The new file descriptor, or -1 with errno set.
+	 */
+	int OpenViaAtDir(int flags) const noexcept;
+
+	/// Pin m_at_dir's descriptor in the FileDescriptorCache, if it has one and our basename is relative to it.
+	FileDescriptorCache::Lease LeaseAtDirDescriptor() const;
+
 //private:
 
 	FileID::IsValid LazyLoadStatInfo() const noexcept;
@@ -93,22 +110,34 @@ public:
 
 	void SetDevIno(dev_t d, ino_t i) noexcept;
 
+	/// Build m_path from @a bname and the path of m_at_dir, and set m_basename_offset to match.
+	void BuildPath(const std::string &bname);
+
 // Data members.
+// Ordered largest-alignment first, so there's no padding between them.
 
 	/// Shared pointer to the directory this FileID is in.
 	/// The constructors ensure that this member always exists and is valid.
 	std::shared_ptr<FileID> m_at_dir;
 
-	/// The basename of this file.
-	/// We define this somewhat differently here: This is either:
-	/// - The full absolute path, or
-	/// - The path relative to m_at_dir, which may consist of more than one path element.
-	/// In any case, it is always equal to the string passed into the constructor, and this will always exist and is valid.
-	std::string m_basename;
+	/// The full m_at_dir-relative path to this file.  Built by the constructors, and immutable after that.  The
+	/// basename is the tail of this string starting at m_basename_offset.
+	std::string m_path;
+
+	/// @name Info normally gathered from a stat() call.
+	///@{
+	mutable dev_ino_pair m_unique_file_identifier;
+
+	/// File size in bytes.
+	mutable off_t m_size { 0 };
 
-	/// The full m_at_dir-relative path to this file.
-	/// This will be lazily evaluated when needed, unless an absolute path is passed in to the constructor.
-	mutable std::string m_path;
+	/// The preferred I/O block size for this file.
+	/// @note GNU libc documents the units on this as bytes.
+	mutable blksize_t m_block_size { 0 };
+	///@}
+
+	/// If this is a directory we've opened, the key of its descriptor in the FileDescriptorCache.
+	mutable FileDescriptorCache::key_type m_dir_cache_key { FileDescriptorCache::invalid_key };
 
 	/// Flags to use when we open the file descriptor.
 	mutable int m_open_flags { 0 };
@@ -120,25 +149,14 @@ public:
 	/// the subsequent call to CloseDir().  Used for caching the AT-dir descriptor for FStatAt().
 	mutable int m_temp_dir_file_descriptor = -987;
 
-	/// @name Info normally gathered from a stat() call.
-	///@{
-	mutable FileType m_file_type { FT_UNINITIALIZED };
-
-	mutable dev_ino_pair m_unique_file_identifier;
-
-	mutable dev_t m_dev { static_cast<dev_t>(-1) };
-
-	/// File size in bytes.
-	mutable off_t m_size { 0 };
-
-	/// The preferred I/O block size for this file.
-	/// @note GNU libc documents the units on this as bytes.
-	mutable blksize_t m_block_size { 0 };
+	/// Offset of the basename within m_path.
+	/// We define the basename somewhat differently here: This is either:
+	/// - The full absolute path, or
+	/// - The path relative to m_at_dir, which may consist of more than one path element.
+	/// In any case, it is always equal to the string passed into the constructor.
+	uint32_t m_basename_offset { 0 };
 
-	/// Number of blocks allocated for this file.
-	/// @note POSIX doesn't define the units for this.  Linux is documented to use 512-byte units, as is GNU libc.
-	mutable blkcnt_t m_blocks { 0 };
-	///@}
+	mutable FileType m_file_type { FT_UNINITIALIZED };
 
 	// Stats
 	static std::atomic<std::uint64_t> m_atomic_fd_max_reg;
@@ -155,41 +173,66 @@ static_assert(std::is_move_assignable<FileID::impl>::value, "FileID::impl must b
 
 
 FileID::impl::impl(std::shared_ptr<FileID> at_dir_fileid, std::string bname)
-	: m_at_dir(std::move(at_dir_fileid)), m_basename(bname)
+	: m_at_dir(std::move(at_dir_fileid))
 {
-	/// @note Taking basename by value since we are always storing it.
 	/// Full openat() semantics:
 	/// - If pathname is absolute, at_dir_fd is ignored.
 	/// - If pathname is relative, it's relative to at_dir_fd.
 
-	LOG(DEBUG) << "2-param const., m_basename=" << m_basename << ", m_at_dir=" << (!!m_at_dir ? (m_at_dir->m_pimpl->m_path) : "<nullptr>");
+	BuildPath(bname);
 
-	if(is_pathname_absolute(bname))
-	{
-		// Save an expensive recursive call to m_at_dir->GetPath() in the future.
-		m_path = bname;
-	}
+	LOG(DEBUG) << "2-param const., m_path=" << m_path;
 }
 
 FileID::impl::impl(std::shared_ptr<FileID> at_dir_fileid, std::string bname, std::string pname,
 		const struct stat *stat_buf, FileType type)
-		: m_at_dir(std::move(at_dir_fileid)), m_basename(std::move(bname)), m_path(std::move(pname)), m_file_type(type)
+		: m_at_dir(std::move(at_dir_fileid)), m_file_type(type)
 {
 	if(stat_buf != nullptr)
 	{
 		SetStatInfo(*stat_buf);
 	}
 
-	if(is_pathname_absolute(m_basename))
+	if(!pname.empty() && pname.size() >= bname.size()
+			&& pname.compare(pname.size() - bname.size(), std::string::npos, bname) == 0)
 	{
-		m_path = m_basename;
+		// We were given the full path, and the basename is its tail.
+		m_path = std::move(pname);
+		m_basename_offset = m_path.size() - bname.size();
+	}
+	else
+	{
+		BuildPath(bname);
 	}
 }
 
-const std::string& FileID::impl::GetBasename() const noexcept
+void FileID::impl::BuildPath(const std::string &bname)
 {
-	return m_basename;
-};
+	if(!m_at_dir || is_pathname_absolute(bname))
+	{
+		m_path = bname;
+		m_basename_offset = 0;
+		return;
+	}
+
+	// The at-dir's path was built when it was constructed, so this doesn't need any locks, or recursion.
+	const std::string& at_path = m_at_dir->GetPath();
+	if(!(at_path.length() == 1 && at_path[0] == '.'))
+	{
+		// This isn't the AT_FDCWD.
+		m_path.reserve(at_path.length() + bname.size() + 1);
+		m_path.append(at_path);
+		m_path.append("/", 1);
+		m_basename_offset = m_path.size();
+		m_path.append(bname);
+	}
+	else
+	{
+		// This is the AT_FDCWD.
+		m_path = bname;
+		m_basename_offset = 0;
+	}
+}
 
 // Stats
 std::atomic<std::uint64_t> FileID::impl::m_atomic_fd_max_reg;
@@ -231,10 +274,7 @@ FileID::IsValid FileID::impl::GetFileDescriptor()
 
 		if(m_at_dir)
 		{
-			int tempfd = -1;
-
-			ResolvePath();
-			tempfd = open(m_path.c_str(), m_open_flags);
+			int tempfd = OpenViaAtDir(m_open_flags);
 			if(unlikely(tempfd == -1))
 			{
 				throw FileException("GetFileDescriptor(): open(" + m_path + ") failed");
@@ -244,12 +284,11 @@ FileID::IsValid FileID::impl::GetFileDescriptor()
 		}
 	}
 
-	return FileID::FILE_DESC | FileID::PATH;
+	return FileID::FILE_DESC;
 }
 
 void FileID::impl::SetDevIno(dev_t d, ino_t i) noexcept
 {
-	m_dev = d;
 	m_unique_file_identifier = dev_ino_pair(d, i);
 }
 
@@ -269,14 +308,68 @@ int FileID::impl::GetTempDirFileDesc() const noexcept
 		else
 		{
 			// Create a new temp file descriptor.
-			ResolvePath();
-			m_temp_dir_file_descriptor = open(m_path.c_str(), O_RDONLY | O_NOATIME | O_NOCTTY | O_DIRECTORY);
+			m_temp_dir_file_descriptor = OpenViaAtDir(O_RDONLY | O_NOATIME | O_NOCTTY | O_DIRECTORY);
+
+			if(m_temp_dir_file_descriptor >= 0)
+			{
+				// We're about to read this directory, and the files and subdirectories in it will be opened soon.
+				// Keep a copy of the descriptor around so they can be opened relative to it.
+				int cache_fd = dup(m_temp_dir_file_descriptor);
+				if(cache_fd >= 0)
+				{
+					if(m_dir_cache_key == FileDescriptorCache::invalid_key)
+					{
+						m_dir_cache_key = FileDescriptorCache::NewKey();
+					}
+					FileDescriptorCache::Instance().Insert(m_dir_cache_key, cache_fd);
+				}
+			}
 		}
 	}
 
 	return m_temp_dir_file_descriptor;
 }
 
+int FileID::impl::OpenViaAtDir(int flags) const noexcept
+{
+	auto &cache = FileDescriptorCache::Instance();
+	int fd = -1;
+
+	while(true)
+	{
+		FileDescriptorCache::Lease at_dir_fd = LeaseAtDirDescriptor();
+
+		if(at_dir_fd)
+		{
+			fd = openat(at_dir_fd.fd(), GetBasenameCStr(), flags);
+		}
+		else
+		{
+			// Have to do it the slow way.
+			fd = open(m_path.c_str(), flags);
+		}
+
+		if(fd != -1 || errno != EMFILE || !cache.ReleaseIdle())
+		{
+			break;
+		}
+
+		LOG(INFO) << "Out of file descriptors, released idle cached directory descriptors and retrying.";
+	}
+
+	return fd;
+}
+
+FileDescriptorCache::Lease FileID::impl::LeaseAtDirDescriptor() const
+{
+	if(m_at_dir && m_at_dir->pimpl()->m_dir_cache_key != FileDescriptorCache::invalid_key && !IsBasenameAbsolute())
+	{
+		return FileDescriptorCache::Instance().Lookup(m_at_dir->pimpl()->m_dir_cache_key);
+	}
+
+	return FileDescriptorCache::Lease();
+}
+
 FileID::IsValid FileID::impl::LazyLoadStatInfo() const noexcept
 {
 	// We don't have stat info and now we need it.
@@ -294,13 +387,14 @@ FileID::IsValid FileID::impl::LazyLoadStatInfo() const noexcept
 
 	if(m_file_descriptor >= 0)
 	{
-		// We have a file descriptor, stat it directly.
-		int status = fstat(m_file_descriptor, &stat_buf);
+		// We have a file descriptor, stat it directly.  Opening it already revalidated its attributes on NFS
+		// (close-to-open consistency), so there's no need to go back to the server for them again.
+		int status = fstatat_minimal(m_file_descriptor, "", &stat_buf, AT_EMPTY_PATH | AT_STATX_DONT_SYNC, FileID::STATINFO_MASK);
 		fstat_success = (status == 0);
 	}
 	else
 	{
-		fstat_success = m_at_dir->FStatAt(m_basename, &stat_buf, AT_NO_AUTOMOUNT);
+		fstat_success = m_at_dir->FStatAt(GetBasename(), &stat_buf, AT_NO_AUTOMOUNT);
 	}
 
 	if(fstat_success)
@@ -336,36 +430,9 @@ void FileID::impl::SetStatInfo(const struct stat &stat_buf) const noexcept
 		m_file_type = FT_UNKNOWN;
 	}
 
-	m_dev = stat_buf.st_dev;
 	m_unique_file_identifier = dev_ino_pair(stat_buf.st_dev, stat_buf.st_ino);
 	m_size = stat_buf.st_size;
 	m_block_size = stat_buf.st_blksize;
-	m_blocks = stat_buf.st_blocks;
-}
-
-FileID::IsValid FileID::impl::ResolvePath() const noexcept
-{
-	// Do we not have a full path already?
-	if(m_path.empty())
-	{
-		// No.  Build the full path.
-		const std::string& at_path = m_at_dir->GetPath();
-		if(!(at_path.length() == 1 && at_path[0] == '.'))
-		{
-			// This isn't the AT_FDCWD.
-			m_path.reserve(at_path.length() + m_basename.size()+2);
-			m_path.append(at_path);
-			m_path.append("/", 1);
-			m_path.append(m_basename);
-		}
-		else
-		{
-			// This is the AT_FDCWD.
-			m_path = m_basename;
-		}
-	}
-
-	return FileID::PATH;
 }
 
 /////////////////////////////////
@@ -375,33 +442,62 @@ FileID::IsValid FileID::impl::ResolvePath() const noexcept
 /////////////////////////////////
 
 
+namespace
+{
+
+/// Number of mutexes in the pool the FileIDs share.  A power of two.
+constexpr size_t f_num_fileid_mutexes = 64;
+
+/// One of the pool's mutexes, each on its own cache line.
+struct alignas(64) PaddedFileIDMutex
+{
+	std::shared_mutex m_mutex;
+};
+
+PaddedFileIDMutex f_fileid_mutexes[f_num_fileid_mutexes];
+
+} // namespace
+
+FileID::MutexType& FileID::GetMutex() const noexcept
+{
+	// Mix the address bits, since FileIDs are allocated at regular strides and the low bits are mostly zero.
+	uintptr_t addr = reinterpret_cast<uintptr_t>(this);
+	addr ^= addr >> 7;
+	addr ^= addr >> 13;
+	return f_fileid_mutexes[addr & (f_num_fileid_mutexes-1)].m_mutex;
+}
+
 // Copy constructor.
 FileID::FileID(const FileID& other)
-	: m_pimpl((ReaderLock(other.m_mutex), std::make_unique<FileID::impl>(*other.m_pimpl)))
 {
 	LOG(DEBUG) << "Copy constructor called";
-	if(!m_pimpl)
-	{
-		throw std::runtime_error("no pimpl on copy");
-	}
+	ReaderLock other_lock(other.GetMutex());
+	new (&m_impl_storage) impl(*other.pimpl());
+	m_valid_bits = other.m_valid_bits.load();
+	// The descriptors belong to other, don't close them twice.
+	pimpl()->m_file_descriptor = -987;
+	pimpl()->m_temp_dir_file_descriptor = -987;
+	m_valid_bits.fetch_and(~static_cast<uint_fast8_t>(FILE_DESC));
 	LOG(DEBUG) << "Copy constructor end";
 };
 
 // Move constructor.
 FileID::FileID(FileID&& other)
-	: m_pimpl(std::move((WriterLock(other.m_mutex), other.m_pimpl)))
 {
 	LOG(DEBUG) << "Move constructor called";
-	if(!m_pimpl)
-	{
-		throw std::runtime_error("no pimpl on move");
-	}
+	WriterLock other_lock(other.GetMutex());
+	new (&m_impl_storage) impl(std::move(*other.pimpl()));
+	m_valid_bits = other.m_valid_bits.load();
+	// We own the descriptors now.
+	other.pimpl()->m_file_descriptor = -987;
+	other.pimpl()->m_temp_dir_file_descriptor = -987;
 	LOG(DEBUG) << "Move constructor end";
 };
 
 FileID::FileID(path_known_cwd_tag)
-	: m_pimpl(std::make_unique<FileID::impl>(nullptr, ".", ".", nullptr, FT_DIR))
 {
+	new (&m_impl_storage) impl(nullptr, ".", ".", nullptr, FT_DIR);
+
 	// Open the file descriptor immediately, since we don't want to use openat() here unlike in all other cases.
 	SetFileDescriptorMode(FAM_SEARCH, FCF_DIRECTORY | FCF_NOCTTY);
 	int tempfd = open(".", O_SEARCH | O_DIRECTORY | O_NOCTTY);
@@ -409,9 +505,9 @@ FileID::FileID(path_known_cwd_tag)
 	{
 		LOG(DEBUG) << "Error in fdcwd constructor: " << LOG_STRERROR();
 	}
-	m_pimpl->m_file_descriptor = tempfd;
+	pimpl()->m_file_descriptor = tempfd;
 
-	LOG(DEBUG) << "FDCWD constructor, file descriptor: " << m_pimpl->m_file_descriptor;
+	LOG(DEBUG) << "FDCWD constructor, file descriptor: " << pimpl()->m_file_descriptor;
 
 	m_valid_bits.fetch_or(FILE_DESC | TYPE | PATH);
 
@@ -422,9 +518,10 @@ FileID::FileID(path_known_relative_tag, const std::shared_ptr<FileID>& at_dir_fi
 		FileType type,
 		dev_t d, ino_t i,
 		FileAccessMode fam, FileCreationFlag fcf)
-	: m_pimpl(std::make_unique<FileID::impl>(at_dir_fileid, bname, "", stat_buf, type))
 {
-	uint_fast8_t orbits = NONE;
+	new (&m_impl_storage) impl(at_dir_fileid, bname, "", stat_buf, type);
+
+	uint_fast8_t orbits = PATH;
 
 	// basename is a file relative to at_dir_fileid.
 	if(stat_buf != nullptr)
@@ -439,32 +536,27 @@ FileID::FileID(path_known_relative_tag, const std::shared_ptr<FileID>& at_dir_fi
 
 	if(d != static_cast<dev_t>(-1) && i != 0)
 	{
-		m_pimpl->SetDevIno(d, i);
+		pimpl()->SetDevIno(d, i);
 		orbits |= UUID;
 	}
 
 	if(fam != FAM_UNINITIALIZED && fcf != FCF_UNINITIALIZED)
 	{
-		m_pimpl->m_open_flags = fam | fcf;
+		pimpl()->m_open_flags = fam | fcf;
 	}
 
 	m_valid_bits.fetch_or(orbits);
 }
 
 FileID::FileID(path_known_absolute_tag, std::shared_ptr<FileID> at_dir_fileid, std::string pathname, FileType type)
-	: m_pimpl(std::make_unique<FileID::impl>(at_dir_fileid, pathname /*==basename*/, pathname, nullptr, type))
 {
-	/// @note Taking pathname by value since we are always storing it.
 	/// Full openat() semantics:
 	/// - If pathname is absolute, at_dir_fd is ignored.
 	/// - If pathname is relative, it's relative to at_dir_fd.
+	new (&m_impl_storage) impl(std::move(at_dir_fileid), pathname /*==basename*/, pathname, nullptr, type);
 
-	uint_fast8_t orbits = NONE;
+	uint_fast8_t orbits = PATH;
 
-	if(is_pathname_absolute(pathname))
-	{
-		orbits |= PATH;
-	}
 	if(type != FT_UNINITIALIZED)
 	{
 		orbits |= TYPE;
@@ -473,31 +565,37 @@ FileID::FileID(path_known_absolute_tag, std::shared_ptr<FileID> at_dir_fileid, s
 }
 
 FileID::FileID(std::shared_ptr<FileID> at_dir_fileid, std::string pathname, FileAccessMode fam, FileCreationFlag fcf)
-	: m_pimpl(std::make_unique<FileID::impl>(std::move(at_dir_fileid), pathname))
 {
-	SetFileDescriptorMode(fam, fcf);
-
-	uint_fast8_t orbits = NONE;
+	new (&m_impl_storage) impl(std::move(at_dir_fileid), std::move(pathname));
 
-	// Did we get a full path?
-	if(!m_pimpl->m_path.empty())
-	{
-		orbits |= PATH;
-	}
+	SetFileDescriptorMode(fam, fcf);
 
-	m_valid_bits.fetch_or(orbits);
+	m_valid_bits.fetch_or(PATH);
 }
 
 FileID& FileID::operator=(const FileID& other)
 {
 	if(this != &other)
 	{
-		WriterLock this_lock(m_mutex, std::defer_lock);
-		ReaderLock other_lock(other.m_mutex, std::defer_lock);
-		std::lock(this_lock, other_lock);
-		m_pimpl = std::make_unique<FileID::impl>(*other.m_pimpl);
+		WriterLock this_lock(GetMutex(), std::defer_lock);
+		ReaderLock other_lock(other.GetMutex(), std::defer_lock);
+		if(&GetMutex() == &other.GetMutex())
+		{
+			// Both in the same slot of the pool, one exclusive lock covers both.
+			this_lock.lock();
+		}
+		else
+		{
+			std::lock(this_lock, other_lock);
+		}
 
-		m_valid_bits = other.m_valid_bits.load();
+		// Destroying the old impl closes its file descriptor.
+		pimpl()->~impl();
+		new (&m_impl_storage) impl(*other.pimpl());
+		pimpl()->m_file_descriptor = -987;
+		pimpl()->m_temp_dir_file_descriptor = -987;
+
+		m_valid_bits = other.m_valid_bits.load() & ~static_cast<uint_fast8_t>(FILE_DESC);
 	}
 	return *this;
 };
@@ -506,11 +604,22 @@ FileID& FileID::operator=(FileID&& other)
 {
 	if(this != &other)
 	{
-		WriterLock this_lock(m_mutex, std::defer_lock);
-		WriterLock other_lock(other.m_mutex, std::defer_lock);
-		std::lock(this_lock, other_lock);
+		WriterLock this_lock(GetMutex(), std::defer_lock);
+		WriterLock other_lock(other.GetMutex(), std::defer_lock);
+		if(&GetMutex() == &other.GetMutex())
+		{
+			this_lock.lock();
+		}
+		else
+		{
+			std::lock(this_lock, other_lock);
+		}
+
+		pimpl()->~impl();
+		new (&m_impl_storage) impl(std::move(*other.pimpl()));
+		other.pimpl()->m_file_descriptor = -987;
+		other.pimpl()->m_temp_dir_file_descriptor = -987;
 
-		m_pimpl = std::move(other.m_pimpl);
 		m_valid_bits = other.m_valid_bits.load();
 	}
 	return *this;
@@ -521,42 +630,56 @@ FileID::~FileID()
 	// Don't lock during destruction.
 	// If anyone was trying to read or write us, they'd have to have (possibly shared) ownership (right?),
 	// and hence we wouldn't be getting destroyed.
+	static_assert(sizeof(impl) <= impl_storage_size, "FileID::impl_storage_size is too small for FileID::impl.");
+	static_assert(alignof(impl) <= alignof(decltype(m_impl_storage)), "FileID::m_impl_storage is not aligned enough for FileID::impl.");
+	pimpl()->~impl();
 }
 
 std::string FileID::GetBasename() const noexcept
 {
 	// This is const after construction, and always exists, so it doesn't need a lock here.
-	return m_pimpl->GetBasename();
+	return pimpl()->GetBasename();
 };
 
+const char* FileID::GetBasenameCStr() const noexcept
+{
+	// Same as GetBasename().
+	return pimpl()->GetBasenameCStr();
+}
+
+FileDescriptorCache::Lease FileID::LeaseAtDirDescriptor() const
+{
+	return pimpl()->LeaseAtDirDescriptor();
+}
+
 const std::string& FileID::GetPath() const noexcept
 {
-	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, PATH, m_mutex, [this](){ return m_pimpl->ResolvePath(); });
-	return m_pimpl->m_path;
+	// Built by the constructor and never changed after that, so no lock needed.
+	return pimpl()->m_path;
 }
 
 FileType FileID::GetFileType() const noexcept
 {
-	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, TYPE, m_mutex, [this](){ return m_pimpl->LazyLoadStatInfo(); });
-	return m_pimpl->m_file_type;
+	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, TYPE, GetMutex(), [this](){ return pimpl()->LazyLoadStatInfo(); });
+	return pimpl()->m_file_type;
 }
 
 off_t FileID::GetFileSize() const noexcept
 {
-	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, STATINFO, m_mutex, [this](){ return m_pimpl->LazyLoadStatInfo(); });
-	return m_pimpl->m_size;
+	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, STATINFO, GetMutex(), [this](){ return pimpl()->LazyLoadStatInfo(); });
+	return pimpl()->m_size;
 };
 
 blksize_t FileID::GetBlockSize() const noexcept
 {
-	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, STATINFO, m_mutex, [this](){ return m_pimpl->LazyLoadStatInfo(); });
-	return m_pimpl->m_block_size;
+	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, STATINFO, GetMutex(), [this](){ return pimpl()->LazyLoadStatInfo(); });
+	return pimpl()->m_block_size;
 };
 
 const dev_ino_pair FileID::GetUniqueFileIdentifier() const noexcept
 {
-	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, UUID, m_mutex, [this](){ return m_pimpl->LazyLoadStatInfo();});
-	return m_pimpl->m_unique_file_identifier;
+	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, UUID, GetMutex(), [this](){ return pimpl()->LazyLoadStatInfo();});
+	return pimpl()->m_unique_file_identifier;
 }
 
 void FileID::SetFileDescriptorMode(FileAccessMode fam, FileCreationFlag fcf)
@@ -566,8 +689,8 @@ void FileID::SetFileDescriptorMode(FileAccessMode fam, FileCreationFlag fcf)
 	LOG(DEBUG) << "Setting file descriptor mode flags: " << to_string(temp_flags, std::hex);
 
 	{
-		WriterLock wl(m_mutex);
-		m_pimpl->m_open_flags = temp_flags;
+		WriterLock wl(GetMutex());
+		pimpl()->m_open_flags = temp_flags;
 	}
 }
 
@@ -583,17 +706,17 @@ FileID FileID::OpenAt(const std::string &name, FileType type, int flags)
 
 DIR *FileID::OpenDir()
 {
-	int fd = m_pimpl->GetTempDirFileDesc();
+	int fd = pimpl()->GetTempDirFileDesc();
 
 	return fdopendir(fd);
 }
 
-bool FileID::FStatAt(const std::string &name, struct stat *statbuf, int flags)
+bool FileID::FStatAt(const std::string &name, struct stat *statbuf, int flags, unsigned int mask)
 {
-	int atdir_fd = m_pimpl->m_temp_dir_file_descriptor;
+	int atdir_fd = pimpl()->m_temp_dir_file_descriptor;
 
 	// Stat the file.
-	int retval = fstatat(atdir_fd, name.c_str(), statbuf, flags);
+	int retval = fstatat_minimal(atdir_fd, name.c_str(), statbuf, flags, mask);
 
 	if(retval == -1)
 	{
@@ -607,31 +730,31 @@ bool FileID::FStatAt(const std::string &name, struct stat *statbuf, int flags)
 }
 void FileID::CloseDir(DIR *d)
 {
-	m_pimpl->m_temp_dir_file_descriptor = -987;
+	pimpl()->m_temp_dir_file_descriptor = -987;
 	closedir(d);
 }
 
 int FileID::GetFileDescriptor()
 {
-	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, FILE_DESC, m_mutex, [this](){ return m_pimpl->GetFileDescriptor();});
-	return m_pimpl->m_file_descriptor;
+	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, FILE_DESC, GetMutex(), [this](){ return pimpl()->GetFileDescriptor();});
+	return pimpl()->m_file_descriptor;
 }
 
 dev_t FileID::GetDev() const noexcept
 {
-	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, UUID, m_mutex, [this](){ return m_pimpl->LazyLoadStatInfo(); });
-	return m_pimpl->m_dev;
+	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, UUID, GetMutex(), [this](){ return pimpl()->LazyLoadStatInfo(); });
+	return pimpl()->m_unique_file_identifier.dev();
 }
 
 void FileID::SetDevIno(dev_t d, ino_t i) noexcept
 {
-	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, UUID, m_mutex,
-			[&](){ m_pimpl->SetDevIno(d, i); return UUID; });
+	DoubleCheckedMultiLock<uint_fast8_t>(m_valid_bits, UUID, GetMutex(),
+			[&](){ pimpl()->SetDevIno(d, i); return UUID; });
 }
 
 std::ostream& operator<<(std::ostream &ostrm, const FileID &fileid)
 {
-	fileid.m_pimpl->dump_stats(ostrm, *fileid.m_pimpl);
+	fileid.pimpl()->dump_stats(ostrm, *fileid.pimpl());
 	return ostrm;
 }
 
@@ -34,10 +34,13 @@
 #include <string>
 #include <atomic>
 #include <climits>
+#include <cstddef>
+#include <type_traits>
 
 #include "integer.hpp"
 #include "filesystem.hpp"
 #include "FileDescriptor.hpp"
+#include "FileDescriptorCache.h"
 
 
 /// File Types enum.
@@ -118,8 +121,12 @@ private:
 	using ReaderLock = std::shared_lock<MutexType>;
 	using WriterLock = std::unique_lock<MutexType>;
 
-	/// Mutex for locking in copy and move constructors, other operations.
-	mutable MutexType m_mutex;
+	/**
+	 * Returns the mutex for locking in copy and move constructors, other operations.  FileIDs share a fixed pool of
+	 * mutexes, picked by address, instead of each carrying its own.  They're only locked the first time a lazily
+	 * evaluated field is needed, and never while another FileID's is held, so sharing them costs next to nothing.
+	 */
+	MutexType& GetMutex() const noexcept;
 
 public: // To allow access from impl.
 
@@ -188,6 +195,18 @@ public:
 
 	std::string GetBasename() const noexcept;
 
+	/// The basename as a C string, without copying it.  Valid as long as this FileID exists.
+	const char* GetBasenameCStr() const noexcept;
+
+	/**
+	 * Pin the descriptor of the directory this file is in, if the FileDescriptorCache has it.  While the returned
+	 * Lease is held, the file can be opened with openat() relative to it and GetBasenameCStr(), instead of by its
+	 * full path.
+	 *
+	 * @returns The pinned descriptor, or an empty Lease if there isn't one cached or the basename is absolute.
+	 */
+	FileDescriptorCache::Lease LeaseAtDirDescriptor() const;
+
 	/**
 	 * Returns the "full path" of the file.  May be absolute or relative to the root AT dir.
 	 * @return Ref to a std::string containing the file's path.  Threadsafe as long as this FileID exists.
@@ -218,16 +237,21 @@ public:
 	 */
 	DIR *OpenDir();
 
+	/// The stat fields FileID actually uses.  Anything else is a wasted attribute fetch on network filesystems.
+	static constexpr unsigned int STATINFO_MASK = STATX_TYPE | STATX_INO | STATX_SIZE | STATX_BLOCKS;
+
 	/**
-	 * Stat the given filename at the directory represented by this.
+	 * Stat the given filename at the directory represented by this.  Only the fields in @a mask are guaranteed to be
+	 * filled in, @see fstatat_minimal().
 	 *
 	 * @note Only makes sense to call on FileIDs representing directories where OpenDir() has been called.
 	 *
 	 * @param name
 	 * @param statbuf
 	 * @param flags
+	 * @param mask
 	 */
-	bool FStatAt(const std::string &name, struct stat *statbuf, int flags);
+	bool FStatAt(const std::string &name, struct stat *statbuf, int flags, unsigned int mask = STATINFO_MASK);
 
 	void CloseDir(DIR* d);
 
@@ -260,8 +284,13 @@ public:
 
 private:
 
-	/// The pImpl.
-	std::unique_ptr<impl> m_pimpl;
+	impl* pimpl() noexcept { return reinterpret_cast<impl*>(&m_impl_storage); };
+	const impl* pimpl() const noexcept { return reinterpret_cast<const impl*>(&m_impl_storage); };
+
+	/// Space for the pImpl, which is constructed in place instead of being separately heap-allocated.  There's one
+	/// FileID for every file we search, so that's one less allocation per file.  FileID.cpp checks that it fits.
+	static constexpr size_t impl_storage_size = 112;
+	std::aligned_storage<impl_storage_size, alignof(void*)>::type m_impl_storage;
 };
 
 std::ostream& operator<<(std::ostream &ostrm, const FileID &fileid);
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "IOUring.h"
+
+#if HAVE_LINUX_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+IOUring::IOUring(unsigned entries) noexcept
+{
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+
+	int fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(fd < 0)
+	{
+		return;
+	}
+
+	m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+	}
+
+	m_sq_ring_ptr = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(m_sq_ring_ptr == MAP_FAILED)
+	{
+		m_sq_ring_ptr = nullptr;
+		close(fd);
+		return;
+	}
+
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_cq_ring_ptr = m_sq_ring_ptr;
+	}
+	else
+	{
+		m_cq_ring_ptr = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(m_cq_ring_ptr == MAP_FAILED)
+		{
+			m_cq_ring_ptr = nullptr;
+			munmap(m_sq_ring_ptr, m_sq_ring_size);
+			m_sq_ring_ptr = nullptr;
+			close(fd);
+			return;
+		}
+	}
+
+	m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED)
+	{
+		if(m_cq_ring_ptr != m_sq_ring_ptr)
+		{
+			munmap(m_cq_ring_ptr, m_cq_ring_size);
+		}
+		munmap(m_sq_ring_ptr, m_sq_ring_size);
+		m_sq_ring_ptr = m_cq_ring_ptr = nullptr;
+		close(fd);
+		return;
+	}
+	m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+	char *sq = static_cast<char*>(m_sq_ring_ptr);
+	m_sq_khead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	m_sq_ktail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	m_sq_entries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+	m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+	char *cq = static_cast<char*>(m_cq_ring_ptr);
+	m_cq_khead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	m_cq_ktail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	m_sqe_tail = m_sqe_submitted_tail = *m_sq_ktail;
+
+	m_ring_fd = fd;
+}
+
+IOUring::~IOUring() noexcept
+{
+	if(m_ring_fd < 0)
+	{
+		return;
+	}
+
+	munmap(m_sqes, m_sqes_size);
+	if(m_cq_ring_ptr != m_sq_ring_ptr)
+	{
+		munmap(m_cq_ring_ptr, m_cq_ring_size);
+	}
+	munmap(m_sq_ring_ptr, m_sq_ring_size);
+	close(m_ring_fd);
+}
+
+int IOUring::RegisterSparseFiles(unsigned nr) noexcept
+{
+	io_uring_rsrc_register reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.nr = nr;
+	reg.flags = IORING_RSRC_REGISTER_SPARSE;
+
+	int retval = syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_FILES2, &reg, sizeof(reg));
+	return (retval < 0) ? -errno : retval;
+}
+
+io_uring_sqe* IOUring::GetSQE() noexcept
+{
+	unsigned head = __atomic_load_n(m_sq_khead, __ATOMIC_ACQUIRE);
+
+	if(m_sqe_tail - head >= m_sq_entries)
+	{
+		// Full.
+		return nullptr;
+	}
+
+	io_uring_sqe *sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+	std::memset(sqe, 0, sizeof(*sqe));
+	++m_sqe_tail;
+	return sqe;
+}
+
+int IOUring::Enter(unsigned to_submit, unsigned min_complete, unsigned flags) noexcept
+{
+	int retval;
+	do
+	{
+		retval = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, nullptr, 0);
+	} while(retval < 0 && errno == EINTR);
+
+	return (retval < 0) ? -errno : retval;
+}
+
+int IOUring::Submit(unsigned wait_nr) noexcept
+{
+	// Fill in the index array for the SQEs we've handed out since the last submit.
+	unsigned to_submit = m_sqe_tail - m_sqe_submitted_tail;
+	for(unsigned tail = m_sqe_submitted_tail; tail != m_sqe_tail; ++tail)
+	{
+		m_sq_array[tail & m_sq_mask] = tail & m_sq_mask;
+	}
+
+	// Publish the new tail to the kernel.
+	__atomic_store_n(m_sq_ktail, m_sqe_tail, __ATOMIC_RELEASE);
+	m_sqe_submitted_tail = m_sqe_tail;
+
+	return Enter(to_submit, wait_nr, (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0);
+}
+
+int IOUring::Wait(unsigned wait_nr) noexcept
+{
+	int retval = Enter(0, wait_nr, IORING_ENTER_GETEVENTS);
+	return (retval < 0) ? retval : 0;
+}
+
+io_uring_cqe* IOUring::PeekCQE() noexcept
+{
+	unsigned head = *m_cq_khead;
+	unsigned tail = __atomic_load_n(m_cq_ktail, __ATOMIC_ACQUIRE);
+
+	if(head == tail)
+	{
+		return nullptr;
+	}
+
+	return &m_cqes[head & m_cq_mask];
+}
+
+void IOUring::SeenCQE() noexcept
+{
+	__atomic_store_n(m_cq_khead, *m_cq_khead + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* HAVE_LINUX_IO_URING */
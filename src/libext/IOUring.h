@@ -0,0 +1,117 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file  Minimal wrapper around the Linux io_uring interface, talking to the kernel directly (i.e. without liburing). */
+
+#ifndef SRC_LIBEXT_IOURING_H_
+#define SRC_LIBEXT_IOURING_H_
+
+#include <config.h>
+
+#if HAVE_LINUX_IO_URING
+
+#include <cstddef>
+#include <linux/io_uring.h>
+
+/**
+ * A single io_uring submission/completion queue pair.  Not thread-safe; intended to be owned by a single thread.
+ */
+class IOUring
+{
+public:
+	/**
+	 * Create an io_uring with room for @a entries submission queue entries.
+	 * If the kernel doesn't support io_uring (or it's disabled), IsValid() will return false.
+	 */
+	explicit IOUring(unsigned entries) noexcept;
+	~IOUring() noexcept;
+
+	IOUring(const IOUring&) = delete;
+	IOUring& operator=(const IOUring&) = delete;
+
+	bool IsValid() const noexcept { return m_ring_fd >= 0; };
+
+	/**
+	 * Register @a nr fixed file slots, all initially empty, for use with direct opens.
+	 * @returns 0 on success, -errno on failure.
+	 */
+	int RegisterSparseFiles(unsigned nr) noexcept;
+
+	/**
+	 * Get the next free submission queue entry, zeroed out.
+	 * @returns nullptr if the submission queue is full.
+	 */
+	io_uring_sqe* GetSQE() noexcept;
+
+	/**
+	 * Submit all SQEs obtained via GetSQE() since the last Submit(), and wait for at least @a wait_nr completions.
+	 * @returns Number of SQEs submitted, or -errno.
+	 */
+	int Submit(unsigned wait_nr) noexcept;
+
+	/**
+	 * Wait for at least @a wait_nr completions without submitting anything new.
+	 * @returns 0 on success, or -errno.
+	 */
+	int Wait(unsigned wait_nr) noexcept;
+
+	/// @returns The next completion queue entry, or nullptr if there currently isn't one.
+	io_uring_cqe* PeekCQE() noexcept;
+
+	/// Mark the CQE returned by the last PeekCQE() as consumed.
+	void SeenCQE() noexcept;
+
+private:
+
+	int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) noexcept;
+
+	int m_ring_fd { -1 };
+
+	void *m_sq_ring_ptr { nullptr };
+	size_t m_sq_ring_size { 0 };
+	void *m_cq_ring_ptr { nullptr };
+	size_t m_cq_ring_size { 0 };
+	io_uring_sqe *m_sqes { nullptr };
+	size_t m_sqes_size { 0 };
+
+	/// @name Pointers into the shared SQ ring.
+	/// @{
+	unsigned *m_sq_khead { nullptr };
+	unsigned *m_sq_ktail { nullptr };
+	unsigned m_sq_mask { 0 };
+	unsigned m_sq_entries { 0 };
+	unsigned *m_sq_array { nullptr };
+	/// @}
+
+	/// @name Pointers into the shared CQ ring.
+	/// @{
+	unsigned *m_cq_khead { nullptr };
+	unsigned *m_cq_ktail { nullptr };
+	unsigned m_cq_mask { 0 };
+	io_uring_cqe *m_cqes { nullptr };
+	/// @}
+
+	/// Our local SQ tail, i.e. one past the last SQE handed out by GetSQE().
+	unsigned m_sqe_tail { 0 };
+
+	/// The SQ tail as of the last Submit().
+	unsigned m_sqe_submitted_tail { 0 };
+};
+
+#endif /* HAVE_LINUX_IO_URING */
+
+#endif /* SRC_LIBEXT_IOURING_H_ */
@@ -0,0 +1,334 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "IgnoreRules.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+/**
+ * Match @a s against the gitignore-style glob @a p.  "*" and "?" don't match "/", "**" in a "**" + "/" or
+ * trailing "/" + "**" position matches any number of path components, and "[...]" is a character class, negated
+ * by a leading "!" or "^".  A backslash quotes the next character.
+ */
+static bool glob_match(const char *p, const char *s) noexcept
+{
+	while(*p != '\0')
+	{
+		if(p[0] == '*' && p[1] == '*' && (p[2] == '/' || p[2] == '\0'))
+		{
+			if(p[2] == '\0')
+			{
+				// Trailing "**" matches everything that's left.
+				return true;
+			}
+			// "**/" matches zero or more leading directories.
+			p += 3;
+			while(true)
+			{
+				if(glob_match(p, s))
+				{
+					return true;
+				}
+				s = std::strchr(s, '/');
+				if(s == nullptr)
+				{
+					return false;
+				}
+				++s;
+			}
+		}
+
+		switch(*p)
+		{
+		case '*':
+		{
+			// Collapse runs of '*'s, then try every possible match length which doesn't cross a '/'.
+			while(*p == '*')
+			{
+				++p;
+			}
+			for(;; ++s)
+			{
+				if(glob_match(p, s))
+				{
+					return true;
+				}
+				if(*s == '\0' || *s == '/')
+				{
+					return false;
+				}
+			}
+		}
+		case '?':
+		{
+			if(*s == '\0' || *s == '/')
+			{
+				return false;
+			}
+			++p;
+			++s;
+			break;
+		}
+		case '[':
+		{
+			const char *q = p+1;
+			bool negated = (*q == '!' || *q == '^');
+			if(negated)
+			{
+				++q;
+			}
+			bool matched = false;
+			bool first = true;
+			while(*q != '\0' && (*q != ']' || first))
+			{
+				first = false;
+				char lo = *q;
+				if(lo == '\\' && q[1] != '\0')
+				{
+					lo = *++q;
+				}
+				char hi = lo;
+				if(q[1] == '-' && q[2] != '\0' && q[2] != ']')
+				{
+					q += 2;
+					hi = *q;
+					if(hi == '\\' && q[1] != '\0')
+					{
+						hi = *++q;
+					}
+				}
+				if(lo <= *s && *s <= hi)
+				{
+					matched = true;
+				}
+				++q;
+			}
+			if(*q != ']')
+			{
+				// No closing bracket, so it's just a '['.
+				if(*s != '[')
+				{
+					return false;
+				}
+				++p;
+				++s;
+				break;
+			}
+			if(*s == '\0' || *s == '/' || matched == negated)
+			{
+				return false;
+			}
+			p = q+1;
+			++s;
+			break;
+		}
+		case '\\':
+			if(p[1] != '\0')
+			{
+				++p;
+			}
+			// Fall through.
+		default:
+		{
+			if(*p != *s)
+			{
+				return false;
+			}
+			++p;
+			++s;
+			break;
+		}
+		}
+	}
+
+	return *s == '\0';
+}
+
+/// @returns true if @a pattern contains any unquoted glob characters, starting at @a start.
+static bool has_wildcards(const std::string &pattern, size_t start = 0) noexcept
+{
+	return pattern.find_first_of("*?[\\", start) != std::string::npos;
+}
+
+
+IgnoreRules::IgnoreRules(std::shared_ptr<const IgnoreRules> parent, std::string dir_path)
+	: m_parent(std::move(parent)), m_dir_path(std::move(dir_path))
+{
+}
+
+void IgnoreRules::AddRules(const std::string &contents)
+{
+	std::istringstream lines(contents);
+	std::string line;
+
+	while(std::getline(lines, line))
+	{
+		// Handle CRLF files.
+		if(!line.empty() && line.back() == '\r')
+		{
+			line.pop_back();
+		}
+
+		// Trailing spaces are ignored, unless they're quoted with a backslash.
+		while(!line.empty() && line.back() == ' ' && !(line.size() >= 2 && line[line.size()-2] == '\\'))
+		{
+			line.pop_back();
+		}
+
+		if(line.empty() || line[0] == '#')
+		{
+			// Blank line or comment.
+			continue;
+		}
+
+		Rule rule {};
+
+		if(line[0] == '!')
+		{
+			rule.m_negated = true;
+			line.erase(0, 1);
+		}
+		else if(line[0] == '\\' && line.size() > 1 && (line[1] == '#' || line[1] == '!'))
+		{
+			// Quoted leading '#' or '!'.
+			line.erase(0, 1);
+		}
+
+		if(!line.empty() && line.back() == '/')
+		{
+			rule.m_dir_only = true;
+			line.pop_back();
+		}
+
+		if(line.find('/') != std::string::npos)
+		{
+			// Relative to this directory.  A leading '/' just says so explicitly.
+			rule.m_anchored = true;
+			if(line[0] == '/')
+			{
+				line.erase(0, 1);
+			}
+		}
+
+		if(line.empty())
+		{
+			continue;
+		}
+
+		if(!has_wildcards(line))
+		{
+			rule.m_kind = Kind::LITERAL;
+		}
+		else if(!rule.m_anchored && line[0] == '*' && !has_wildcards(line, 1))
+		{
+			rule.m_kind = Kind::SUFFIX;
+			line.erase(0, 1);
+		}
+		else
+		{
+			rule.m_kind = Kind::GLOB;
+		}
+
+		rule.m_pattern = std::move(line);
+		m_has_anchored_rules |= rule.m_anchored;
+		m_rules.push_back(std::move(rule));
+	}
+}
+
+bool IgnoreRules::IsIgnored(const std::string &dir_path, const std::string &name, bool is_dir) const
+{
+	for(const IgnoreRules *rules = this; rules != nullptr; rules = rules->m_parent.get())
+	{
+		Verdict verdict = rules->Match(dir_path, name, is_dir);
+		if(verdict != Verdict::NO_MATCH)
+		{
+			return verdict == Verdict::IGNORE;
+		}
+	}
+
+	return false;
+}
+
+IgnoreRules::Verdict IgnoreRules::Match(const std::string &dir_path, const std::string &name, bool is_dir) const
+{
+	std::string rel_path;
+	if(m_has_anchored_rules)
+	{
+		rel_path = RelativePath(dir_path, name);
+	}
+
+	// Last match wins, so start at the end.
+	for(auto rule = m_rules.crbegin(); rule != m_rules.crend(); ++rule)
+	{
+		if(rule->m_dir_only && !is_dir)
+		{
+			continue;
+		}
+
+		const std::string &subject = rule->m_anchored ? rel_path : name;
+		bool matched;
+		switch(rule->m_kind)
+		{
+		case Kind::LITERAL:
+			matched = (subject == rule->m_pattern);
+			break;
+		case Kind::SUFFIX:
+			matched = subject.size() >= rule->m_pattern.size()
+					&& subject.compare(subject.size() - rule->m_pattern.size(), std::string::npos, rule->m_pattern) == 0;
+			break;
+		default:
+			matched = glob_match(rule->m_pattern.c_str(), subject.c_str());
+			break;
+		}
+
+		if(matched)
+		{
+			return rule->m_negated ? Verdict::INCLUDE : Verdict::IGNORE;
+		}
+	}
+
+	return Verdict::NO_MATCH;
+}
+
+std::string IgnoreRules::RelativePath(const std::string &dir_path, const std::string &name) const
+{
+	if(dir_path == m_dir_path)
+	{
+		return name;
+	}
+
+	// The paths of the children of "." don't start with "./".
+	size_t prefix_len = (m_dir_path == ".") ? 0 : m_dir_path.size();
+	std::string retval = dir_path.substr(std::min(prefix_len, dir_path.size()));
+	if(!retval.empty() && retval[0] == '/')
+	{
+		retval.erase(0, 1);
+	}
+	if(!retval.empty())
+	{
+		retval += '/';
+	}
+	retval += name;
+
+	return retval;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_LIBEXT_IGNORERULES_H_
+#define SRC_LIBEXT_IGNORERULES_H_
+
+#include <config.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * The exclusion rules from the .gitignore-format files in one directory, chained to those of its ancestors.
+ *
+ * Supports the gitignore(5) pattern syntax: "#" comments, "!" negation, a trailing "/" for directories only, patterns
+ * containing a "/" being relative to the directory the file is in, and "*", "?", "[...]" and "**" wildcards.  Within
+ * one directory's rules the last matching one wins, and a directory's rules take precedence over its ancestors'.
+ *
+ * Each pattern is classified when it's added, so the common cases (a literal name like "node_modules", or a suffix
+ * like "*.o") are matched with a string compare instead of a glob match.  Instances are immutable once they've been
+ * handed to a subdirectory, so they can be shared between traversal threads.
+ */
+class IgnoreRules
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param parent    The rules in effect in the parent directory, or nullptr.
+	 * @param dir_path  The path of the directory these rules are from, as FileID::GetPath() reports it.
+	 */
+	IgnoreRules(std::shared_ptr<const IgnoreRules> parent, std::string dir_path);
+	~IgnoreRules() = default;
+
+	/**
+	 * Add the rules in @a contents, the contents of a .gitignore-format file.  Rules added later take precedence
+	 * over those added earlier.
+	 */
+	void AddRules(const std::string &contents);
+
+	/// @returns true if no rules have been added to this instance.  Its ancestors might still have some.
+	bool empty() const noexcept { return m_rules.empty(); };
+
+	/**
+	 * Check whether an entry should be excluded.
+	 *
+	 * @param dir_path  The path of the directory the entry is in, as FileID::GetPath() reports it.  Must be this
+	 *                  instance's directory or one of its descendants.
+	 * @param name      The entry's name.
+	 * @param is_dir    true if the entry is a directory.
+	 * @returns true if the entry is excluded by these rules or their ancestors'.
+	 */
+	bool IsIgnored(const std::string &dir_path, const std::string &name, bool is_dir) const;
+
+private:
+
+	enum class Verdict
+	{
+		NO_MATCH,
+		IGNORE,
+		INCLUDE
+	};
+
+	/// How a rule's pattern gets matched.
+	enum class Kind
+	{
+		LITERAL,	///< No wildcards, compare the whole string.
+		SUFFIX,		///< "*" followed by no wildcards, compare the end of the string.
+		GLOB		///< Anything else.
+	};
+
+	struct Rule
+	{
+		std::string m_pattern;
+		Kind m_kind;
+		bool m_negated;
+		bool m_dir_only;
+		/// true if the pattern contains a "/", and so is matched against the path relative to m_dir_path instead of
+		/// just the name.
+		bool m_anchored;
+	};
+
+	/// Match against this instance's rules only.
+	Verdict Match(const std::string &dir_path, const std::string &name, bool is_dir) const;
+
+	/// Returns the path of @a name in @a dir_path, relative to m_dir_path.
+	std::string RelativePath(const std::string &dir_path, const std::string &name) const;
+
+	std::shared_ptr<const IgnoreRules> m_parent;
+
+	std::string m_dir_path;
+
+	std::vector<Rule> m_rules;
+
+	/// true if any rule needs the relative path.
+	bool m_has_anchored_rules { false };
+};
+
+#endif /* SRC_LIBEXT_IGNORERULES_H_ */
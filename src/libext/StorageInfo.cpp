@@ -0,0 +1,167 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "StorageInfo.h"
+
+#include "Logger.h"
+
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if HAVE_SYS_VFS_H
+#include <sys/vfs.h> // For statfs().
+#endif
+#if HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h> // For major() and minor().
+#endif
+
+const char * to_string(StorageKind kind) noexcept
+{
+	switch(kind)
+	{
+	case StorageKind::MEMORY: return "memory";
+	case StorageKind::SOLID_STATE: return "solid-state";
+	case StorageKind::ROTATIONAL: return "rotational";
+	case StorageKind::NETWORK: return "network";
+	case StorageKind::FUSE: return "fuse";
+	default: return "unknown";
+	}
+}
+
+#if HAVE_SYS_VFS_H
+
+namespace
+{
+
+/// The statfs() f_type magic numbers we care about, from the Linux kernel's <linux/magic.h> and filesystem sources.
+/// Spelled out here since that header doesn't have all of them, and other statfs() platforms don't have it at all.
+struct FsMagic
+{
+	unsigned long m_magic;
+	const char *m_name;
+	StorageKind m_kind;
+};
+
+constexpr FsMagic f_fs_magics[] =
+{
+	{ 0x01021994, "tmpfs", StorageKind::MEMORY },
+	{ 0x858458f6, "ramfs", StorageKind::MEMORY },
+	{ 0x6969, "nfs", StorageKind::NETWORK },
+	{ 0x517b, "smb", StorageKind::NETWORK },
+	{ 0xff534d42, "cifs", StorageKind::NETWORK },
+	{ 0xfe534d42, "smb2", StorageKind::NETWORK },
+	{ 0x00c36400, "ceph", StorageKind::NETWORK },
+	{ 0x5346414f, "afs", StorageKind::NETWORK },
+	{ 0x01021997, "9p", StorageKind::NETWORK },
+	{ 0x65735546, "fuse", StorageKind::FUSE },
+	// Local filesystems.  Whether they're on something rotational is up to the block device.
+	{ 0xef53, "ext2/3/4", StorageKind::UNKNOWN },
+	{ 0x58465342, "xfs", StorageKind::UNKNOWN },
+	{ 0x9123683e, "btrfs", StorageKind::UNKNOWN },
+	{ 0xf2f52010, "f2fs", StorageKind::UNKNOWN },
+	{ 0x2fc12fc1, "zfs", StorageKind::UNKNOWN },
+	{ 0x794c7630, "overlayfs", StorageKind::UNKNOWN },
+	{ 0x4d44, "vfat", StorageKind::UNKNOWN },
+	{ 0x5346544e, "ntfs", StorageKind::UNKNOWN },
+};
+
+/**
+ * Look up the sysfs rotational flag for the block device @a dev.  /sys/dev/block/MAJ:MIN links to the device, and for
+ * a partition, the flag is on its parent, the whole disk.
+ *
+ * @returns 1 if rotational, 0 if not, -1 if we can't tell (e.g. it's not a real block device, as for btrfs and NFS).
+ */
+int sysfs_rotational(dev_t dev)
+{
+#if HAVE_SYS_SYSMACROS_H
+	const std::string devdir = "/sys/dev/block/" + std::to_string(major(dev)) + ":" + std::to_string(minor(dev));
+
+	for(const char *suffix : { "/queue/rotational", "/../queue/rotational" })
+	{
+		std::ifstream flag(devdir + suffix);
+		int value;
+		if(flag >> value)
+		{
+			return value != 0 ? 1 : 0;
+		}
+	}
+#endif
+
+	return -1;
+}
+
+} // namespace
+
+StorageInfo GetStorageInfo(const std::string &path)
+{
+	StorageInfo retval;
+
+	struct statfs sfs;
+	if(statfs(path.c_str(), &sfs) != 0)
+	{
+		LOG(INFO) << "statfs(\"" << path << "\") failed: " << LOG_STRERROR();
+		return retval;
+	}
+
+	const unsigned long magic = static_cast<unsigned long>(sfs.f_type) & 0xffffffffUL;
+	bool local = true;
+	std::ostringstream magic_str;
+	magic_str << std::hex << std::showbase << magic;
+	retval.m_fs_name = magic_str.str();
+	for(const auto &fs : f_fs_magics)
+	{
+		if(fs.m_magic == magic)
+		{
+			retval.m_fs_name = fs.m_name;
+			retval.m_kind = fs.m_kind;
+			local = (fs.m_kind == StorageKind::UNKNOWN);
+			break;
+		}
+	}
+
+	if(local)
+	{
+		struct stat st;
+		if(stat(path.c_str(), &st) == 0)
+		{
+			switch(sysfs_rotational(st.st_dev))
+			{
+			case 1: retval.m_kind = StorageKind::ROTATIONAL; break;
+			case 0: retval.m_kind = StorageKind::SOLID_STATE; break;
+			default: break;
+			}
+		}
+	}
+
+	return retval;
+}
+
+#else
+
+StorageInfo GetStorageInfo(const std::string &path)
+{
+	// No statfs(), so no way to tell.
+	return StorageInfo();
+}
+
+#endif
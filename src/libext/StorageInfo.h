@@ -0,0 +1,57 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_LIBEXT_STORAGEINFO_H_
+#define SRC_LIBEXT_STORAGEINFO_H_
+
+#include <config.h>
+
+#include <string>
+
+/// The broad classes of storage, as far as how much parallelism they reward.
+enum class StorageKind
+{
+	UNKNOWN,		///< Couldn't tell.
+	MEMORY,			///< tmpfs, ramfs: no I/O at all, we're purely CPU bound.
+	SOLID_STATE,	///< A local non-rotational block device.
+	ROTATIONAL,		///< A local spinning disk, where concurrent reads mostly buy seeks.
+	NETWORK,		///< NFS, SMB, etc.: latency bound, so more requests in flight help.
+	FUSE			///< A userspace filesystem, often with a single-threaded daemon behind it.
+};
+
+/// @returns A human-readable name for @a kind.
+const char * to_string(StorageKind kind) noexcept;
+
+/// What we could find out about the storage a path is on.
+struct StorageInfo
+{
+	StorageKind m_kind { StorageKind::UNKNOWN };
+
+	/// The filesystem type's name, e.g. "ext4", or "unknown".
+	std::string m_fs_name { "unknown" };
+};
+
+/**
+ * Find out what kind of storage @a path is on, from the statfs() filesystem type and, for local block devices, the
+ * kernel's rotational flag for the device.  On platforms which have neither, always returns StorageKind::UNKNOWN.
+ * Never fails; anything we can't determine is left as unknown.
+ */
+StorageInfo GetStorageInfo(const std::string &path);
+
+#endif /* SRC_LIBEXT_STORAGEINFO_H_ */
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_LIBEXT_WORKSTEALINGSCHEDULER_HPP_
+#define SRC_LIBEXT_WORKSTEALINGSCHEDULER_HPP_
+
+#include <config.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing scheduler for a fixed number of worker threads which generate their own work, e.g. the directories
+ * in a tree traversal.
+ *
+ * Each worker has its own deque.  A worker pushes the new work it finds onto the back of its own deque, and pulls from
+ * there too, so it mostly works depth-first on data which is still hot in its caches.  Only when its deque runs dry
+ * does it steal from the front of another worker's, where the oldest (and usually biggest) pieces of work are.  The
+ * only lock taken on the fast path is the worker's own deque's, which is almost never contended.
+ *
+ * Completion is detected with an atomic count of the work items which have been pushed but not yet finished.  An item
+ * is finished when the worker which pulled it pulls again, so anything it pushed while working on the item has already
+ * been counted.  When the count drops to zero, there's no work left anywhere and nothing running which could create
+ * more, so Pull() returns false in every worker.  There's no need for a master thread to watch for this and close a
+ * queue.
+ *
+ * Idle workers sleep on a condition variable, which is only touched when there's a worker to wake.
+ */
+template <typename ValueType>
+class WorkStealingScheduler
+{
+public:
+	explicit WorkStealingScheduler(size_t num_workers)
+	{
+		if(num_workers == 0)
+		{
+			num_workers = 1;
+		}
+		m_workers.reserve(num_workers);
+		for(size_t i=0; i<num_workers; ++i)
+		{
+			m_workers.emplace_back(new Worker());
+		}
+	}
+
+	WorkStealingScheduler(const WorkStealingScheduler&) = delete;
+	WorkStealingScheduler& operator=(const WorkStealingScheduler&) = delete;
+
+	size_t GetNumWorkers() const noexcept { return m_workers.size(); };
+
+	/**
+	 * Push @a value onto worker @a worker_index's deque.  Before the workers are started, any thread may push onto any
+	 * worker's deque.  After that, workers should only push onto their own.
+	 */
+	void Push(size_t worker_index, ValueType &&value)
+	{
+		m_num_unfinished.fetch_add(1);
+		{
+			Worker &w = *m_workers[worker_index];
+			std::lock_guard<std::mutex> lock(w.m_mutex);
+			w.m_deque.push_back(std::move(value));
+		}
+		WakeIdleWorkers(false);
+	}
+
+	/**
+	 * Push all of @a values onto worker @a worker_index's deque, moving them out of @a values.
+	 */
+	template <typename ContainerType, typename Unused = typename ContainerType::value_type>
+	void Push(size_t worker_index, ContainerType &values)
+	{
+		if(values.empty())
+		{
+			return;
+		}
+
+		m_num_unfinished.fetch_add(values.size());
+		{
+			Worker &w = *m_workers[worker_index];
+			std::lock_guard<std::mutex> lock(w.m_mutex);
+			w.m_deque.insert(w.m_deque.end(), std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+		}
+		WakeIdleWorkers(values.size() > 1);
+	}
+
+	/**
+	 * Finish the item worker @a worker_index last pulled, if any, and get it the next one: the newest item on its own
+	 * deque, or failing that, the oldest item on some other worker's.  If there's nothing to be had anywhere, wait.
+	 *
+	 * @returns true if @a value was pulled, false if all work is finished and the worker should exit.
+	 */
+	bool Pull(size_t worker_index, ValueType &value)
+	{
+		Worker &self = *m_workers[worker_index];
+
+		if(self.m_holding_item)
+		{
+			self.m_holding_item = false;
+			if(m_num_unfinished.fetch_sub(1) == 1)
+			{
+				// That was the last one.  Tell everyone to go home.
+				std::lock_guard<std::mutex> lock(m_idle_mutex);
+				m_all_finished.store(true);
+				m_idle_cv.notify_all();
+			}
+		}
+
+		while(true)
+		{
+			// Anything pushed after this will change m_push_epoch, so if we don't find any work below, we'll know
+			// whether it's worth looking again instead of going to sleep.
+			auto epoch = m_push_epoch.load();
+
+			if(TryPopBack(self, value))
+			{
+				self.m_holding_item = true;
+				return true;
+			}
+
+			// Try to steal, starting with our neighbor so the thieves spread out over the victims.
+			const size_t num_workers = m_workers.size();
+			bool contended = false;
+			for(size_t i = 1; i < num_workers; ++i)
+			{
+				switch(TryPopFront(*m_workers[(worker_index + i) % num_workers], value))
+				{
+				case steal_result::success:
+					++self.m_num_steals;
+					self.m_holding_item = true;
+					return true;
+				case steal_result::busy:
+					contended = true;
+					break;
+				case steal_result::empty:
+					break;
+				}
+			}
+
+			if(m_all_finished.load() || m_num_unfinished.load() == 0)
+			{
+				return false;
+			}
+
+			if(contended)
+			{
+				// Somebody else had a deque we wanted locked, so there may still be something in it.  Look again.
+				std::this_thread::yield();
+				continue;
+			}
+
+			// Nothing to do right now.  Wait for someone to push something, or for everything to be finished.
+			std::unique_lock<std::mutex> lock(m_idle_mutex);
+			m_num_idle.fetch_add(1);
+			m_idle_cv.wait(lock, [&](){ return m_push_epoch.load() != epoch || m_all_finished.load(); });
+			m_num_idle.fetch_sub(1);
+		}
+	}
+
+	/// @returns The number of items worker @a worker_index has stolen from other workers.  Call after it's exited.
+	size_t GetNumSteals(size_t worker_index) const noexcept { return m_workers[worker_index]->m_num_steals; };
+
+private:
+
+	struct alignas(64) Worker
+	{
+		std::mutex m_mutex;
+		std::deque<ValueType> m_deque;
+
+		/// @name Only touched by the worker itself.
+		/// @{
+		bool m_holding_item { false };
+		size_t m_num_steals { 0 };
+		/// @}
+	};
+
+	static bool TryPopBack(Worker &w, ValueType &value)
+	{
+		std::lock_guard<std::mutex> lock(w.m_mutex);
+		if(w.m_deque.empty())
+		{
+			return false;
+		}
+		value = std::move(w.m_deque.back());
+		w.m_deque.pop_back();
+		return true;
+	}
+
+	enum class steal_result { success, empty, busy };
+
+	static steal_result TryPopFront(Worker &w, ValueType &value)
+	{
+		// If the owner or another thief has it locked, don't wait around, there may be better victims.
+		std::unique_lock<std::mutex> lock(w.m_mutex, std::try_to_lock);
+		if(!lock.owns_lock())
+		{
+			return steal_result::busy;
+		}
+		if(w.m_deque.empty())
+		{
+			return steal_result::empty;
+		}
+		value = std::move(w.m_deque.front());
+		w.m_deque.pop_front();
+		return steal_result::success;
+	}
+
+	/**
+	 * Let any idle workers know there's something new to steal.
+	 * @note All the atomics here and in Pull() are sequentially consistent on purpose.  Either a worker about to sleep
+	 *       sees the new epoch and doesn't, or we see it in m_num_idle and wake it.
+	 */
+	void WakeIdleWorkers(bool more_than_one)
+	{
+		m_push_epoch.fetch_add(1);
+		if(m_num_idle.load() > 0)
+		{
+			std::lock_guard<std::mutex> lock(m_idle_mutex);
+			if(more_than_one)
+			{
+				m_idle_cv.notify_all();
+			}
+			else
+			{
+				m_idle_cv.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	/// Number of items which have been pushed but not finished.
+	std::atomic<size_t> m_num_unfinished { 0 };
+
+	/// Incremented on every push.
+	std::atomic<std::uint64_t> m_push_epoch { 0 };
+
+	/// Number of workers sleeping on m_idle_cv.
+	std::atomic<size_t> m_num_idle { 0 };
+
+	std::atomic<bool> m_all_finished { false };
+
+	std::mutex m_idle_mutex;
+	std::condition_variable m_idle_cv;
+};
+
+#endif /* SRC_LIBEXT_WORKSTEALINGSCHEDULER_HPP_ */
@@ -35,6 +35,9 @@
 #include <unistd.h> // For close().
 #include <sys/stat.h>
 #include <sys/types.h> // for dev_t, ino_t
+#if HAVE_STATX
+#include <sys/sysmacros.h> // For makedev().
+#endif
 // Don't know where the name "libgen" comes from, but this is where POSIX says dirname() and basename() are declared.
 /// There are two basename()s.  GNU basename, from string.h, and POSIX basename() from libgen.h.
 /// See notes here: https://linux.die.net/man/3/dirname
@@ -48,6 +51,8 @@
 #include <string.h>
 #include <cstdlib>   // For free().
 #include <string>
+#include <atomic>
+#include <cerrno>
 #include <iterator>   // For std::distance().
 #include <future/type_traits.hpp>
 #include <future/memory.hpp>
@@ -119,6 +124,27 @@ inline int fstatat(int dirfd, const char *pathname, struct stat *buf, int flags)
 #if !defined(O_PATH)
 #define O_PATH 0
 #endif
+
+// Linux-only: fstatat() of the descriptor itself when the path is "".
+#if !defined(AT_EMPTY_PATH)
+#define AT_EMPTY_PATH 0
+#endif
+
+// statx() is Linux >= 4.11, glibc >= 2.28.  Where we don't have it, fstatat_minimal() below ignores the mask and these
+// flags, so define them to values which are harmless to pass around.
+#if !defined(HAVE_STATX) || HAVE_STATX == 0
+#if !defined(STATX_TYPE)
+#define STATX_TYPE 0x0001U
+#define STATX_MTIME 0x0040U
+#define STATX_INO 0x0100U
+#define STATX_SIZE 0x0200U
+#define STATX_BLOCKS 0x0400U
+#endif
+#if !defined(AT_STATX_FORCE_SYNC)
+#define AT_STATX_FORCE_SYNC 0x2000
+#define AT_STATX_DONT_SYNC 0x4000
+#endif
+#endif
 /// @}
 
 
@@ -147,12 +173,19 @@ struct dev_ino_pair
 	constexpr dev_ino_pair(dev_t d, ino_t i) noexcept : m_dev(d), m_ino(i) { };
 	~dev_ino_pair() = default;
 
-	inline bool operator<(const dev_ino_pair& other) const noexcept { return m_dev < other.m_dev || m_ino < other.m_ino; };
+	/// Orders by device, then by inode number.
+	inline bool operator<(const dev_ino_pair& other) const noexcept
+	{
+		return m_dev < other.m_dev || (m_dev == other.m_dev && m_ino < other.m_ino);
+	};
 
 	inline bool operator==(dev_ino_pair other) const noexcept { return m_dev == other.m_dev && m_ino == other.m_ino; };
 
 	inline bool empty() const noexcept { return m_dev == 0 && m_ino == 0; };
 
+	inline dev_t dev() const noexcept { return m_dev; };
+	inline ino_t ino() const noexcept { return m_ino; };
+
 private:
 	friend struct std::hash<dev_ino_pair>;
 
@@ -204,6 +237,19 @@ inline std::string dirent_get_name(const dirent* de) noexcept
 	return basename;
 }
 
+/**
+ * Get the d_type field out of the passed dirent struct #de, or DT_UNKNOWN if struct dirent doesn't have one.
+ */
+inline unsigned char dirent_get_type(const dirent* de) noexcept
+{
+#if defined(_DIRENT_HAVE_D_TYPE)
+	return de->d_type;
+#else
+	(void)de;
+	return DT_UNKNOWN;
+#endif
+}
+
 
 /**
  * Checks two file descriptors (file, dir, whatever) and checks if they are referring to the same entity.
@@ -238,6 +284,67 @@ inline bool is_same_file(int fd1, int fd2)
 	}
 }
 
+#if HAVE_STATX
+/**
+ * Copy the fields of @a stx which fstatat_minimal() promises into the zeroed @a buf.
+ */
+inline void statx_to_stat(const struct statx &stx, struct stat *buf) noexcept
+{
+	buf->st_mode = stx.stx_mode;
+	buf->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	buf->st_ino = stx.stx_ino;
+	buf->st_size = stx.stx_size;
+	buf->st_blksize = stx.stx_blksize;
+	buf->st_blocks = stx.stx_blocks;
+	buf->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+	buf->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+}
+#endif
+
+/**
+ * fstatat() replacement which asks the kernel for only the fields in @a mask, some combination of STATX_TYPE,
+ * STATX_INO, STATX_SIZE, STATX_BLOCKS and STATX_MTIME.  st_dev and st_blksize are always filled in, and everything else in
+ * @a buf is zeroed.
+ *
+ * On NFS and FUSE, fetching fewer fields, and passing AT_STATX_DONT_SYNC in @a flags when cached attributes are good
+ * enough, can save a round trip to the server per call.  Where statx() isn't available, the mask and any AT_STATX_*
+ * flags are ignored and this falls back to fstatat(), or to fstat() if @a pathname is empty.
+ *
+ * @returns 0 on success, -1 with errno set on failure.
+ */
+inline int fstatat_minimal(int dirfd, const char *pathname, struct stat *buf, int flags, unsigned int mask) noexcept
+{
+	memset(buf, 0, sizeof(*buf));
+
+#if HAVE_STATX
+	// Old kernels and some seccomp sandboxes don't have statx() even though libc does.
+	static std::atomic<bool> f_statx_missing { false };
+
+	if(!f_statx_missing.load(std::memory_order_relaxed))
+	{
+		struct statx stx;
+		if(statx(dirfd, pathname, flags, mask, &stx) == 0)
+		{
+			statx_to_stat(stx, buf);
+			return 0;
+		}
+		if(errno != ENOSYS)
+		{
+			return -1;
+		}
+		f_statx_missing.store(true, std::memory_order_relaxed);
+	}
+#else
+	(void)mask;
+#endif
+
+	if(pathname[0] == '\0')
+	{
+		return fstat(dirfd, buf);
+	}
+	return fstatat(dirfd, pathname, buf, flags & ~(AT_EMPTY_PATH | AT_STATX_FORCE_SYNC | AT_STATX_DONT_SYNC));
+}
+
 namespace portable
 {
 
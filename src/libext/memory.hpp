@@ -26,6 +26,7 @@
 
 #include <cstdlib>  // For aligned_alloc().
 #include <string.h>  // for memmem().
+#include <new> // For std::bad_alloc.
 
 #include "hints.hpp"
 #include "integer.hpp"
@@ -0,0 +1,503 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file Lock-free bounded multi-producer/multi-consumer queue with the sync_queue<> interface. */
+
+#ifndef SRC_MPMC_SYNC_QUEUE_H_
+#define SRC_MPMC_SYNC_QUEUE_H_
+
+#include <config.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "queue_op_status.h"
+
+/**
+ * A drop-in replacement for sync_queue<> built on a bounded ring buffer, after Dmitry Vyukov's MPMC queue
+ * <http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue>.
+ *
+ * Each slot has a sequence number which says whose turn it is to use it, a producer or a consumer, and on which lap
+ * around the ring.  Producers claim slots by compare-exchanging the enqueue position and consumers the dequeue
+ * position, so as long as the ring is neither empty nor full, a push or a pull is one CAS and a couple of loads and
+ * stores, with no lock.  The two positions are on separate cache lines, so producers and consumers don't invalidate
+ * each other's.
+ *
+ * Threads only block when they have to: consumers when the ring is empty, producers when it's full or over its
+ * capacity.  They sleep on a condition variable, and the other side only takes the mutex to wake them when it sees a
+ * nonzero count of sleepers, so the fast paths never touch it.  The close() and wait_for_worker_completion() semantics
+ * are the same as sync_queue<>'s, except that only threads actually waiting for work count as waiting.
+ *
+ * The ring always has a fixed number of slots, so unlike sync_queue<>, this queue is never truly unbounded.  With no
+ * capacity set, producers block only if the ring fills up.  Capacities are enforced approximately: producers which
+ * find room at the same time can all get in, overshooting by up to one element each.
+ */
+template <typename ValueType>
+class mpmc_sync_queue
+{
+public:
+
+	using size_type = size_t;
+
+	/// Returns the weight of an element for the purposes of the capacity.  Must not change while it's in the queue.
+	using weigher_type = std::function<size_t(const ValueType&)>;
+
+	/// Number of slots in the ring unless set_capacity() says otherwise.
+	static constexpr size_type default_num_slots = 16*1024;
+
+	explicit mpmc_sync_queue(size_type num_slots = default_num_slots)
+	{
+		allocate_ring(num_slots);
+	}
+
+	~mpmc_sync_queue() = default;
+
+	mpmc_sync_queue(const mpmc_sync_queue&) = delete;
+	mpmc_sync_queue& operator=(const mpmc_sync_queue&) = delete;
+
+	/**
+	 * Set the total weight at which pushes start blocking, or 0 for no limit beyond the ring's size.  Each element weighs
+	 * 1 unless a @a weigher is given.  Without one, the ring is resized to hold twice @a capacity elements, leaving room
+	 * for force_push_back()s.  Call before any threads are using the queue.
+	 */
+	void set_capacity(size_t capacity, weigher_type weigher = nullptr)
+	{
+		m_capacity = capacity;
+		m_low_water = (capacity == 0) ? 0 : capacity - std::max<size_t>(capacity/4, 1);
+		m_weigher = std::move(weigher);
+		if(!m_weigher && capacity != 0)
+		{
+			allocate_ring(2*capacity);
+		}
+	}
+
+	size_t capacity() const noexcept { return m_capacity; };
+
+	/// @returns The number of elements in the queue.  Only a snapshot if other threads are using it.
+	size_type size() const noexcept
+	{
+		// Load the dequeue position first, so the enqueue position can't be behind it.
+		size_t deq = m_dequeue_pos.load(std::memory_order_relaxed);
+		size_t enq = m_enqueue_pos.load(std::memory_order_relaxed);
+		return enq - deq;
+	}
+
+	/// @returns The number of times a push has had to wait for room in the queue.
+	size_t num_full_waits() const noexcept { return m_num_full_waits.load(std::memory_order_relaxed); };
+
+	/// @returns The greatest total weight the queue has held.
+	size_t high_water_mark() const noexcept { return m_high_water_mark.load(std::memory_order_relaxed); };
+
+	void close()
+	{
+		m_closed.store(true);
+
+		// Take the mutex so that nobody can be between checking m_closed and going to sleep.
+		{
+			std::lock_guard<std::mutex> lock(m_wait_mutex);
+		}
+		m_cv_not_empty.notify_all();
+		m_cv_not_full.notify_all();
+		m_cv_complete.notify_all();
+	}
+
+	queue_op_status push_back(const ValueType& x)
+	{
+		ValueType copy(x);
+		return push_back(std::move(copy));
+	}
+
+	queue_op_status push_back(ValueType&& x)
+	{
+		queue_op_status status = push_impl(x, false);
+		if(status == queue_op_status::success)
+		{
+			notify_consumers();
+		}
+		return status;
+	}
+
+	/**
+	 * Push multiple values from a container onto the queue.  Moves the elements.
+	 */
+	template <typename T, typename Unused = typename T::value_type>
+	queue_op_status push_back(T& ContainerOfValues)
+	{
+		for(auto &x : ContainerOfValues)
+		{
+			queue_op_status status = push_impl(x, false);
+			if(status != queue_op_status::success)
+			{
+				return status;
+			}
+			// Wake a consumer for each one, in case we have to block on the next.
+			notify_consumers();
+		}
+
+		return queue_op_status::success;
+	}
+
+	/**
+	 * Push @a x even if the queue is over capacity.  For consumers which need to put something on their own input
+	 * queue, and which would deadlock if they blocked there.  Only blocks if the ring itself is full.
+	 */
+	queue_op_status force_push_back(ValueType&& x)
+	{
+		queue_op_status status = push_impl(x, true);
+		if(status == queue_op_status::success)
+		{
+			notify_consumers();
+		}
+		return status;
+	}
+
+	queue_op_status pull_front(ValueType& x)
+	{
+		// Something will often turn up in the time it takes to go to sleep and be woken again, so give it a moment.
+		for(int i=0; i<f_num_spins_before_sleep; ++i)
+		{
+			if(try_dequeue(x))
+			{
+				notify_producers();
+				return queue_op_status::success;
+			}
+			if(m_closed.load(std::memory_order_relaxed))
+			{
+				break;
+			}
+			std::this_thread::yield();
+		}
+
+		// Nothing there.  Get ready to sleep.
+		queue_op_status status;
+		{
+			std::unique_lock<std::mutex> lock(m_wait_mutex);
+
+			m_num_waiting_consumers.fetch_add(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if(m_num_waiting_consumers.load() == m_num_waiting_threads_notification_level)
+			{
+				m_cv_complete.notify_all();
+			}
+
+			while(true)
+			{
+				if(try_dequeue(x))
+				{
+					status = queue_op_status::success;
+					break;
+				}
+				if(m_closed.load())
+				{
+					// Closed, but a push could have gotten in just ahead of the close().
+					status = try_dequeue(x) ? queue_op_status::success : queue_op_status::closed;
+					break;
+				}
+				m_cv_not_empty.wait(lock);
+			}
+
+			m_num_waiting_consumers.fetch_sub(1);
+		}
+
+		if(status == queue_op_status::success)
+		{
+			notify_producers();
+		}
+		return status;
+	}
+
+	queue_op_status pull_front(ValueType&& x)
+	{
+		return pull_front(x);
+	}
+
+	/**
+	 * Non-blocking version of pull_front().
+	 *
+	 * @returns queue_op_status::success if an element was pulled into @p x, queue_op_status::empty if there was nothing to
+	 *          pull, or queue_op_status::closed if the queue is closed and empty.
+	 */
+	queue_op_status try_pull_front(ValueType& x)
+	{
+		if(try_dequeue(x))
+		{
+			notify_producers();
+			return queue_op_status::success;
+		}
+
+		return m_closed.load() ? queue_op_status::closed : queue_op_status::empty;
+	}
+
+	/**
+	 * Blocks the calling thread until the queue is empty and @p num_workers threads are waiting for something to pull,
+	 * or the queue is closed.  See sync_queue<>::wait_for_worker_completion().
+	 */
+	queue_op_status wait_for_worker_completion(size_t num_workers)
+	{
+		std::unique_lock<std::mutex> lock(m_wait_mutex);
+
+		if(num_workers > 0)
+		{
+			m_num_waiting_threads_notification_level = num_workers;
+		}
+
+		m_cv_complete.wait(lock, [this](){
+			return (m_num_waiting_consumers.load() == m_num_waiting_threads_notification_level && size() == 0)
+					|| m_closed.load();
+		});
+
+		return m_closed.load() ? queue_op_status::closed : queue_op_status::success;
+	}
+
+private:
+
+	/// Number of times a consumer retries an empty queue, yielding in between, before it sleeps.
+	static constexpr int f_num_spins_before_sleep = 16;
+
+	struct Cell
+	{
+		std::atomic<size_t> m_sequence;
+		ValueType m_value;
+	};
+
+	void allocate_ring(size_type num_slots)
+	{
+		size_t n = 2;
+		while(n < num_slots)
+		{
+			n *= 2;
+		}
+
+		m_cells.reset(new Cell[n]);
+		for(size_t i=0; i<n; ++i)
+		{
+			m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+		}
+		m_mask = n - 1;
+		m_slot_low_water = n - n/4;
+	}
+
+	size_t weight_of(const ValueType &x) const { return m_weigher ? m_weigher(x) : 1; };
+
+	size_t current_weight() const noexcept { return m_weigher ? m_weight.load(std::memory_order_relaxed) : size(); };
+
+	bool has_room() const noexcept { return m_capacity == 0 || current_weight() < m_capacity; };
+
+	/// Claim a slot and move @a x into it, if the ring isn't full.  @a x is left alone if it is.
+	bool try_enqueue(ValueType &x)
+	{
+		Cell *cell;
+		size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		while(true)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t seq = cell->m_sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if(diff == 0)
+			{
+				// The slot's free on this lap.  Try to claim it.
+				if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if(diff < 0)
+			{
+				// The slot still holds last lap's value, so the ring is full.
+				return false;
+			}
+			else
+			{
+				// Somebody else claimed it first.
+				pos = m_enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		// Count the weight before publishing the value.  Otherwise a consumer could pull it and subtract its weight
+		// first, wrapping m_weight around to a huge value, and a producer seeing that would go to sleep without anyone
+		// left to wake it.
+		const size_t w = weight_of(x);
+		size_t new_weight = m_weigher ? m_weight.fetch_add(w, std::memory_order_relaxed) + w : 0;
+		cell->m_value = std::move(x);
+		cell->m_sequence.store(pos + 1, std::memory_order_release);
+
+		if(!m_weigher)
+		{
+			new_weight = size();
+		}
+		size_t high_water = m_high_water_mark.load(std::memory_order_relaxed);
+		while(new_weight > high_water
+				&& !m_high_water_mark.compare_exchange_weak(high_water, new_weight, std::memory_order_relaxed))
+		{
+		}
+
+		return true;
+	}
+
+	/// Move the front element into @a x, if there is one.
+	bool try_dequeue(ValueType &x)
+	{
+		Cell *cell;
+		size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		while(true)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t seq = cell->m_sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if(diff == 0)
+			{
+				// There's a value in the slot.  Try to claim it.
+				if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if(diff < 0)
+			{
+				// Nothing's been put in this slot on this lap yet, so the ring is empty.
+				return false;
+			}
+			else
+			{
+				pos = m_dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		x = std::move(cell->m_value);
+		// Free the slot for the next lap.
+		cell->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+		if(m_weigher)
+		{
+			m_weight.fetch_sub(weight_of(x), std::memory_order_relaxed);
+		}
+
+		return true;
+	}
+
+	/// Push @a x, blocking while there's no room unless @a force is true.  Doesn't wake anybody up.
+	queue_op_status push_impl(ValueType &x, bool force)
+	{
+		if(m_closed.load(std::memory_order_acquire))
+		{
+			return queue_op_status::closed;
+		}
+
+		if((force || has_room()) && try_enqueue(x))
+		{
+			return queue_op_status::success;
+		}
+
+		// No room.  Get ready to sleep.
+		m_num_full_waits.fetch_add(1, std::memory_order_relaxed);
+
+		std::unique_lock<std::mutex> lock(m_wait_mutex);
+
+		m_num_waiting_producers.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		queue_op_status status;
+		while(true)
+		{
+			if(m_closed.load())
+			{
+				status = queue_op_status::closed;
+				break;
+			}
+			if((force || has_room()) && try_enqueue(x))
+			{
+				status = queue_op_status::success;
+				break;
+			}
+			m_cv_not_full.wait(lock);
+		}
+
+		m_num_waiting_producers.fetch_sub(1);
+
+		return status;
+	}
+
+	/// Wake a consumer if any are asleep.  Called after every successful push.
+	void notify_consumers()
+	{
+		// Pairs with the fence in pull_front(): either the consumer sees what we pushed, or we see it waiting.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(m_num_waiting_consumers.load(std::memory_order_relaxed) != 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_wait_mutex);
+			}
+			m_cv_not_empty.notify_one();
+		}
+	}
+
+	/// Wake any sleeping producers once the queue's down to its low-water marks.  Called after every successful pull.
+	void notify_producers()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(m_num_waiting_producers.load(std::memory_order_relaxed) != 0
+				&& (m_capacity == 0 || current_weight() <= m_low_water)
+				&& size() <= m_slot_low_water)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_wait_mutex);
+			}
+			m_cv_not_full.notify_all();
+		}
+	}
+
+	/// @name The hot indices, each on its own cache line.
+	/// @{
+	alignas(64) std::atomic<size_t> m_enqueue_pos { 0 };
+	alignas(64) std::atomic<size_t> m_dequeue_pos { 0 };
+	/// Total weight, if there's a weigher.
+	alignas(64) std::atomic<size_t> m_weight { 0 };
+	/// @}
+
+	/// @name Read-mostly after construction.
+	/// @{
+	alignas(64) std::unique_ptr<Cell[]> m_cells;
+	size_t m_mask { 0 };
+	size_t m_slot_low_water { 0 };
+	size_t m_capacity { 0 };
+	size_t m_low_water { 0 };
+	weigher_type m_weigher;
+	/// @}
+
+	/// @name Read on the fast paths, but only written on the slow ones.
+	/// @{
+	alignas(64) std::atomic<bool> m_closed { false };
+	std::atomic<size_t> m_num_waiting_consumers { 0 };
+	std::atomic<size_t> m_num_waiting_producers { 0 };
+	std::atomic<size_t> m_num_full_waits { 0 };
+	std::atomic<size_t> m_high_water_mark { 0 };
+	std::mutex m_wait_mutex;
+	std::condition_variable m_cv_not_empty;
+	std::condition_variable m_cv_not_full;
+	std::condition_variable m_cv_complete;
+	size_t m_num_waiting_threads_notification_level { 500 };
+	/// @}
+};
+
+#endif /* SRC_MPMC_SYNC_QUEUE_H_ */
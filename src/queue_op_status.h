@@ -0,0 +1,34 @@
+/*
+ * Copyright 2015-2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file Result codes shared by the sync_queue<> implementations. */
+
+#ifndef SRC_QUEUE_OP_STATUS_H_
+#define SRC_QUEUE_OP_STATUS_H_
+
+enum class queue_op_status
+{
+	success,
+	empty,
+	full,
+	closed,
+	busy,
+	timeout,
+	not_ready
+};
+
+#endif /* SRC_QUEUE_OP_STATUS_H_ */
@@ -15,17 +15,20 @@
  * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-/** @file Simple unbounded synchronized queue class. */
+/** @file Simple synchronized queue class, optionally bounded. */
 
 #ifndef SYNC_QUEUE_H_
 #define SYNC_QUEUE_H_
 
 #include <config.h>
 
+#include <algorithm>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 #include <queue>
 #include <libext/hints.hpp>
+#include "queue_op_status.h"
 
 #if TODO
 #include <scoped_allocator>
@@ -36,20 +39,17 @@
 #include <tbb/scalable_allocator.h>
 #endif
 
-enum class queue_op_status
-{
-	success,
-	empty,
-	full,
-	closed,
-	busy,
-	timeout,
-	not_ready
-};
-
 
 /**
- * Simple unbounded synchronized queue class.
+ * Simple synchronized queue class.
+ *
+ * Unbounded by default.  If a capacity is set, pushes block while the queue is full, until the consumers have brought
+ * it back down to a low-water mark or the queue is closed.  Waiting for the low-water mark rather than for the first
+ * free slot means a blocked producer is woken once per batch of pulls, not on every one.
+ *
+ * By default each element counts as 1 towards the capacity.  A weigher can be given instead, e.g. to cap the number of
+ * bytes the elements are holding onto.  An element is let in whenever the queue is below capacity, so the total can
+ * overshoot it by up to one element's weight; that way an element heavier than the whole capacity can't block forever.
  *
  * The interface implemented here is loosely based on ISO/IEC JTC1 SC22 WG21 N3533
  * <http://www.open-std.org/jtc1/sc22/wg21/docs/papers/2013/n3533.html> and subsequent work noted here:
@@ -74,6 +74,36 @@ public:
 	sync_queue() {};
 	~sync_queue() {};
 
+	/// Returns the weight of an element for the purposes of the capacity.  Must not change while it's in the queue.
+	using weigher_type = std::function<size_t(const ValueType&)>;
+
+	/**
+	 * Set the total weight at which pushes start blocking, or 0 (the default) for an unbounded queue.  Each element
+	 * weighs 1 unless a @a weigher is given.  Call before any threads are using the queue.
+	 */
+	void set_capacity(size_t capacity, weigher_type weigher = nullptr)
+	{
+		m_capacity = capacity;
+		m_low_water = (capacity == 0) ? 0 : capacity - std::max<size_t>(capacity/4, 1);
+		m_weigher = std::move(weigher);
+	}
+
+	size_t capacity() const noexcept { return m_capacity; };
+
+	/// @returns The number of times a push has had to wait for room in the queue.
+	size_t num_full_waits() const noexcept
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_num_full_waits;
+	}
+
+	/// @returns The greatest total weight the queue has held.
+	size_t high_water_mark() const noexcept
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_high_water_mark;
+	}
+
 	size_type size() const noexcept __attribute__((noinline))
 	{
 		std::unique_lock<std::mutex> lock(m_mutex);
@@ -90,14 +120,17 @@ public:
 		// by the notify, and then blocking because we still hold the mutex.
 		lock.unlock();
 
-		// Notify all threads waiting on the queue's condition variable that it's just been closed.
+		// Notify all threads waiting on the queue's condition variables that it's just been closed.
 		m_cv.notify_all();
+		m_cv_room.notify_all();
 	}
 
 	queue_op_status push_back(const ValueType& x) ATTR_NOINLINE
 	{
 		std::unique_lock<std::mutex> lock(m_mutex);
 
+		wait_for_room(lock);
+
 		// Is the queue closed?
 		if(m_closed)
 		{
@@ -106,6 +139,7 @@ public:
 		}
 
 		// Push via copy.
+		account_push(x);
 		m_underlying_queue.push_back(x);
 
 		// Unlock the mutex immediately prior to notify.  This prevents a waiting thread from being immediately woken up
@@ -124,6 +158,8 @@ public:
 	{
 		std::unique_lock<std::mutex> lock(m_mutex);
 
+		wait_for_room(lock);
+
 		// Is the queue closed?
 		if(m_closed)
 		{
@@ -132,6 +168,7 @@ public:
 		}
 
 		// Push via move.
+		account_push(x);
 		m_underlying_queue.push_back(std::move(x));
 
 		// Unlock the mutex immediately prior to notify.  This prevents a waiting thread from being immediately woken up
@@ -147,7 +184,8 @@ public:
 	}
 
 	/**
-	 * Push multiple values from a container onto the queue in one operation.  Moves the elements.
+	 * Push multiple values from a container onto the queue in one operation.  Moves the elements.  If the queue has a
+	 * capacity, as many as fit are pushed at a time, and the rest wait for room.
 	 *
 	 * @param ContainerOfValues
 	 * @return
@@ -157,24 +195,59 @@ public:
 	{
 		std::unique_lock<std::mutex> lock(m_mutex);
 
-		// Is the queue closed?
+		auto first = ContainerOfValues.begin();
+		const auto last = ContainerOfValues.end();
+
+		while(first != last)
+		{
+			wait_for_room(lock);
+
+			// Is the queue closed?
+			if(m_closed)
+			{
+				// Yes, fail the push.
+				return queue_op_status::closed;
+			}
+
+			// Push via move, as many as there's room for.
+			do
+			{
+				account_push(*first);
+				m_underlying_queue.push_back(std::move(*first));
+				++first;
+			} while(first != last && has_room());
+
+			// Unlock the mutex immediately prior to notify.  This prevents a waiting thread from being immediately woken up
+			// by the notify, and then blocking because we still hold the mutex.
+			lock.unlock();
+
+			// Notify any threads waiting on the queue's condition variable that they now have something to pull.
+			m_cv.notify_all();
+
+			lock.lock();
+		}
+
+		return queue_op_status::success;
+	}
+
+	/**
+	 * Push @a x even if the queue is full.  For consumers which need to put something on their own input queue, e.g. to
+	 * wake up other consumers, and which would deadlock if they blocked there.
+	 */
+	queue_op_status force_push_back(ValueType&& x)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
 		if(m_closed)
 		{
-			// Yes, fail the push.
 			return queue_op_status::closed;
 		}
 
-		// Push via move.
-		m_underlying_queue.insert(m_underlying_queue.end(), /// @note This should be cend() AFAICT, but that won't compile on old clang.
-				std::make_move_iterator(ContainerOfValues.begin()),
-				std::make_move_iterator(ContainerOfValues.end()));
+		account_push(x);
+		m_underlying_queue.push_back(std::move(x));
 
-		// Unlock the mutex immediately prior to notify.  This prevents a waiting thread from being immediately woken up
-		// by the notify, and then blocking because we still hold the mutex.
 		lock.unlock();
-
-		// Notify any threads waiting on the queue's condition variable that they now have something to pull.
-		m_cv.notify_all();
+		m_cv.notify_one();
 
 		return queue_op_status::success;
 	}
@@ -205,9 +278,12 @@ public:
 		}
 
 		// Otherwise, we have something in the queue to pull off.
+		account_pull(m_underlying_queue.front());
 		x = m_underlying_queue.front();
 		m_underlying_queue.pop_front();
 
+		notify_producers_if_room(lock);
+
 		return queue_op_status::success;
 	}
 
@@ -240,9 +316,36 @@ public:
 		// Use move-assignment vs. copy-assignment for efficiency.
 		// Note that C++11 std::queue<>::front() returns a non-const reference as well as a const one, so
 		// std::move() will work here.
+		account_pull(m_underlying_queue.front());
 		x = std::move(m_underlying_queue.front());
 		m_underlying_queue.pop_front();
 
+		notify_producers_if_room(lock);
+
+		return queue_op_status::success;
+	}
+
+	/**
+	 * Non-blocking version of pull_front().
+	 *
+	 * @returns queue_op_status::success if an element was pulled into @p x, queue_op_status::empty if there was nothing to
+	 *          pull, or queue_op_status::closed if the queue is closed and empty.
+	 */
+	queue_op_status try_pull_front(ValueType& x) ATTR_NOINLINE
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if(m_underlying_queue.empty())
+		{
+			return m_closed ? queue_op_status::closed : queue_op_status::empty;
+		}
+
+		account_pull(m_underlying_queue.front());
+		x = std::move(m_underlying_queue.front());
+		m_underlying_queue.pop_front();
+
+		notify_producers_if_room(lock);
+
 		return queue_op_status::success;
 	}
 
@@ -289,10 +392,62 @@ public:
 
 private:
 
+	size_t weight_of(const ValueType &x) const { return m_weigher ? m_weigher(x) : 1; };
+
+	void account_push(const ValueType &x)
+	{
+		m_weight += weight_of(x);
+		m_high_water_mark = std::max(m_high_water_mark, m_weight);
+	}
+
+	void account_pull(const ValueType &x) { m_weight -= weight_of(x); };
+
+	bool has_room() const noexcept { return m_capacity == 0 || m_weight < m_capacity; };
+
+	/// If the queue is full, wait until it's down to the low-water mark or closed.  @a lock must hold m_mutex.
+	void wait_for_room(std::unique_lock<std::mutex> &lock)
+	{
+		if(has_room())
+		{
+			return;
+		}
+
+		++m_num_full_waits;
+		++m_num_waiting_producers;
+		m_cv_room.wait(lock, [this](){ return m_weight <= m_low_water || m_closed; });
+		--m_num_waiting_producers;
+	}
+
+	/// Wake any producers waiting for room, if there's now enough.  @a lock must hold m_mutex, and is released.
+	void notify_producers_if_room(std::unique_lock<std::mutex> &lock)
+	{
+		if(m_num_waiting_producers != 0 && m_weight <= m_low_water)
+		{
+			lock.unlock();
+			m_cv_room.notify_all();
+		}
+	}
+
 	mutable std::mutex m_mutex;
 
 	std::condition_variable m_cv;
 
+	/// Producers waiting for room in a bounded queue wait on this.
+	std::condition_variable m_cv_room;
+
+	/// @name Capacity, if bounded.
+	/// @{
+	size_t m_capacity { 0 };
+	size_t m_low_water { 0 };
+	weigher_type m_weigher;
+	size_t m_num_waiting_producers { 0 };
+	size_t m_num_full_waits { 0 };
+	/// @}
+
+	/// Total weight of the elements in the queue, and the most it's ever been.
+	size_t m_weight { 0 };
+	size_t m_high_water_mark { 0 };
+
 	std::condition_variable m_cv_complete;
 
 	size_t m_num_waiting_threads_notification_level { 500 };
@@ -26,7 +26,12 @@
 
 #include <config.h>
 
-#ifdef USE_SYNC_QUEUE_BOOST
+#if defined(USE_SYNC_QUEUE_MPMC)
+#include "mpmc_sync_queue.h"
+
+template <typename ValueType>
+using sync_queue = mpmc_sync_queue<ValueType>;
+#elif defined(USE_SYNC_QUEUE_BOOST)
 #include <boost/thread/sync_queue.hpp>
 
 using boost::concurrent::sync_queue;
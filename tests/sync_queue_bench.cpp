@@ -0,0 +1,167 @@
+/*
+ * Copyright 2017 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ * Throughput benchmark for the sync_queue<> implementations: the mutex-based sync_queue<>, the lock-free
+ * mpmc_sync_queue<>, and, if configure found it, Boost.Thread's sync_queue<>.  Each is run with every power-of-two
+ * combination of producer and consumer threads from 1 up to the maximum.  The producers push their share of the items
+ * one at a time, the consumers pull until the queue is closed, and the items per second are reported.
+ *
+ * Usage: sync_queue_bench [NUM_ITEMS [MAX_THREADS]]
+ */
+
+#include <config.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "sync_queue.h"
+#include "mpmc_sync_queue.h"
+#if HAVE_BOOST_SYNC_QUEUE
+#include <boost/thread/concurrent_queues/sync_queue.hpp>
+#endif
+
+#if HAVE_BOOST_SYNC_QUEUE
+/// Boost's sync_queue<> has since renamed push_back() and pull_front(), so adapt it to ours.
+template <typename ValueType>
+class boost_sync_queue_adapter
+{
+public:
+	queue_op_status push_back(ValueType&& x)
+	{
+		return m_queue.try_push(std::move(x)) == boost::concurrent::queue_op_status::closed
+				? queue_op_status::closed : queue_op_status::success;
+	}
+
+	queue_op_status pull_front(ValueType& x)
+	{
+		return m_queue.wait_pull(x) == boost::concurrent::queue_op_status::closed
+				? queue_op_status::closed : queue_op_status::success;
+	}
+
+	void close() { m_queue.close(); };
+
+private:
+	boost::concurrent::sync_queue<ValueType> m_queue;
+};
+#endif
+
+/**
+ * Push @a num_items items through a new QueueType with @a num_producers and @a num_consumers threads.
+ *
+ * @returns The elapsed time in seconds, or a negative number if any items went missing.
+ */
+template <typename QueueType>
+static double run_one(size_t num_items, int num_producers, int num_consumers)
+{
+	QueueType queue;
+	std::atomic<size_t> sum {0};
+	std::atomic<int> num_producers_left {num_producers};
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for(int c=0; c<num_consumers; ++c)
+	{
+		threads.emplace_back([&](){
+			size_t local_sum = 0;
+			size_t value;
+			while(queue.pull_front(value) != queue_op_status::closed)
+			{
+				local_sum += value;
+			}
+			sum += local_sum;
+		});
+	}
+	for(int p=0; p<num_producers; ++p)
+	{
+		threads.emplace_back([&, p](){
+			// Producer p pushes 1, 2, ... for every item i with i % num_producers == p.
+			for(size_t i=p; i<num_items; i+=num_producers)
+			{
+				queue.push_back(i+1);
+			}
+			if(--num_producers_left == 0)
+			{
+				queue.close();
+			}
+		});
+	}
+	for(auto &t : threads)
+	{
+		t.join();
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	if(sum.load() != num_items*(num_items+1)/2)
+	{
+		return -1.0;
+	}
+	return elapsed.count();
+}
+
+template <typename QueueType>
+static bool run_all(const char *name, size_t num_items, int max_threads)
+{
+	bool ok = true;
+	for(int producers=1; producers<=max_threads; producers*=2)
+	{
+		for(int consumers=1; consumers<=max_threads; consumers*=2)
+		{
+			double seconds = run_one<QueueType>(num_items, producers, consumers);
+			if(seconds < 0)
+			{
+				std::printf("%-8s %9d %9d  ITEMS LOST\n", name, producers, consumers);
+				ok = false;
+				continue;
+			}
+			std::printf("%-8s %9d %9d %12.2f\n", name, producers, consumers, num_items / seconds / 1.0e6);
+			std::fflush(stdout);
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_items = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+	int max_threads = (argc > 2) ? std::atoi(argv[2]) : 64;
+
+	if(num_items == 0 || max_threads < 1)
+	{
+		std::fprintf(stderr, "Usage: %s [NUM_ITEMS [MAX_THREADS]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::printf("%-8s %9s %9s %12s\n", "queue", "producers", "consumers", "Mitems/s");
+
+	bool ok = run_all<sync_queue<size_t>>("mutex", num_items, max_threads);
+	ok &= run_all<mpmc_sync_queue<size_t>>("mpmc", num_items, max_threads);
+#if HAVE_BOOST_SYNC_QUEUE
+	ok &= run_all<boost_sync_queue_adapter<size_t>>("boost", num_items, max_threads);
+#else
+	std::printf("(Boost.Thread's sync_queue not found by configure, not benchmarked.)\n");
+#endif
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
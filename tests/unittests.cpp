@@ -25,6 +25,16 @@
 /// @todo Microstring testing should be moved to its own file.
 #include "../src/libext/microstring.hpp"
 
+#include "../src/BufferPool.h"
+#include "../src/libext/FileDescriptorCache.h"
+#include "../src/libext/WorkStealingScheduler.hpp"
+#include "../src/libext/ConcurrentHashSet.hpp"
+#include "../src/sync_queue.h"
+#include "../src/mpmc_sync_queue.h"
+
+#include <chrono>
+#include <thread>
+
 namespace {
 
 // The fixture for testing class Foo.
@@ -143,6 +153,397 @@ TEST_F(OptimizationsTest, microstring_length)
 	EXPECT_EQ(8, ms8.length());
 }
 
+TEST(BufferPoolTest, buffers_are_padded_and_recycled)
+{
+	BufferPool pool;
+
+	char *first_data;
+	{
+		auto buffer = pool.Acquire(1000);
+		ASSERT_NE(nullptr, buffer.data());
+		EXPECT_LE(1000U, buffer.capacity());
+		for(size_t i = 0; i < BufferPool::padding_size; ++i)
+		{
+			EXPECT_EQ(0, buffer.data()[1000+i]);
+		}
+		// Dirty the padding, the next Acquire() should clean it up.
+		std::memset(buffer.data(), 'x', 1000+BufferPool::padding_size);
+		first_data = buffer.data();
+	}
+
+	// Same size class, should get the same buffer back, with the padding re-zeroed.
+	auto buffer = pool.Acquire(999);
+	EXPECT_EQ(first_data, buffer.data());
+	EXPECT_EQ(0, buffer.data()[999]);
+	EXPECT_EQ(1U, pool.GetStats().m_num_allocations);
+	EXPECT_EQ(1U, pool.GetStats().m_num_pool_hits);
+
+	// A bigger request while the first buffer is still in use gets a different buffer.
+	auto big_buffer = pool.Acquire(4*1024*1024);
+	EXPECT_NE(buffer.data(), big_buffer.data());
+	EXPECT_EQ(0, big_buffer.data()[4*1024*1024]);
+	EXPECT_EQ(2U, pool.GetStats().m_num_allocations);
+}
+
+TEST(FileDescriptorCacheTest, lru_eviction_skips_pinned_descriptors)
+{
+	FileDescriptorCache cache(2);
+
+	auto k1 = FileDescriptorCache::NewKey();
+	auto k2 = FileDescriptorCache::NewKey();
+	auto k3 = FileDescriptorCache::NewKey();
+	EXPECT_NE(k1, k2);
+
+	cache.Insert(k1, dup(0));
+	cache.Insert(k2, dup(0));
+	EXPECT_FALSE(cache.Lookup(k3));
+
+	{
+		// k1 is now the most recently used, and pinned.
+		auto lease = cache.Lookup(k1);
+		ASSERT_TRUE(static_cast<bool>(lease));
+
+		// Inserting k3 should evict k2, the least recently used.
+		cache.Insert(k3, dup(0));
+		EXPECT_EQ(2U, cache.size());
+		EXPECT_FALSE(cache.Lookup(k2));
+		EXPECT_TRUE(static_cast<bool>(cache.Lookup(k3)));
+
+		// Nothing idle but k3.
+		EXPECT_TRUE(cache.ReleaseIdle());
+		EXPECT_EQ(1U, cache.size());
+	}
+
+	// The lease is gone, k1 can go now too.
+	EXPECT_TRUE(static_cast<bool>(cache.Lookup(k1)));
+	EXPECT_TRUE(cache.ReleaseIdle());
+	EXPECT_EQ(0U, cache.size());
+
+	auto stats = cache.GetStats();
+	EXPECT_EQ(3U, stats.m_num_hits);
+	EXPECT_EQ(2U, stats.m_num_misses);
+	EXPECT_EQ(3U, stats.m_num_evictions);
+}
+
+TEST(WorkStealingSchedulerTest, all_generated_work_is_done_once)
+{
+	// Each item N > 0 generates items N-1 and N-1, so one item of depth D makes 2^(D+1)-1 items in all.
+	constexpr int depth = 12;
+	constexpr size_t num_workers = 4;
+	WorkStealingScheduler<int> scheduler(num_workers);
+	std::atomic<size_t> num_done {0};
+
+	scheduler.Push(0, int{depth});
+
+	std::vector<std::thread> threads;
+	for(size_t i=0; i<num_workers; ++i)
+	{
+		threads.emplace_back([&, i](){
+			int item;
+			std::vector<int> children;
+			while(scheduler.Pull(i, item))
+			{
+				++num_done;
+				if(item > 0)
+				{
+					children.assign(2, item-1);
+					scheduler.Push(i, children);
+				}
+			}
+		});
+	}
+	for(auto &t : threads)
+	{
+		t.join();
+	}
+
+	EXPECT_EQ((1U << (depth+1)) - 1, num_done.load());
+}
+
+TEST(ConcurrentHashSetTest, each_key_is_new_exactly_once)
+{
+	// Every thread inserts the same keys, so each key should be reported as new to exactly one of them.
+	constexpr size_t num_keys = 16384;
+	constexpr size_t num_threads = 4;
+	ConcurrentHashSet<dev_ino_pair> set(num_keys / 4, 16);
+	std::atomic<size_t> num_new {0};
+
+	std::vector<std::thread> threads;
+	for(size_t t=0; t<num_threads; ++t)
+	{
+		threads.emplace_back([&, t](){
+			for(size_t k=0; k<num_keys; ++k)
+			{
+				// Walk the keys in a different order in each thread.  Odd multipliers modulo a power of two are permutations.
+				size_t i = (k * (2*t + 1)) % num_keys;
+				if(set.insert(dev_ino_pair(i % 3, i)))
+				{
+					++num_new;
+				}
+			}
+		});
+	}
+	for(auto &t : threads)
+	{
+		t.join();
+	}
+
+	EXPECT_EQ(num_keys, num_new.load());
+	EXPECT_EQ(num_keys, set.size());
+}
+
+TEST(SyncQueueTest, bounded_queue_blocks_producers_at_capacity)
+{
+	constexpr size_t capacity = 8;
+	constexpr int num_singles = 1000;
+	constexpr int num_batched = 100;
+	sync_queue<int> q;
+	q.set_capacity(capacity);
+
+	std::thread producer([&](){
+		for(int i=0; i<num_singles; ++i)
+		{
+			q.push_back(int{i});
+		}
+		std::vector<int> batch;
+		for(int i=num_singles; i<num_singles+num_batched; ++i)
+		{
+			batch.push_back(i);
+		}
+		q.push_back(batch);
+		q.close();
+	});
+
+	// Everything arrives, in order, and the queue never gets bigger than its capacity.
+	int expected = 0;
+	int value;
+	while(q.pull_front(value) != queue_op_status::closed)
+	{
+		EXPECT_EQ(expected, value);
+		++expected;
+		EXPECT_GE(capacity, q.size());
+		if(expected % 64 == 0)
+		{
+			// Let the producer fill the queue up.
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	producer.join();
+
+	EXPECT_EQ(num_singles + num_batched, expected);
+	EXPECT_LT(0U, q.num_full_waits());
+}
+
+TEST(SyncQueueTest, force_push_ignores_capacity)
+{
+	sync_queue<int> q;
+	q.set_capacity(2);
+	q.push_back(1);
+	q.push_back(2);
+
+	// This would block with push_back().
+	EXPECT_EQ(queue_op_status::success, q.force_push_back(3));
+	EXPECT_EQ(3U, q.size());
+	EXPECT_EQ(0U, q.num_full_waits());
+}
+
+TEST(SyncQueueTest, weighted_capacity_tracks_high_water_mark)
+{
+	// Capacity of 100 bytes, each string weighing its length.
+	sync_queue<std::string> q;
+	q.set_capacity(100, [](const std::string &str){ return str.size(); });
+
+	q.push_back(std::string(60, 'a'));
+	q.push_back(std::string(30, 'b'));
+	// Still under capacity, so this gets in even though it goes over.
+	q.push_back(std::string(50, 'c'));
+	EXPECT_EQ(140U, q.high_water_mark());
+
+	// Now it's full, so the next push has to wait until the queue's been pulled down to 75 bytes.
+	std::thread producer([&](){ q.push_back(std::string(10, 'd')); });
+	std::string value;
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(3U, q.size());
+	EXPECT_EQ(queue_op_status::success, q.pull_front(value));
+	EXPECT_EQ(60U, value.size());
+	// 80 bytes left, still above the low-water mark.
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(2U, q.size());
+	EXPECT_EQ(queue_op_status::success, q.pull_front(value));
+	EXPECT_EQ(30U, value.size());
+	producer.join();
+
+	EXPECT_EQ(2U, q.size());
+	EXPECT_EQ(140U, q.high_water_mark());
+}
+
+TEST(MpmcSyncQueueTest, every_item_is_pulled_exactly_once)
+{
+	constexpr size_t num_items = 100000;
+	constexpr int num_producers = 4;
+	constexpr int num_consumers = 4;
+	// A small ring, so the producers have to wait on the consumers too.
+	mpmc_sync_queue<size_t> q(64);
+	std::atomic<size_t> sum {0};
+	std::atomic<size_t> num_pulled {0};
+	std::atomic<int> num_producers_left {num_producers};
+
+	std::vector<std::thread> threads;
+	for(int c=0; c<num_consumers; ++c)
+	{
+		threads.emplace_back([&](){
+			size_t value;
+			while(q.pull_front(value) != queue_op_status::closed)
+			{
+				sum += value;
+				++num_pulled;
+			}
+		});
+	}
+	for(int p=0; p<num_producers; ++p)
+	{
+		threads.emplace_back([&, p](){
+			for(size_t i=p; i<num_items; i+=num_producers)
+			{
+				q.push_back(i+1);
+			}
+			if(--num_producers_left == 0)
+			{
+				q.close();
+			}
+		});
+	}
+	for(auto &t : threads)
+	{
+		t.join();
+	}
+
+	EXPECT_EQ(num_items, num_pulled.load());
+	EXPECT_EQ(num_items*(num_items+1)/2, sum.load());
+	EXPECT_EQ(0U, q.size());
+}
+
+TEST(MpmcSyncQueueTest, close_and_worker_completion)
+{
+	mpmc_sync_queue<int> q;
+	int value = 0;
+
+	EXPECT_EQ(queue_op_status::empty, q.try_pull_front(value));
+
+	// Wait for two consumers to be waiting on an empty queue.
+	std::vector<std::thread> consumers;
+	std::atomic<int> num_pulled {0};
+	for(int i=0; i<2; ++i)
+	{
+		consumers.emplace_back([&](){
+			int v;
+			while(q.pull_front(v) != queue_op_status::closed)
+			{
+				++num_pulled;
+			}
+		});
+	}
+	std::vector<int> values {1, 2, 3};
+	EXPECT_EQ(queue_op_status::success, q.push_back(values));
+	EXPECT_EQ(queue_op_status::success, q.wait_for_worker_completion(2));
+	EXPECT_EQ(3, num_pulled.load());
+
+	q.close();
+	for(auto &t : consumers)
+	{
+		t.join();
+	}
+	EXPECT_EQ(queue_op_status::closed, q.push_back(4));
+	EXPECT_EQ(queue_op_status::closed, q.try_pull_front(value));
+}
+
+TEST(MpmcSyncQueueTest, weighted_capacity_and_force_push)
+{
+	mpmc_sync_queue<std::string> q;
+	q.set_capacity(100, [](const std::string &str){ return str.size(); });
+
+	q.push_back(std::string(60, 'a'));
+	q.push_back(std::string(50, 'b'));
+	EXPECT_EQ(110U, q.high_water_mark());
+
+	// Over capacity, but forced pushes still get in.
+	EXPECT_EQ(queue_op_status::success, q.force_push_back(std::string(10, 'c')));
+	EXPECT_EQ(3U, q.size());
+	EXPECT_EQ(0U, q.num_full_waits());
+
+	// A normal push waits until the queue has been pulled down to 75 bytes.
+	std::thread producer([&](){ q.push_back(std::string(5, 'd')); });
+	std::string value;
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(3U, q.size());
+	EXPECT_EQ(queue_op_status::success, q.pull_front(value));
+	EXPECT_EQ(60U, value.size());
+	producer.join();
+	EXPECT_EQ(3U, q.size());
+}
+
+TEST(MpmcSyncQueueTest, weighted_stress_doesnt_lose_wakeups)
+{
+	constexpr int num_rounds = 200;
+	constexpr size_t num_items = 2000;
+	constexpr int num_producers = 3;
+	constexpr int num_consumers = 2;
+
+	for(int round = 0; round < num_rounds; ++round)
+	{
+		// A capacity of a few items' weight, so the producers are forever waiting for room.
+		mpmc_sync_queue<size_t> q;
+		q.set_capacity(64, [](const size_t &v){ return v % 32 + 1; });
+		std::atomic<size_t> sum {0};
+		std::atomic<int> num_producers_left {num_producers};
+		std::atomic<int> num_threads_done {0};
+
+		std::vector<std::thread> threads;
+		for(int c=0; c<num_consumers; ++c)
+		{
+			threads.emplace_back([&](){
+				size_t value;
+				while(q.pull_front(value) != queue_op_status::closed)
+				{
+					sum += value;
+				}
+				++num_threads_done;
+			});
+		}
+		for(int p=0; p<num_producers; ++p)
+		{
+			threads.emplace_back([&, p](){
+				for(size_t i=p; i<num_items; i+=num_producers)
+				{
+					q.push_back(i+1);
+				}
+				if(--num_producers_left == 0)
+				{
+					q.close();
+				}
+				++num_threads_done;
+			});
+		}
+
+		// A lost wakeup leaves a producer asleep forever.  Don't hang the test if that happens.
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while(num_threads_done.load() < num_producers + num_consumers && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		bool hung = (num_threads_done.load() < num_producers + num_consumers);
+		q.close();
+		for(auto &t : threads)
+		{
+			t.join();
+		}
+
+		ASSERT_FALSE(hung) << "Stalled in round " << round;
+		ASSERT_EQ(num_items*(num_items+1)/2, sum.load());
+		ASSERT_EQ(0U, q.size());
+	}
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {